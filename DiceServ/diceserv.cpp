@@ -144,6 +144,8 @@ SOFTWARE.
 
 #include <algorithm>
 #include <functional>
+#include <list>
+#include <memory>
 #include <cctype>
 #include <cmath>
 #include <cstdlib>
@@ -156,7 +158,9 @@ SOFTWARE.
 #include <emmintrin.h>
 
 static const int DICE_MAX_TIMES = 25;
-static const unsigned DICE_MAX_DICE = 99999;
+static const unsigned DICE_MAX_DICE = 999999;
+static const unsigned DICE_MAX_EXACT_SUM = 4096;
+static const int DICE_FILL_CHUNK = 256;
 static const unsigned DICE_MAX_SIDES = 99999;
 
 /** Determine if the double-precision floating point value is infinite or not.
@@ -445,6 +449,51 @@ public:
 	{
 		return static_cast<int>(std::floor(this->genrand_close_open() * (max - min + 1)) + min);
 	}
+
+	/** Generate a normally distributed random number with a mean of 0 and a standard deviation of 1.
+	 * @return A standard normal deviate
+	 *
+	 * Uses the Box-Muller transform, taking one deviate of each pair. Not part of the original dSFMT implementation.
+	 */
+	double Gaussian()
+	{
+		// 1 - [0, 1) is (0, 1], which keeps the logarithm finite
+		double u1 = 1.0 - this->genrand_close_open(), u2 = this->genrand_close_open();
+		return std::sqrt(-2.0 * std::log(u1)) * std::cos(8.0 * std::atan(1.0) * u2);
+	}
+
+	/** Fill an array with rolls of a die.
+	 * @param count The number of rolls to generate
+	 * @param sides The number of sides on the die, must be at least 1
+	 * @param out The array to store the rolls in, must have room for count values
+	 *
+	 * The rolls are taken straight from the blocks that gen_rand_all() produces instead of going through a double each. As in the reference
+	 * dSFMT's genrand_uint32, the low 32 bits of each value are used as a random integer, which is mapped to [1, sides] with Lemire's
+	 * multiply-shift. Values that would make some sides more likely than others are rejected, so every side has exactly the same chance.
+	 * Not part of the original dSFMT implementation.
+	 */
+	void FillDice(size_t count, unsigned sides, unsigned *out)
+	{
+		const uint64_t *psfmt64 = &this->status[0].u[0];
+		// 2^32 mod sides, the number of low products that have to be rejected
+		uint32_t threshold = static_cast<uint32_t>(-sides) % sides;
+
+		size_t i = 0;
+		while (i < count)
+		{
+			if (this->idx >= DSFMT_N64)
+			{
+				this->gen_rand_all();
+				this->idx = 0;
+			}
+			for (; i < count && this->idx < DSFMT_N64; ++this->idx)
+			{
+				uint64_t m = static_cast<uint64_t>(static_cast<uint32_t>(psfmt64[this->idx])) * sides;
+				if (static_cast<uint32_t>(m) >= threshold)
+					out[i++] = static_cast<unsigned>(m >> 32) + 1;
+			}
+		}
+	}
 };
 
 const dSFMT216091::X128I_T dSFMT216091::sse2_param_mask = { { DSFMT_MSK1, DSFMT_MSK2 } };
@@ -535,20 +584,6 @@ static inline unsigned is_function(const Anope::string &str, unsigned pos = 0)
 	return 0;
 }
 
-/** Determine the number of arguments that the given function needs.
- * @param str Function string to check
- * @return Returns 1 except for the min and max functions which return -2 (to say they require AT LEAST 2 arguments), and the atan2 and rand functions which return 2
- */
-static inline int function_argument_count(const Anope::string &str)
-{
-	Anope::string func_3 = str.substr(0, 3);
-	if (func_3.equals_ci("max") || func_3.equals_ci("min"))
-		return -2;
-	if (str.equals_ci("atan2") || str.equals_ci("rand"))
-		return 2;
-	return 1;
-}
-
 /** Determine if the substring portion of the given string is a constant (currently only e and pi).
  * @param str String to check
  * @param pos Starting position of the substring to check, defaults to 0
@@ -616,12 +651,48 @@ static inline int would_pop(const Anope::string &adding, const Anope::string &to
 DiceResult Dice(int num, unsigned sides)
 {
 	DiceResult result = DiceResult(num, sides);
-	for (int i = 0; i < num; ++i)
-		// Get a random number between 1 and the number of sides
-		result.AddResult(sfmtRNG.Random(1, sides));
+	unsigned rolls[DICE_FILL_CHUNK];
+	for (int done = 0; done < num; done += DICE_FILL_CHUNK)
+	{
+		int count = std::min(num - done, DICE_FILL_CHUNK);
+		// Get random numbers between 1 and the number of sides
+		sfmtRNG.FillDice(count, sides, rolls);
+		for (int i = 0; i < count; ++i)
+			result.AddResult(rolls[i]);
+	}
 	return result;
 }
 
+/** Calculate the total of a die roll without keeping the individual dice.
+ * @param num Number of times to throw the die
+ * @param sides Number of sides on the die
+ * @return The sum of all the dice thrown
+ *
+ * Up to DICE_MAX_EXACT_SUM dice are thrown one at a time. Larger pools are drawn from the normal distribution with the exact mean and
+ * variance of the sum, n(s + 1) / 2 and n(s^2 - 1) / 12, rounded to a whole number and kept within the possible totals. With that many
+ * dice the sum is already normal to well within what a roll can show, and it costs the same however many dice are thrown.
+ */
+static uint64_t DiceSum(int num, unsigned sides)
+{
+	if (num <= static_cast<int>(DICE_MAX_EXACT_SUM))
+	{
+		uint64_t sum = 0;
+		unsigned rolls[DICE_FILL_CHUNK];
+		for (int done = 0; done < num; done += DICE_FILL_CHUNK)
+		{
+			int count = std::min(num - done, DICE_FILL_CHUNK);
+			sfmtRNG.FillDice(count, sides, rolls);
+			for (int i = 0; i < count; ++i)
+				sum += rolls[i];
+		}
+		return sum;
+	}
+	double n = num, s = sides;
+	double mean = n * (s + 1) / 2, deviation = std::sqrt(n * (s * s - 1) / 12);
+	double sum = std::floor(mean + deviation * sfmtRNG.Gaussian() + 0.5);
+	return static_cast<uint64_t>(std::max(n, std::min(sum, n * s)));
+}
+
 /** Round a value to the given number of decimals, originally needed for Windows but also used for other OSes as well due to undefined references.
  * @param val The value to round
  * @param decimals The number of digits after the decimal point, defaults to 0
@@ -1004,259 +1075,246 @@ static Infix TokenizeInfix(const Infix &infix)
 	return Infix(newinfix, positions);
 }
 
-/** Enumeration for PostfixValue to determine its type */
-enum PostfixValueType
-{
-	POSTFIX_VALUE_NONE,
-	POSTFIX_VALUE_DOUBLE,
-	POSTFIX_VALUE_STRING
+/** Enumeration of the instructions of a compiled expression */
+enum PostfixOpcode
+{
+	// Pushes the instruction's number
+	POSTFIX_NUMBER,
+	// Stops the evaluation with the expression's stack error, see Postfix
+	POSTFIX_ERROR,
+	// The operators, each pops 2 values and pushes the result
+	POSTFIX_ADD,
+	POSTFIX_SUBTRACT,
+	POSTFIX_MULTIPLY,
+	POSTFIX_DIVIDE,
+	POSTFIX_MODULUS,
+	POSTFIX_POWER,
+	POSTFIX_DICE,
+	// The functions, each pops its arguments and pushes the result, in the same order as postfix_functions below
+	POSTFIX_ABS,
+	POSTFIX_ACOS,
+	POSTFIX_ACOSH,
+	POSTFIX_ASIN,
+	POSTFIX_ASINH,
+	POSTFIX_ATAN,
+	POSTFIX_ATAN2,
+	POSTFIX_ATANH,
+	POSTFIX_CBRT,
+	POSTFIX_CEIL,
+	POSTFIX_COS,
+	POSTFIX_COSH,
+	POSTFIX_DEG,
+	POSTFIX_EXP,
+	POSTFIX_FAC,
+	POSTFIX_FLOOR,
+	POSTFIX_LOG,
+	POSTFIX_LOG10,
+	POSTFIX_MAX,
+	POSTFIX_MIN,
+	POSTFIX_RAD,
+	POSTFIX_RAND,
+	POSTFIX_ROUND,
+	POSTFIX_SIN,
+	POSTFIX_SINH,
+	POSTFIX_SQRT,
+	POSTFIX_TAN,
+	POSTFIX_TANH,
+	POSTFIX_TRUNC
 };
 
-/** Base class for values in a postfix equation */
-class PostfixValueBase
+/** Structure describing a function the parser recognizes */
+struct PostfixFunction
 {
-	/** The type for the value */
-	PostfixValueType type;
-
-protected:
-	/** When overridden, will be used to delete memory allocated.
-	 */
-	virtual void Clear() = 0;
-
-public:
-	/** Constructor that take the type for the value.
-	 */
-	PostfixValueBase(PostfixValueType t) : type(t)
-	{
-	}
-
-	/** Destructor, virtual so that derived classes can call the Clear function.
-	 */
-	virtual ~PostfixValueBase()
-	{
-	}
-
-	/** Gets the type of the value.
-	 * @return The value's type
-	 */
-	PostfixValueType Type() const
-	{
-		return this->type;
-	}
-
-	/** Creates a clone of the value.
-	 * @return A clone of the value
-	 */
-	virtual PostfixValueBase *Clone() const = 0;
+	/** The name of the function, as shown in extended output */
+	const char *name;
+	/** The number of arguments the function takes, or the negated minimum for the functions taking a variable number of them */
+	int arguments;
 };
 
-/** Version of PostfixValue for double (this is used for numbers) */
-class PostfixValueDouble : public PostfixValueBase
+/** The functions the parser recognizes, in the same order as their opcodes */
+static const PostfixFunction postfix_functions[] =
 {
-	/** The value */
-	double *val;
-
-protected:
-	/** Deletes the value to prevent memory leaks.
-	 */
-	void Clear()
-	{
-		delete this->val;
-	}
-
-public:
-	/** Constructor that takes the value to store.
-	 */
-	PostfixValueDouble(double Val) : PostfixValueBase(POSTFIX_VALUE_DOUBLE), val(new double(Val))
-	{
-	}
-
-	/** Copy constructor, duplicates the value.
-	 */
-	PostfixValueDouble(const PostfixValueDouble &Val) : PostfixValueBase(POSTFIX_VALUE_DOUBLE), val(Val.val ? new double(*Val.val) : NULL)
-	{
-	}
+	{ "abs", 1 }, { "acos", 1 }, { "acosh", 1 }, { "asin", 1 }, { "asinh", 1 }, { "atan", 1 }, { "atan2", 2 }, { "atanh", 1 },
+	{ "cbrt", 1 }, { "ceil", 1 }, { "cos", 1 }, { "cosh", 1 }, { "deg", 1 }, { "exp", 1 }, { "fac", 1 }, { "floor", 1 }, { "log", 1 },
+	{ "log10", 1 }, { "max", -2 }, { "min", -2 }, { "rad", 1 }, { "rand", 2 }, { "round", 1 }, { "sin", 1 }, { "sinh", 1 },
+	{ "sqrt", 1 }, { "tan", 1 }, { "tanh", 1 }, { "trunc", 1 }
+};
 
-	/** Destructor, deletes value.
-	 */
-	~PostfixValueDouble()
-	{
-		this->Clear();
-	}
+/** Gets the description of a function from its opcode.
+ * @param opcode The opcode of the function
+ * @return The function's description
+ */
+static inline const PostfixFunction &postfix_function(PostfixOpcode opcode)
+{
+	return postfix_functions[opcode - POSTFIX_ABS];
+}
 
-	/** Assignment operator, will make sure to only allocate memory when needed.
-	 * @param Val The value to copy into the current instance
-	 * @return A reference of the current instance, for operator chaining purposes
-	 */
-	PostfixValueDouble &operator=(const PostfixValueDouble &Val)
-	{
-		if (this != &Val && Val.val)
+/** Gets the opcode of an operator or function.
+ * @param token The operator or the name of the function, as found by the parser
+ * @return The opcode, or POSTFIX_NUMBER if the token is neither
+ */
+static PostfixOpcode postfix_opcode(const Anope::string &token)
+{
+	if (token.length() == 1)
+		switch (token[0])
 		{
-			if (this->val)
-				*this->val = *Val.val;
-			else
-				this->val = new double(*Val.val);
+			case '+':
+				return POSTFIX_ADD;
+			case '-':
+				return POSTFIX_SUBTRACT;
+			case '*':
+				return POSTFIX_MULTIPLY;
+			case '/':
+				return POSTFIX_DIVIDE;
+			case '%':
+				return POSTFIX_MODULUS;
+			case '^':
+				return POSTFIX_POWER;
+			case 'd':
+			case 'D':
+				return POSTFIX_DICE;
 		}
-		return *this;
-	}
-
-	/** Gets the value.
-	 * @return The value
-	 */
-	const double *Get() const
-	{
-		return this->val;
-	}
+	for (unsigned y = 0, count = sizeof(postfix_functions) / sizeof(*postfix_functions); y < count; ++y)
+		if (token.equals_ci(postfix_functions[y].name))
+			return static_cast<PostfixOpcode>(POSTFIX_ABS + y);
+	return POSTFIX_NUMBER;
+}
 
-	/** Creates a clone of the value.
-	 * @return A clone of the value
-	 */
-	PostfixValueDouble *Clone() const
-	{
-		return new PostfixValueDouble(*this);
-	}
+/** A single instruction of a compiled expression */
+struct PostfixInstruction
+{
+	/** What the instruction does */
+	PostfixOpcode opcode;
+	/** The number of arguments, only used by the functions taking a variable number of them */
+	unsigned arity;
+	/** The number to push, only used by POSTFIX_NUMBER */
+	double value;
 };
 
-/** Version of PostfixValue for Anope::string (this is used for anything that isn't a number) */
-class PostfixValueString : public PostfixValueBase
+/** A compiled expression: a flat list of instructions for a stack machine.
+ *
+ * The stack is tracked as the instructions are added, and the deepest it gets is recorded so the evaluation can set aside enough
+ * room for it up front. An instruction that would pop more values than there are, or an expression that leaves more than one
+ * value behind, is replaced by a POSTFIX_ERROR instruction and nothing more is added. The error is only reported when the
+ * evaluation gets that far, so the dice rolled before it and any error they cause come first, the same as before the
+ * expression was compiled.
+ */
+class Postfix
 {
-	/** The value */
-	Anope::string *val;
-
-protected:
-	/** Deletes the value to prevent memory leaks.
-	 */
-	void Clear()
-	{
-		delete this->val;
-	}
-
-public:
-	/** Constructor that takes the value to store.
-	 */
-	PostfixValueString(const Anope::string &Val) : PostfixValueBase(POSTFIX_VALUE_STRING), val(new Anope::string(Val))
-	{
-	}
+	/** The instructions, in the order they are executed */
+	std::vector<PostfixInstruction> code;
+	/** The number of values on the stack after the last instruction, and the most there were at any point */
+	unsigned depth, max_depth;
+	/** The message for the POSTFIX_ERROR instruction, if there is one */
+	Anope::string error;
 
-	/** Copy constructor, duplicates the value.
+	/** Ends the expression with an error instruction.
+	 * @param message The message for the error
 	 */
-	PostfixValueString(const PostfixValueString &Val) : PostfixValueBase(POSTFIX_VALUE_STRING), val(Val.val ? new Anope::string(*Val.val) : NULL)
+	void Fail(const Anope::string &message)
 	{
+		PostfixInstruction instruction = { POSTFIX_ERROR, 0, 0.0 };
+		this->code.push_back(instruction);
+		this->error = message;
 	}
 
-	/** Destructor, deletes value.
+	/** Checks that there are enough values on the stack for an instruction and accounts for its result.
+	 * @param pops The number of values the instruction pops
+	 * @param message The error to give if there aren't enough values
+	 * @return true if there were enough values, false if the expression was ended with an error instead
 	 */
-	~PostfixValueString()
+	bool Pop(unsigned pops, const Anope::string &message)
 	{
-		this->Clear();
-	}
-
-	/** Assignment operator, will make sure to only allocate memory when needed.
-	 * @param Val The value to copy into the current instance
-	 * @return A reference of the current instance, for operator chaining purposes
-	 */
-	PostfixValueString &operator=(const PostfixValueString &Val)
-	{
-		if (this != &Val && Val.val)
+		if (this->depth < pops)
 		{
-			if (this->val)
-				*this->val = *Val.val;
-			else
-				this->val = new Anope::string(*Val.val);
+			this->Fail(message);
+			return false;
 		}
-		return *this;
+		this->depth -= pops - 1;
+		return true;
 	}
 
-	/** Gets the value.
-	 * @return The value
-	 */
-	const Anope::string *Get() const
-	{
-		return this->val;
-	}
-
-	/** Creates a clone of the value.
-	 * @return A clone of the value
-	 */
-	PostfixValueString *Clone() const
+public:
+	Postfix() : code(), depth(0), max_depth(0), error()
 	{
-		return new PostfixValueString(*this);
 	}
-};
-
-/** Container for the list of Postfix values */
-class Postfix
-{
-	/** A vector storing the list of Postfix values */
-	std::vector<PostfixValueBase *> values;
 
-public:
-	/** Default constructor, creates an empty list.
+	/** Clears the list.
 	 */
-	Postfix() : values()
+	void clear()
 	{
+		this->code.clear();
+		this->depth = this->max_depth = 0;
+		this->error.clear();
 	}
 
-	/** Copy constructor, will copy all values from another instance to this one.
+	/** Determine if the expression ends with an error instruction.
+	 * @return true if it does, false otherwise
 	 */
-	Postfix(const Postfix &postfix) : values()
+	bool failed() const
 	{
-		this->append(postfix);
+		return !this->code.empty() && this->code.back().opcode == POSTFIX_ERROR;
 	}
 
-	/** Destructor, will clear the list.
+	/** Adds an instruction that pushes a number.
+	 * @param number The number to push
 	 */
-	~Postfix()
+	void add(double number)
 	{
-		this->clear();
+		if (this->failed())
+			return;
+		PostfixInstruction instruction = { POSTFIX_NUMBER, 0, number };
+		this->code.push_back(instruction);
+		if (++this->depth > this->max_depth)
+			this->max_depth = this->depth;
 	}
 
-	/** Assignment operator, will copy all values from one instance to this one, making sure to avoid memory leaks.
-	 * @param postfix The instance to copy values from
-	 * @return A reference of the current instance, for operator chaining purposes
+	/** Adds an operator or function.
+	 * @param token The operator or the name of the function
+	 * @param arity The number of arguments given, only used by the functions taking a variable number of them
 	 */
-	Postfix &operator=(const Postfix &postfix)
+	void add(const Anope::string &token, unsigned arity = 0)
 	{
-		if (this != &postfix)
+		if (this->failed())
+			return;
+		PostfixOpcode opcode = postfix_opcode(token);
+		if (opcode == POSTFIX_NUMBER)
 		{
-			this->clear();
-			this->append(postfix);
+			this->Fail(_("Something went wrong while evaluating that roll (empty token)."));
+			return;
 		}
-		return *this;
-	}
-
-	/** Clears the list, deleting the allocated memory to prevent memory leaks.
-	 */
-	void clear()
-	{
-		for (unsigned y = 0, len = this->values.size(); y < len; ++y)
-			delete this->values[y];
-		this->values.clear();
-	}
-
-	/** Adds a new double value to the list.
-	 * @param dbl The double value to add
-	 */
-	void add(double dbl)
-	{
-		this->values.push_back(new PostfixValueDouble(dbl));
-	}
-
-	/** Adds a new string value to the list.
-	 * @param str The string value to add
-	 */
-	void add(const Anope::string &str)
-	{
-		this->values.push_back(new PostfixValueString(str));
+		if (opcode < POSTFIX_ABS)
+		{
+			if (!this->Pop(2, _("That operator doesn't have enough numbers to work with.")))
+				return;
+		}
+		else
+		{
+			int function_arguments = postfix_function(opcode).arguments;
+			if (function_arguments < 0)
+			{
+				if (arity < static_cast<unsigned>(-function_arguments))
+				{
+					this->Fail("Function needs at least " + ds_stringify(-function_arguments) + " arguments, but got " + ds_stringify(arity) + ".");
+					return;
+				}
+				function_arguments = arity;
+			}
+			else
+				arity = function_arguments;
+			if (!this->Pop(function_arguments, _("That function doesn't have enough numbers to work with.")))
+				return;
+		}
+		PostfixInstruction instruction = { opcode, arity, 0.0 };
+		this->code.push_back(instruction);
 	}
 
-	/** Appends another instance to this one.
-	 * @param postfix The instance to append from
+	/** Ends the expression with an error if it doesn't leave exactly one value behind, the result.
 	 */
-	void append(const Postfix &postfix)
+	void finish()
 	{
-		for (unsigned y = 0, len = postfix.values.size(); y < len; ++y)
-			this->values.push_back(postfix.values[y]->Clone());
+		if (!this->failed() && this->depth != 1)
+			this->Fail(_("That expression has too many numbers and can't be evaluated as written."));
 	}
 
 	/** Determine if the list is empty or not.
@@ -1264,7 +1322,7 @@ public:
 	 */
 	bool empty() const
 	{
-		return this->values.empty();
+		return this->code.empty();
 	}
 
 	/** Gets the size of the list.
@@ -1272,26 +1330,32 @@ public:
 	 */
 	size_t size() const
 	{
-		return this->values.size();
+		return this->code.size();
+	}
+
+	/** Gets the most values that are on the stack at once while evaluating the expression.
+	 * @return The stack depth needed
+	 */
+	unsigned stack_depth() const
+	{
+		return this->max_depth;
 	}
 
-	/** Subscript operator, will get the value at the given index.
-	 * @param index The index to look at
-	 * @return The value for the given index
+	/** Gets the message of the POSTFIX_ERROR instruction.
+	 * @return The message, empty if the expression has no error instruction
 	 */
-	PostfixValueBase *operator[](unsigned index)
+	const Anope::string &error_message() const
 	{
-		if (index >= this->values.size())
-			return NULL;
-		return this->values[index];
+		return this->error;
 	}
 
-	/** Same as above, but for const safety. */
-	const PostfixValueBase *operator[](unsigned index) const
+	/** Subscript operator, will get the instruction at the given index.
+	 * @param index The index to look at, must be less than size()
+	 * @return The instruction for the given index
+	 */
+	const PostfixInstruction &operator[](unsigned index) const
 	{
-		if (index >= this->values.size())
-			return NULL;
-		return this->values[index];
+		return this->code[index];
 	}
 };
 
@@ -1319,9 +1383,9 @@ public:
  * - If there were operators left on the operator stack, pop all of them, failing if anything is left on the stack (an open
  *   parenthesis will cause this).
  *
- * Of special note, when a function is being popped from the operator stack, if the function is allowed to take a variable
- * number of arguments, the number of arguments from the arity stack will be appended to the function's name, with an underscore
- * before that. The arity stack will be popped regardless.
+ * Of special note, when a function is being popped from the operator stack, the number of arguments from the arity stack is
+ * stored with it, functions that take a variable number of arguments need it. The arity stack will be popped regardless.
+ * Operators and function names are turned into opcodes as they are added.
  *
  * The improvement to the shunting-yard algorithm to allow functions to have arbitrary numbers of arguments comes from:
  * https://blog.kallisti.net.nz/2008/02/extension-to-the-shunting-yard-algorithm-to-allow-variable-numbers-of-arguments-to-functions/
@@ -1433,17 +1497,13 @@ static Postfix InfixToPostfix(DiceServData &data, const Infix &infix)
 				{
 					while (would_pop(token, lastone))
 					{
+						unsigned arity = 0;
 						if (is_function(lastone))
 						{
-							if (function_argument_count(lastone) < 0)
-							{
-								unsigned arity = arity_stack.top();
-									Anope::string arityStr = ds_stringify(arity);
-								lastone += "_" + arityStr;
-							}
+							arity = arity_stack.top();
 							arity_stack.pop();
 						}
-						postfix.add(lastone);
+						postfix.add(lastone, arity);
 						op_stack.pop();
 						lastone = op_stack.empty() ? "" : op_stack.top();
 					}
@@ -1503,17 +1563,13 @@ static Postfix InfixToPostfix(DiceServData &data, const Infix &infix)
 		lastone = op_stack.top();
 		while (would_pop("", lastone))
 		{
+			unsigned arity = 0;
 			if (is_function(lastone))
 			{
-				if (function_argument_count(lastone) < 0)
-				{
-					unsigned arity = arity_stack.top();
-								Anope::string arityStr = ds_stringify(arity);
-					lastone += "_" + arityStr;
-				}
+				arity = arity_stack.top();
 				arity_stack.pop();
 			}
-			postfix.add(lastone);
+			postfix.add(lastone, arity);
 			op_stack.pop();
 			if (op_stack.empty())
 				break;
@@ -1529,66 +1585,152 @@ static Postfix InfixToPostfix(DiceServData &data, const Infix &infix)
 			return postfix;
 		}
 	}
+	postfix.finish();
 	return postfix;
 }
 
+/** The stack depth the evaluation handles without allocating, deeper expressions are rare */
+static const unsigned POSTFIX_FIXED_STACK = 64;
+
 /** Evaluate a postfix notation equation.
  * @param The postfix notation equation to evaluate
  * @return The final result after calculation of the equation
  *
  * The evaluation pops the required values from the operand stack for a function, and 2 values from the operand stack for an operator. The result
- * of either one is placed back on the operand stack, hopefully leaving a single result at the end.
+ * of either one is placed back on the operand stack, leaving a single result at the end. The equation was checked when it was compiled, so the
+ * stack can neither run out of values nor grow beyond the depth recorded for it. An equation that would have run out stops at its POSTFIX_ERROR.
  */
 static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 {
+	double fixed_stack[POSTFIX_FIXED_STACK];
+	std::vector<double> large_stack;
+	double *num_stack = fixed_stack;
+	if (postfix.stack_depth() > POSTFIX_FIXED_STACK)
+	{
+		large_stack.resize(postfix.stack_depth());
+		num_stack = &large_stack[0];
+	}
+	unsigned top = 0; // The number of values on the stack
 	double val = 0;
-	std::stack<double> num_stack;
 	for (unsigned x = 0, len = postfix.size(); x < len; ++x)
 	{
-		if (postfix[x]->Type() == POSTFIX_VALUE_STRING)
+		const PostfixInstruction &instruction = postfix[x];
+		if (instruction.opcode == POSTFIX_NUMBER)
+			num_stack[top++] = instruction.value;
+		else if (instruction.opcode == POSTFIX_ERROR)
 		{
-			const Anope::string *token_ptr = anope_dynamic_static_cast<const PostfixValueString *>(postfix[x])->Get();
-			Anope::string token = token_ptr ? *token_ptr : "";
-			if (token.empty())
-			{
-				data.errCode = DICE_ERROR_STACK;
-				data.errStr = _("Something went wrong while evaluating that roll (empty token).");
-				return 0;
-			}
-			if (is_function(token))
+			data.errCode = DICE_ERROR_STACK;
+			data.errStr = postfix.error_message();
+			return 0;
+		}
+		else if (instruction.opcode < POSTFIX_ABS)
+		{
+			double val2 = num_stack[--top];
+			double val1 = num_stack[--top];
+			switch (instruction.opcode)
 			{
-				int function_arguments = function_argument_count(token);
-				if (function_arguments < 0)
-				{
-					size_t underscore = token.find('_');
-									int real_function_arguments = Anope::Convert<int>(token.substr(underscore + 1), 0);
-					token = token.substr(0, underscore);
-					if (real_function_arguments < -function_arguments)
+				case POSTFIX_ADD:
+					val = val1 + val2;
+					break;
+				case POSTFIX_SUBTRACT:
+					val = val1 - val2;
+					break;
+				case POSTFIX_MULTIPLY:
+					val = val1 * val2;
+					break;
+				case POSTFIX_DIVIDE:
+					// Prevent division by 0
+					if (!val2)
 					{
-						data.errCode = DICE_ERROR_STACK;
-						data.errStr = "Function needs at least " + ds_stringify(-function_arguments) + " arguments, but got " +
-							ds_stringify(real_function_arguments) + ".";
+						data.errCode = DICE_ERROR_DIV0;
 						return 0;
 					}
-					function_arguments = real_function_arguments;
-				}
-				if (num_stack.empty() || num_stack.size() < static_cast<unsigned>(function_arguments))
+					val = val1 / val2;
+					break;
+				case POSTFIX_MODULUS:
+					// Prevent division by 0
+					if (!val2)
+					{
+						data.errCode = DICE_ERROR_DIV0;
+						return 0;
+					}
+					val = std::fmod(val1, val2);
+					break;
+				case POSTFIX_POWER:
+					// Because imaginary numbers are not being used, it is impossible to take the power of a negative number to a non-integer exponent
+					if (val1 < 0 && static_cast<int>(val2) != val2)
+					{
+						data.errCode = DICE_ERROR_UNDEFINED;
+						return 0;
+					}
+					// Prevent division by 0
+					if (!val1 && !val2)
+					{
+						data.errCode = DICE_ERROR_DIV0;
+						return 0;
+					}
+					// 0 to a negative power is invalid
+					if (!val1 && val2 < 0)
+					{
+						data.errCode = DICE_ERROR_OVERUNDERFLOW;
+						return 0;
+					}
+					val = std::pow(val1, val2);
+					break;
+				case POSTFIX_DICE:
 				{
-					data.errCode = DICE_ERROR_STACK;
-					data.errStr = _("That function doesn't have enough numbers to work with.");
-					return 0;
+					// Make sure both the number of dice and the number of sides are within acceptable ranges
+					if (val1 < 1 || val1 > DICE_MAX_DICE)
+					{
+						data.errCode = DICE_ERROR_UNACCEPTABLE_DICE;
+						data.errNum = static_cast<int>(val1);
+						return 0;
+					}
+					if (val2 < 1 || val2 > DICE_MAX_SIDES)
+					{
+						data.errCode = DICE_ERROR_UNACCEPTABLE_SIDES;
+						data.errNum = static_cast<int>(val2);
+						return 0;
+					}
+					int num = static_cast<int>(val1);
+					unsigned sides = static_cast<unsigned>(val2);
+					// Only extended output lists the individual dice, and only when the whole roll leaves room for at least a digit and a space per die
+					if (!data.isExtended)
+						val = DiceSum(num, sides);
+					else
+					{
+						if (!data.diceUnlisted && 2 * (static_cast<uint64_t>(data.listedDice) + num) > static_cast<uint64_t>(data.maxMessageLength))
+							data.UnlistDice();
+						DiceResult result = data.diceUnlisted ? DiceResult(num, sides) : Dice(num, sides);
+						if (data.diceUnlisted)
+							result.SetSum(DiceSum(num, sides));
+						else
+							data.listedDice += num;
+						data.AddToOpResults(result);
+						val = result.Value();
+					}
+					break;
 				}
-				double val1 = num_stack.top();
-				num_stack.pop();
-				FunctionResult result;
-				if (token.equals_ci("abs"))
-				{
+				default:
+					break;
+			}
+			if (is_infinite(val) || is_notanumber(val))
+			{
+				data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
+				return 0;
+			}
+			num_stack[top++] = val;
+		}
+		else
+		{
+			FunctionResult result;
+			double val1 = num_stack[--top];
+			switch (instruction.opcode)
+			{
+				case POSTFIX_ABS:
 					val = std::abs(val1);
-					result.SetNameAndResult("abs", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("acos"))
-				{
+					break;
+				case POSTFIX_ACOS:
 					// Arc cosine is undefined outside the domain [-1, 1]
 					if (std::abs(val1) > 1)
 					{
@@ -1596,11 +1738,8 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = std::acos(val1);
-					result.SetNameAndResult("acos", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("acosh"))
-				{
+					break;
+				case POSTFIX_ACOSH:
 					// Inverse hyperbolic cosine is undefined for any value less than 1
 					if (val1 < 1)
 					{
@@ -1608,11 +1747,8 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = acosh(val1);
-					result.SetNameAndResult("acosh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("asin"))
-				{
+					break;
+				case POSTFIX_ASIN:
 					// Arc sine is undefined outside the domain [-1, 1]
 					if (std::abs(val1) > 1)
 					{
@@ -1620,33 +1756,23 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = std::asin(val1);
-					result.SetNameAndResult("asin", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("asinh"))
-				{
+					break;
+				case POSTFIX_ASINH:
 					val = asinh(val1);
-					result.SetNameAndResult("asinh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("atan"))
-				{
+					break;
+				case POSTFIX_ATAN:
 					val = std::atan(val1);
-					result.SetNameAndResult("atan", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("atan2"))
+					break;
+				case POSTFIX_ATAN2:
 				{
 					double val2 = val1;
-					val1 = num_stack.top();
-					num_stack.pop();
+					val1 = num_stack[--top];
 					val = std::atan2(val1, val2);
-					result.SetNameAndResult("atan2", val);
 					result.AddArgument(val1);
 					result.AddArgument(val2);
+					break;
 				}
-				else if (token.equals_ci("atanh"))
-				{
+				case POSTFIX_ATANH:
 					// Inverse hyperbolic tangent is undefined outside the domain (-1, 1)
 					if (std::abs(val1) >= 1)
 					{
@@ -1654,47 +1780,26 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = atanh(val1);
-					result.SetNameAndResult("atanh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("cbrt"))
-				{
+					break;
+				case POSTFIX_CBRT:
 					val = cbrt(val1);
-					result.SetNameAndResult("cbrt", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("ceil"))
-				{
+					break;
+				case POSTFIX_CEIL:
 					val = std::ceil(val1);
-					result.SetNameAndResult("ceil", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("cos"))
-				{
+					break;
+				case POSTFIX_COS:
 					val = std::cos(val1);
-					result.SetNameAndResult("cos", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("cosh"))
-				{
+					break;
+				case POSTFIX_COSH:
 					val = std::cosh(val1);
-					result.SetNameAndResult("cosh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("deg"))
-				{
+					break;
+				case POSTFIX_DEG:
 					val = val1 * 45.0 / std::atan(1.0);
-					result.SetNameAndResult("deg", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("exp"))
-				{
+					break;
+				case POSTFIX_EXP:
 					val = std::exp(val1);
-					result.SetNameAndResult("exp", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("fac"))
-				{
+					break;
+				case POSTFIX_FAC:
 					// Negative factorials are considered undefined
 					if (static_cast<int>(val1) < 0)
 					{
@@ -1710,17 +1815,12 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 					val = 1;
 					for (unsigned n = 2; n <= static_cast<unsigned>(val1); ++n)
 						val *= n;
-					result.SetNameAndResult("fac", val);
 					result.AddArgument(static_cast<unsigned>(val1));
-				}
-				else if (token.equals_ci("floor"))
-				{
+					break;
+				case POSTFIX_FLOOR:
 					val = std::floor(val1);
-					result.SetNameAndResult("floor", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("log"))
-				{
+					break;
+				case POSTFIX_LOG:
 					// Logarithm is invalid for values 0 or less
 					if (val1 <= 0)
 					{
@@ -1728,11 +1828,8 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = std::log(val1);
-					result.SetNameAndResult("log", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("log10"))
-				{
+					break;
+				case POSTFIX_LOG10:
 					// Logarithm is invalid for values 0 or less
 					if (val1 <= 0)
 					{
@@ -1740,89 +1837,42 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = std::log10(val1);
-					result.SetNameAndResult("log10", val);
+					break;
+				case POSTFIX_MAX:
+				case POSTFIX_MIN:
+					// The arguments are still on the stack below the last one, fold them from the right and show them from the left
+					top -= instruction.arity - 1;
+					val = val1;
+					for (unsigned y = instruction.arity - 1; y-- > 0;)
+						val = instruction.opcode == POSTFIX_MAX ? std::max(num_stack[top + y], val) : std::min(num_stack[top + y], val);
+					for (unsigned y = 0; y + 1 < instruction.arity; ++y)
+						result.AddArgument(num_stack[top + y]);
 					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("max"))
-				{
-					std::stack<double> args;
-					args.push(val1);
-					for (int i = 1; i < function_arguments; ++i)
-					{
-						double val2 = val1;
-						val1 = num_stack.top();
-						num_stack.pop();
-						args.push(val1);
-						val = val1 = std::max(val1, val2);
-					}
-					result.SetNameAndResult("max", val);
-					while (!args.empty())
-					{
-						result.AddArgument(args.top());
-						args.pop();
-					}
-				}
-				else if (token.equals_ci("min"))
-				{
-					std::stack<double> args;
-					args.push(val1);
-					for (int i = 1; i < function_arguments; ++i)
-					{
-						double val2 = val1;
-						val1 = num_stack.top();
-						num_stack.pop();
-						args.push(val1);
-						val = val1 = std::min(val1, val2);
-					}
-					result.SetNameAndResult("min", val);
-					while (!args.empty())
-					{
-						result.AddArgument(args.top());
-						args.pop();
-					}
-				}
-				else if (token.equals_ci("rad"))
-				{
+					break;
+				case POSTFIX_RAD:
 					val = val1 * std::atan(1.0) / 45.0;
-					result.SetNameAndResult("rad", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("rand"))
+					break;
+				case POSTFIX_RAND:
 				{
 					double val2 = val1;
-					val1 = num_stack.top();
-					num_stack.pop();
+					val1 = num_stack[--top];
 					if (val1 > val2)
-					{
-						double tmp = val2;
-						val2 = val1;
-						val1 = tmp;
-					}
+						std::swap(val1, val2);
 					val = sfmtRNG.Random(static_cast<int>(val1), static_cast<int>(val2));
-					result.SetNameAndResult("rand", val);
 					result.AddArgument(static_cast<int>(val1));
 					result.AddArgument(static_cast<int>(val2));
+					break;
 				}
-				else if (token.equals_ci("round"))
-				{
+				case POSTFIX_ROUND:
 					val = my_round(val1);
-					result.SetNameAndResult("round", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("sin"))
-				{
+					break;
+				case POSTFIX_SIN:
 					val = std::sin(val1);
-					result.SetNameAndResult("sin", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("sinh"))
-				{
+					break;
+				case POSTFIX_SINH:
 					val = std::sinh(val1);
-					result.SetNameAndResult("sinh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("sqrt"))
-				{
+					break;
+				case POSTFIX_SQRT:
 					// Because imaginary numbers are not being used, it is impossible to take the square root of a negative number
 					if (val1 < 0)
 					{
@@ -1830,11 +1880,8 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = std::sqrt(val1);
-					result.SetNameAndResult("sqrt", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("tan"))
-				{
+					break;
+				case POSTFIX_TAN:
 					// Tangent is undefined for any value of pi / 2 + pi * n for all integers n
 					if (!std::fmod(val1 + 2 * std::atan(1.0), std::atan(1.0) * 4))
 					{
@@ -1842,141 +1889,31 @@ static double EvaluatePostfix(DiceServData &data, const Postfix &postfix)
 						return 0;
 					}
 					val = std::tan(val1);
-					result.SetNameAndResult("tan", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("tanh"))
-				{
+					break;
+				case POSTFIX_TANH:
 					val = std::tanh(val1);
-					result.SetNameAndResult("tanh", val);
-					result.AddArgument(val1);
-				}
-				else if (token.equals_ci("trunc"))
-				{
+					break;
+				case POSTFIX_TRUNC:
 					val = static_cast<int>(val1);
-					result.SetNameAndResult("trunc", val);
-					result.AddArgument(val1);
-				}
-				if (is_infinite(val) || is_notanumber(val))
-				{
-					data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
-					return 0;
-				}
-				num_stack.push(val);
-				data.AddToOpResults(result);
+					break;
+				default:
+					break;
 			}
-			else if (is_operator(token[0]) && token.length() == 1)
+			if (is_infinite(val) || is_notanumber(val))
 			{
-				if (num_stack.empty() || num_stack.size() < 2)
-				{
-					data.errCode = DICE_ERROR_STACK;
-					data.errStr = _("That operator doesn't have enough numbers to work with.");
-					return 0;
-				}
-				double val2 = num_stack.top();
-				num_stack.pop();
-				double val1 = num_stack.top();
-				num_stack.pop();
-				switch (token[0])
-				{
-					case '+':
-						val = val1 + val2;
-						break;
-					case '-':
-						val = val1 - val2;
-						break;
-					case '*':
-						val = val1 * val2;
-						break;
-					case '/':
-						// Prevent division by 0
-						if (!val2)
-						{
-							data.errCode = DICE_ERROR_DIV0;
-							return 0;
-						}
-						val = val1 / val2;
-						break;
-					case '%':
-						// Prevent division by 0
-						if (!val2)
-						{
-							data.errCode = DICE_ERROR_DIV0;
-							return 0;
-						}
-						val = std::fmod(val1, val2);
-						break;
-					case '^':
-						// Because imaginary numbers are not being used, it is impossible to take the power of a negative number to a non-integer exponent
-						if (val1 < 0 && static_cast<int>(val2) != val2)
-						{
-							data.errCode = DICE_ERROR_UNDEFINED;
-							return 0;
-						}
-						// Prevent division by 0
-						if (!val1 && !val2)
-						{
-							data.errCode = DICE_ERROR_DIV0;
-							return 0;
-						}
-						// 0 to a negative power is invalid
-						if (!val1 && val2 < 0)
-						{
-							data.errCode = DICE_ERROR_OVERUNDERFLOW;
-							return 0;
-						}
-						val = std::pow(val1, val2);
-						break;
-					case 'd':
-					{
-						// Make sure both the number of dice and the number of sides are within acceptable ranges
-						if (val1 < 1 || val1 > DICE_MAX_DICE)
-						{
-							data.errCode = DICE_ERROR_UNACCEPTABLE_DICE;
-							data.errNum = static_cast<int>(val1);
-							return 0;
-						}
-						if (val2 < 1 || val2 > DICE_MAX_SIDES)
-						{
-							data.errCode = DICE_ERROR_UNACCEPTABLE_SIDES;
-							data.errNum = static_cast<int>(val2);
-							return 0;
-						}
-						DiceResult result = Dice(static_cast<int>(val1), static_cast<unsigned>(val2));
-						data.AddToOpResults(result);
-						val = result.Value();
-					}
-				}
-				if (is_infinite(val) || is_notanumber(val))
-				{
-					data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
-					return 0;
-				}
-				num_stack.push(val);
-			}
-		}
-		else
-		{
-			const PostfixValueDouble *dbl = anope_dynamic_static_cast<const PostfixValueDouble *>(postfix[x]);
-			const double *val_ptr = dbl->Get();
-			if (!val_ptr)
-			{
-				data.errCode = DICE_ERROR_STACK;
-				data.errStr = _("Something went wrong while evaluating that roll (missing number).");
+				data.errCode = is_infinite(val) ? DICE_ERROR_OVERUNDERFLOW : DICE_ERROR_UNDEFINED;
 				return 0;
 			}
-			num_stack.push(*val_ptr);
+			// The functions with more than one argument (or a converted one) have added their arguments above
+			result.SetNameAndResult(postfix_function(instruction.opcode).name, val);
+			if (postfix_function(instruction.opcode).arguments == 1 && instruction.opcode != POSTFIX_FAC)
+				result.AddArgument(val1);
+			num_stack[top++] = val;
+			if (data.isExtended)
+				data.AddToOpResults(result);
 		}
 	}
-	val = num_stack.top();
-	num_stack.pop();
-	if (!num_stack.empty())
-	{
-		data.errCode = DICE_ERROR_STACK;
-		data.errStr = _("That expression has too many numbers and can't be evaluated as written.");
-		return 0;
-	}
-	return val;
+	return num_stack[0];
 }
 
 /** Parse an infix notation expression and convert the expression to postfix notation.
@@ -2015,13 +1952,20 @@ const OperatorResultType &OperatorResultBase::Type() const
 	return this->type;
 }
 
-DiceResult::DiceResult(int n, unsigned s) : OperatorResultBase(OPERATOR_RESULT_TYPE_DICE), num(n), sides(s), results()
+DiceResult::DiceResult(int n, unsigned s) : OperatorResultBase(OPERATOR_RESULT_TYPE_DICE), num(n), sides(s), sum(0), results()
 {
 }
 
 void DiceResult::AddResult(unsigned result)
 {
 	this->results.push_back(result);
+	this->sum += result;
+}
+
+void DiceResult::SetSum(uint64_t total)
+{
+	this->results.clear();
+	this->sum = total;
 }
 
 const std::vector<unsigned> &DiceResult::Results() const
@@ -2039,9 +1983,9 @@ Anope::string DiceResult::DiceString() const
 	return ds_stringify(this->num) + "d" + ds_stringify(this->sides);
 }
 
-unsigned DiceResult::Sum() const
+uint64_t DiceResult::Sum() const
 {
-	return std::accumulate(this->results.begin(), this->results.end(), 0u);
+	return this->sum;
 }
 
 double DiceResult::Value() const
@@ -2051,6 +1995,9 @@ double DiceResult::Value() const
 
 Anope::string DiceResult::LongString() const
 {
+	// A result that only has its total can't list the dice
+	if (this->results.empty())
+		return this->ShortString();
 	std::ostringstream str;
 	str << ds_stringify(this->num) << "d" << ds_stringify(this->sides) << "=(";
 	bool first = true;
@@ -2155,6 +2102,8 @@ bool OperatorResults::empty() const
 
 void DiceServData::Reset()
 {
+	this->listedDice = 0;
+	this->diceUnlisted = false;
 	this->timesResults.clear();
 	this->opResults.clear();
 	this->results.clear();
@@ -2309,6 +2258,10 @@ bool DiceServData::CheckMessageLengthPostProcess(CommandSource &source, const An
 
 Anope::string DiceServData::GenerateLongExOutput() const
 {
+	// The dice weren't kept because listing them all would overflow the message, in which case the callers fall back to the short form anyway
+	if (this->diceUnlisted)
+		return this->GenerateShortExOutput();
+
 	std::ostringstream output;
 	output << "<" << this->rollPrefix << " [" << this->dicePrefix << this->diceStr << this->diceSuffix << "]: ";
 
@@ -2475,6 +2428,29 @@ void DiceServData::SetOpResultsAsTimesResults()
 	this->opResults.clear();
 }
 
+/** Drop the individual dice of the dice results in a set of operator results, keeping their totals.
+ * @param results The operator results
+ */
+static void KeepDiceTotals(OperatorResults &results)
+{
+	for (unsigned i = 0, count = results.size(); i < count; ++i)
+		if (results[i]->Type() == OPERATOR_RESULT_TYPE_DICE)
+		{
+			DiceResult *result = static_cast<DiceResult *>(results[i]);
+			result->SetSum(result->Sum());
+		}
+}
+
+/** Keeps only the totals of the dice rolled so far, once the roll has more dice than its long output could list in a message.
+ */
+void DiceServData::UnlistDice()
+{
+	this->diceUnlisted = true;
+	KeepDiceTotals(this->timesResults);
+	for (unsigned i = 0, len = this->opResults.size(); i < len; ++i)
+		KeepDiceTotals(this->opResults[i]);
+}
+
 void DiceServData::Roll()
 {
 	this->DiceServ->Roller(*this);
@@ -2616,7 +2592,7 @@ public:
 		return result.DiceString();
 	}
 
-	unsigned Sum(const DiceResult &result) const
+	uint64_t Sum(const DiceResult &result) const
 	{
 		return result.Sum();
 	}
@@ -2627,6 +2603,91 @@ public:
 	}
 };
 
+/** A least recently used cache of parsed expressions.
+ *
+ * The same few expressions (3d6, 1d20+5 and so on) make up most rolls, so the core keeps the postfix form of those it has parsed
+ * recently and only evaluates them again. Expressions are looked up case-insensitively, the parser treats them that way as well.
+ * Expressions that failed to parse are never cached, so the error position of a failed parse is always that of the given text.
+ */
+class DiceServExpressionCache
+{
+	typedef std::list<std::pair<Anope::string, std::shared_ptr<const Postfix> > > entry_list;
+
+	/** The cached expressions, most recently used first */
+	entry_list entries;
+	/** The position of each expression in the above list */
+	Anope::unordered_map<entry_list::iterator> index;
+	/** The most expressions to keep, 0 disables the cache */
+	size_t capacity;
+	/** The lookups that found an expression and those that had to parse it */
+	uint64_t hits, misses;
+
+	/** Drops the least recently used expressions until there are at most capacity left.
+	 */
+	void Trim()
+	{
+		while (this->entries.size() > this->capacity)
+		{
+			this->index.erase(this->entries.back().first);
+			this->entries.pop_back();
+		}
+	}
+
+public:
+	DiceServExpressionCache() : entries(), index(), capacity(0), hits(0), misses(0)
+	{
+	}
+
+	/** Sets the most expressions to keep, dropping the least recently used ones if there are too many.
+	 * @param size The new capacity, 0 disables the cache
+	 */
+	void SetCapacity(size_t size)
+	{
+		this->capacity = size;
+		this->Trim();
+	}
+
+	/** Gets the parsed form of an expression, parsing it only if it wasn't cached.
+	 * @param data The roll the expression belongs to, any parse error is stored in here
+	 * @param infix The expression to parse
+	 * @return The parsed expression, or an empty pointer if the expression could not be parsed
+	 */
+	std::shared_ptr<const Postfix> Get(DiceServData &data, const Anope::string &infix)
+	{
+		Anope::unordered_map<entry_list::iterator>::iterator it = this->index.find(infix);
+		if (it != this->index.end())
+		{
+			++this->hits;
+			this->entries.splice(this->entries.begin(), this->entries, it->second);
+			return it->second->second;
+		}
+		++this->misses;
+		std::shared_ptr<Postfix> postfix = std::make_shared<Postfix>(DoParse(data, infix));
+		if (postfix->empty())
+			return std::shared_ptr<const Postfix>();
+		if (this->capacity)
+		{
+			this->entries.push_front(std::make_pair(infix, postfix));
+			this->index[infix] = this->entries.begin();
+			this->Trim();
+		}
+		return postfix;
+	}
+
+	/** Gets the counters of the cache.
+	 * @return The number of cached expressions, the capacity, and the hit and miss counters since the core was loaded
+	 */
+	DiceServCacheStats Stats() const
+	{
+		DiceServCacheStats stats;
+		stats.entries = this->entries.size();
+		stats.capacity = this->capacity;
+		stats.hits = this->hits;
+		stats.misses = this->misses;
+		return stats;
+	}
+};
+
 /** A timer designed to load an old DiceServ database from Anope 1.8.x or pre-Anope 1.9.2 after the main database has loaded.
  */
 class DiceServUpgradeTimer : public Timer
@@ -2649,6 +2710,7 @@ class DiceServCore : public Module, public DiceServService
 	Reference<BotInfo> DiceServ;
 	DiceServDataHandler DiceServHandler;
 	SerializableExtensibleItem<bool> DiceServIgnore;
+	DiceServExpressionCache ExpressionCache;
 
 	/** Makes sure that a user who was ignored by their NickServ account is still ignored no matter what.
 	 */
@@ -2686,6 +2748,7 @@ public:
 	{
 		const Anope::string &dsnick = conf.GetModule(this).Get<const Anope::string>("client", "DiceServ");
 		this->DiceServ = BotInfo::Find(dsnick, true);
+		this->ExpressionCache.SetCapacity(conf.GetModule(this).Get<unsigned>("expressioncache", "256"));
 	}
 
 	/** Handles accessing HELP FUNCTIONS
@@ -2911,6 +2974,7 @@ public:
 	}
 
 	/** DiceServ's core roller, handles parsing the actual expression and then executing it however many times is necessary.
+	 * Expressions that were parsed recently are taken from the expression cache instead of being parsed again.
 	 */
 	void Roller(DiceServData &data)
 	{
@@ -2926,15 +2990,14 @@ public:
 				data.errPos = data.timesPart.length() + 1;
 				return;
 			}
-			Postfix times_postfix = DoParse(data, data.timesPart);
+			std::shared_ptr<const Postfix> times_postfix = this->ExpressionCache.Get(data, data.timesPart);
 			// If the parsing failed, leave
-			if (times_postfix.empty())
+			if (!times_postfix)
 				return;
 			// Evaluate the expression
 			data.StartNewOpResults();
-			v = DoEvaluate(data, times_postfix);
+			v = DoEvaluate(data, *times_postfix);
 			data.SetOpResultsAsTimesResults();
-			times_postfix.clear();
 			// Check if the evaluated number of times is out of bounds
 			if (data.errCode == DICE_ERROR_NONE)
 			{
@@ -2951,9 +3014,9 @@ public:
 		if (data.errCode == DICE_ERROR_NONE)
 		{
 			// Parse the dice
-			Postfix dice_postfix = DoParse(data, data.dicePart);
+			std::shared_ptr<const Postfix> dice_postfix = this->ExpressionCache.Get(data, data.dicePart);
 			// If the parsing failed, leave
-			if (dice_postfix.empty())
+			if (!dice_postfix)
 			{
 				if (!data.timesPart.empty())
 					data.errPos += data.timesPart.length() + 1;
@@ -2964,7 +3027,7 @@ public:
 			{
 				// Evaluate the dice, then check for errors
 				data.StartNewOpResults();
-				v = DoEvaluate(data, dice_postfix);
+				v = DoEvaluate(data, *dice_postfix);
 				// As long as we didn't have an error, we will continue
 				if (data.errCode == DICE_ERROR_NONE)
 					// Round the result, if needed, and add it the buffer
@@ -2977,10 +3040,16 @@ public:
 					return;
 				}
 			}
-			dice_postfix.clear();
 		}
 	}
 
+	/** Gets the counters of the parsed expression cache.
+	 */
+	DiceServCacheStats CacheStats()
+	{
+		return this->ExpressionCache.Stats();
+	}
+
 	/** A middleman function to roll dice, used currently by the Earthdawn command for generating bonus rolls.
 	 */
 	DiceResult *Dice(int num, unsigned sides)
@@ -70,16 +70,18 @@ class DiceResult : public OperatorResultBase
 {
 	int num;
 	unsigned sides;
+	uint64_t sum;
 	std::vector<unsigned> results;
 
 public:
 	DiceResult(int n = 0, unsigned s = 0);
 
 	void AddResult(unsigned result);
+	void SetSum(uint64_t total);
 	const std::vector<unsigned> &Results() const;
 	const unsigned &Sides() const;
 	Anope::string DiceString() const;
-	unsigned Sum() const;
+	uint64_t Sum() const;
 	double Value() const;
 	Anope::string LongString() const;
 	Anope::string ShortString() const;
@@ -160,6 +162,13 @@ public:
 
 class DiceServData;
 
+/** Counters of the core's cache of parsed expressions */
+struct DiceServCacheStats
+{
+	size_t entries, capacity;
+	uint64_t hits, misses;
+};
+
 class DiceServService : public Service
 {
 public:
@@ -185,6 +194,7 @@ public:
 	virtual void Ignore(Extensible *obj) = 0;
 	virtual void Unignore(Extensible *obj) = 0;
 	virtual bool IsIgnored(Extensible *obj) = 0;
+	virtual DiceServCacheStats CacheStats() = 0;
 };
 
 class DiceServData
@@ -195,6 +205,9 @@ public:
 	bool isExtended, roundResults, sourceIsBot;
 	Anope::string rollPrefix, dicePrefix, diceStr, timesPart, dicePart, diceSuffix, extraStr, chanStr, commentStr;
 	int maxMessageLength;
+	/** The dice listed so far in this roll, and whether the roll has too many to list them all */
+	unsigned listedDice;
+	bool diceUnlisted;
 	OperatorResults timesResults;
 	std::vector<OperatorResults> opResults;
 	std::vector<double> results;
@@ -204,7 +217,7 @@ public:
 	int errNum;
 
 	DiceServData() : DiceServ("DiceServService", "DiceServ"), isExtended(false), roundResults(true), sourceIsBot(false), rollPrefix(""), dicePrefix(""),
-		diceStr(""), timesPart(""), dicePart(""), diceSuffix(""), extraStr(""), chanStr(""), commentStr(""), maxMessageLength(510), timesResults(), opResults(),
+		diceStr(""), timesPart(""), dicePart(""), diceSuffix(""), extraStr(""), chanStr(""), commentStr(""), maxMessageLength(510), listedDice(0), diceUnlisted(false), timesResults(), opResults(),
 		results(), errCode(DICE_ERROR_NONE), errStr(""), errPos(0u), errNum(0)
 	{
 		if (!this->DiceServ)
@@ -222,6 +235,7 @@ public:
 	void AddToOpResults(const DiceResult &result);
 	void AddToOpResults(const FunctionResult &result);
 	void SetOpResultsAsTimesResults();
+	void UnlistDice();
 	void Roll();
 	DiceResult *Dice(int num, unsigned sides);
 	void HandleError(CommandSource &source);
@@ -260,6 +274,6 @@ public:
 	virtual const std::vector<unsigned> &Results(const DiceResult &result) const = 0;
 	virtual const unsigned &Sides(const DiceResult &result) const = 0;
 	virtual Anope::string DiceString(const DiceResult &result) const = 0;
-	virtual unsigned Sum(const DiceResult &result) const = 0;
+	virtual uint64_t Sum(const DiceResult &result) const = 0;
 	virtual DiceResult *Clone(const DiceResult &result) const = 0;
 };
@@ -119,8 +119,9 @@ public:
 				"the format of: [\037z\037]d\037w\037, where z is the number of dice to\n"
 				"be thrown, and w is the number of sides on each die. z is\n"
 				"optional, will default to 1 if not given. Please note that\n"
-				"the sides or number of dice can not be 0 or negative, and\n"
-				"both can not be greater than 99999.\n"
+				"the sides or number of dice can not be 0 or negative, the\n"
+				"number of dice can not be greater than 999999, and the sides\n"
+				"can not be greater than 99999.\n"
 				" \n"
 				"x~ is used to determine how many consecutive sets of dice\n"
 				"will be rolled. This is optional, defaults to 1 if not\n"
@@ -15,19 +15,41 @@ ServiceReference<DiceServService> DiceServ("DiceServService", "DiceServ");
 
 /** STATUS command
  *
- * This will allow Services Operators to view the ignore status of a single channel or a single nickname/user.
+ * This will allow Services Operators to view the ignore status of a single channel or a single nickname/user,
+ * or the counters of DiceServ's expression cache when given neither.
  */
 class DSStatusCommand : public Command
 {
+	/** Shows how well the core's cache of parsed expressions is doing.
+	 */
+	void DoCache(CommandSource &source)
+	{
+		DiceServCacheStats stats = DiceServ->CacheStats();
+		if (!stats.capacity)
+			source.Reply(_("The expression cache is disabled."));
+		else
+			source.Reply(_("Expression cache: %s of %s expressions cached."), ds_stringify(stats.entries).c_str(), ds_stringify(stats.capacity).c_str());
+		uint64_t lookups = stats.hits + stats.misses;
+		source.Reply(_("Lookups: %s, hits: %s, misses: %s (%s%% hit rate)."), ds_stringify(lookups).c_str(), ds_stringify(stats.hits).c_str(),
+			ds_stringify(stats.misses).c_str(), ds_stringify(lookups ? stats.hits * 100 / lookups : 0).c_str());
+	}
+
 public:
-	DSStatusCommand(Module *creator) : Command(creator, "diceserv/status", 1, 1)
+	DSStatusCommand(Module *creator) : Command(creator, "diceserv/status", 0, 1)
 	{
 		this->SetDesc(_("Shows allow status of channel or nick"));
 		this->SetSyntax(_("{\037channel\037|\037nick\037}"));
+		this->SetSyntax("");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
 	{
+		if (params.empty())
+		{
+			this->DoCache(source);
+			return;
+		}
+
 		Anope::string what = params[0];
 		// If the argument starts with a #, assume it's a channel
 		if (what[0] == '#')
@@ -92,7 +114,11 @@ public:
 		source.Reply(_("This will give you the allowed or ignored status of a\n"
 			"channel or a nick, depending on which one you give. It will\n"
 			"also tell you if that status is on an online nick/channel,\n"
-			"or set in services due to the nick not being online."));
+			"or set in services due to the nick not being online.\n"
+			" \n"
+			"Without a channel or nick, this will show how many parsed\n"
+			"dice expressions are cached and how often rolls were able\n"
+			"to use them instead of parsing the expression again."));
 		return true;
 	}
 };
@@ -12,25 +12,47 @@
 //   - monthly: YYYY-MM-01 (start of month)
 //   - total:   1970-01-01
 // - Does not require stored procedures or SQL EVENT schedulers.
+// - Works with MySQL/MariaDB or SQLite (3.24+); the dialect follows the provider.
 //
 // What it tracks (per channel, and optionally per identified nick):
 // - lines, words, letters, actions (/me), smileys (happy/sad/other)
 // - kicks given / kicks received, channel mode changes, topic changes
+// - approximate unique speakers per channel for the current day/week/month (HyperLogLog)
 //
 // Commands / toggles:
 // - ChanServ: /msg ChanServ SET <channel> CHANSTATSPLUS {ON|OFF}
 // - NickServ: /msg NickServ SET CHANSTATSPLUS {ON|OFF}
 //   Only identified users who enable the NickServ option are recorded as per-nick stats.
+// - ChanServ: /msg ChanServ LIVETOP <channel> [count] (also as a fantasy command)
+//   Top speakers over the last livewindow, from memory.
+// - OperServ: /msg OperServ CHANSTATSPLUS STATS
+//   Shows flush pacing, queue depth, SQL latency and the last retention run.
+// - OperServ: /msg OperServ CHANSTATSPLUS COMPACT
+//   Runs the retention job now.
 //
 // Config example:
 //
 // module {
 //   name = "rpc_chanstatsplus"
 //   engine = "mysql/dbstats"
+//   dialect = ""
 //   prefix = "anope_"
 //   flushinterval = 5s
 //   maxpending = 100000
 //   maxrowsperquery = 500
+//   flushbudget = 5000
+//   targetlatency = 1000
+//   maxinflight = 4
+//   livewindow = 60m
+//   livecapacity = 32
+//   journal = "chanstats_plus.journal"
+//   speakers = "chanstats_plus.speakers"
+//   retaindaily = 90
+//   retainweekly = 104
+//   compactinterval = 6h
+//   compactbatch = 5000
+//   partitionbyperiod = no
+//   maxjournalsize = 65536
 //   smileyshappy = { ":)" ":-)" ":D" }
 //   smileyssad = { ":(" ":-(" }
 //   smileysother = { ";)" ";-)" }
@@ -38,10 +60,26 @@
 //
 
 #include "module.h"
+#include "modules/rpc.h"
 #include "modules/sql.h"
 
-#include <cctype>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
 #include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string_view>
+
+#include <fcntl.h>
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <unistd.h>
+#endif
 
 
 namespace
@@ -85,508 +123,2647 @@ namespace
 		}
 	};
 
+	enum SmileyKind
+	{
+		SMILEY_HAPPY,
+		SMILEY_SAD,
+		SMILEY_OTHER,
+		SMILEY_KINDS
+	};
+
 	static inline bool IsSpace(unsigned char c)
 	{
-		return std::isspace(c) != 0;
+		// Same set as std::isspace() in the "C" locale, without the locale lookup.
+		return c == ' ' || (c >= '\t' && c <= '\r');
 	}
 
-	static size_t CountWords(const Anope::string &msg)
+	struct MessageCounts final
+	{
+		uint64_t letters = 0;
+		uint64_t words = 0;
+		uint64_t smileys[SMILEY_KINDS] = { 0, 0, 0 };
+	};
+
+	/** Counts words, letters and smileys of a message in a single pass.
+	 *
+	 * Smileys are matched with an Aho-Corasick automaton built once on reload over
+	 * all configured tokens. Bytes that don't occur in any token share one column
+	 * of the transition table so it stays a few hundred bytes for typical lists.
+	 * Like the old per-token find() loop, overlapping matches are all counted and a
+	 * token listed twice counts twice.
+	 */
+	class MessageAnalyser final
 	{
-		bool in_word = false;
-		size_t words = 0;
-		for (const unsigned char c : msg)
+		struct Output final
+		{
+			uint32_t counts[SMILEY_KINDS] = { 0, 0, 0 };
+			bool any = false;
+		};
+
+		uint16_t byteclass[256] = { };
+		size_t classes = 1;
+		std::vector<uint32_t> next = { 0 };
+		std::vector<Output> outputs = { Output() };
+
+	public:
+		void Build(const std::vector<Anope::string> (&tokens)[SMILEY_KINDS])
 		{
-			if (IsSpace(c))
+			std::fill(std::begin(byteclass), std::end(byteclass), 0);
+			classes = 1;
+			for (const auto &list : tokens)
 			{
-				in_word = false;
-				continue;
+				for (const auto &token : list)
+				{
+					for (const unsigned char c : token)
+					{
+						if (!byteclass[c])
+							byteclass[c] = static_cast<uint16_t>(classes++);
+					}
+				}
+			}
+
+			// Trie first; 0 in a non-root slot means "no edge" until the BFS below fills it in.
+			next.assign(classes, 0);
+			outputs.assign(1, Output());
+			for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+			{
+				for (const auto &token : tokens[kind])
+				{
+					if (token.empty())
+						continue;
+
+					uint32_t state = 0;
+					for (const unsigned char c : token)
+					{
+						uint32_t &edge = next[state * classes + byteclass[c]];
+						if (!edge)
+						{
+							edge = static_cast<uint32_t>(outputs.size());
+							outputs.emplace_back();
+							next.resize(next.size() + classes, 0);
+						}
+						state = next[state * classes + byteclass[c]];
+					}
+					outputs[state].counts[kind]++;
+					outputs[state].any = true;
+				}
+			}
+
+			// Turn the trie into a DFA: missing edges follow the failure link, and each
+			// state inherits the matches of its failure state.
+			std::vector<uint32_t> fail(outputs.size(), 0);
+			std::vector<uint32_t> queue;
+			queue.reserve(outputs.size());
+			for (size_t cls = 0; cls < classes; ++cls)
+			{
+				if (next[cls])
+					queue.push_back(next[cls]);
 			}
-			if (!in_word)
+
+			for (size_t head = 0; head < queue.size(); ++head)
 			{
-				in_word = true;
-				words++;
+				const uint32_t state = queue[head];
+				const Output &inherited = outputs[fail[state]];
+				for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+					outputs[state].counts[kind] += inherited.counts[kind];
+				outputs[state].any |= inherited.any;
+
+				for (size_t cls = 0; cls < classes; ++cls)
+				{
+					uint32_t &edge = next[state * classes + cls];
+					const uint32_t fallback = next[fail[state] * classes + cls];
+					if (edge)
+					{
+						fail[edge] = fallback;
+						queue.push_back(edge);
+					}
+					else
+						edge = fallback;
+				}
 			}
 		}
-		return words;
-	}
 
-	static size_t CountSmileys(const Anope::string &msg, const Anope::string &smileylist)
-	{
-		size_t smileys = 0;
-		spacesepstream sep(smileylist);
-		Anope::string token;
-		while (sep.GetToken(token) && !token.empty())
+		void Analyse(std::string_view text, MessageCounts &counts) const
 		{
-			for (size_t pos = msg.find(token, 0); pos != Anope::string::npos; pos = msg.find(token, pos + 1))
-				smileys++;
+			counts.letters = text.length();
+
+			const uint32_t *table = next.data();
+			const Output *out = outputs.data();
+			uint32_t state = 0;
+			bool in_word = false;
+			for (const unsigned char c : text)
+			{
+				const bool space = IsSpace(c);
+				counts.words += !space && !in_word;
+				in_word = !space;
+
+				state = table[state * classes + byteclass[c]];
+				if (out[state].any)
+				{
+					for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+						counts.smileys[kind] += out[state].counts[kind];
+				}
+			}
 		}
-		return smileys;
-	}
+	};
 
 	static bool IsCTCPAction(const Anope::string &msg)
 	{
 		return msg.length() >= 8 && msg[0] == '\x01' && msg.find("ACTION ") == 1;
 	}
 
-	static Anope::string StripCTCPAction(const Anope::string &msg)
+	/** Converts a proleptic Gregorian date to a number of days since 1970-01-01. */
+	static int32_t DaysFromCivil(int y, unsigned m, unsigned d)
 	{
-		// "\x01ACTION <text>\x01" -> "<text>"
-		if (!IsCTCPAction(msg))
-			return msg;
-		Anope::string out = msg;
-		if (!out.empty() && out[out.length() - 1] == '\x01')
-			out.erase(out.length() - 1);
-		// remove leading "\x01ACTION "
-		if (out.length() >= 8)
-			out.erase(0, 8);
-		return out;
+		// http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+		y -= m <= 2;
+		const int era = (y >= 0 ? y : y - 399) / 400;
+		const unsigned yoe = static_cast<unsigned>(y - era * 400);
+		const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+		const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+		return era * 146097 + static_cast<int32_t>(doe) - 719468;
 	}
 
-	static Anope::string FormatDateYMD(time_t ts)
+	/** Converts a number of days since 1970-01-01 to a proleptic Gregorian date. */
+	static void CivilFromDays(int32_t days, int &y, unsigned &m, unsigned &d)
 	{
-		std::tm tmv;
-		localtime_r(&ts, &tmv);
-		char buf[11];
-		std::strftime(buf, sizeof(buf), "%Y-%m-%d", &tmv);
-		return buf;
+		// http://howardhinnant.github.io/date_algorithms.html#civil_from_days
+		days += 719468;
+		const int era = (days >= 0 ? days : days - 146096) / 146097;
+		const unsigned doe = static_cast<unsigned>(days - era * 146097);
+		const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+		const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+		const unsigned mp = (5 * doy + 2) / 153;
+		d = doy - (153 * mp + 2) / 5 + 1;
+		m = mp < 10 ? mp + 3 : mp - 9;
+		y = static_cast<int>(yoe) + era * 400 + (m <= 2);
 	}
 
-	static time_t StartOfDay(time_t ts)
+	/** Formats a number of days since 1970-01-01 as YYYY-MM-DD. */
+	static Anope::string FormatDays(int32_t days)
 	{
-		std::tm tmv;
-		localtime_r(&ts, &tmv);
-		tmv.tm_hour = 0;
-		tmv.tm_min = 0;
-		tmv.tm_sec = 0;
-		return std::mktime(&tmv);
-	}
+		int y;
+		unsigned m, d;
+		CivilFromDays(days, y, m, d);
 
-	static time_t StartOfMonth(time_t ts)
-	{
-		std::tm tmv;
-		localtime_r(&ts, &tmv);
-		tmv.tm_mday = 1;
-		tmv.tm_hour = 0;
-		tmv.tm_min = 0;
-		tmv.tm_sec = 0;
-		return std::mktime(&tmv);
+		char buf[16];
+		snprintf(buf, sizeof(buf), "%04d-%02u-%02u", y, m, d);
+		return buf;
 	}
 
-	static time_t StartOfWeek(time_t ts)
+	static int32_t StartOfWeek(int32_t day)
 	{
 		// Week starts Monday (ISO-ish). If you want Sunday, make it configurable.
-		std::tm tmv;
-		localtime_r(&ts, &tmv);
-		int wday = tmv.tm_wday; // 0=Sun..6=Sat
-		int days_from_monday = (wday + 6) % 7;
-		time_t day_start = StartOfDay(ts);
-		return day_start - static_cast<time_t>(days_from_monday) * 86400;
+		// 1970-01-01 was a Thursday, so (day + 3) % 7 is the number of days since Monday.
+		const int32_t since_monday = ((day + 3) % 7 + 7) % 7;
+		return day - since_monday;
 	}
 
-	static Anope::string MakeKey(const Anope::string &chan, const Anope::string &nick, const Anope::string &period,
-		const Anope::string &period_start)
+	static int32_t StartOfMonth(int32_t day)
 	{
-		Anope::string key(chan);
-		key.push_back('\x1f');
-		key += nick;
-		key.push_back('\x1f');
-		key += period;
-		key.push_back('\x1f');
-		key += period_start;
-		return key;
+		int y;
+		unsigned m, d;
+		CivilFromDays(day, y, m, d);
+		return DaysFromCivil(y, m, 1);
 	}
 
-	static void SplitKey(const Anope::string &key, Anope::string &chan, Anope::string &nick, Anope::string &period,
-		Anope::string &period_start)
+	/** The current local day (see DaysFromCivil).
+	 *
+	 * This only changes at local midnight, so it is recomputed when the clock
+	 * leaves the cached day instead of on every event. The week and month start
+	 * are derived from it with calendar arithmetic at flush time, so days that are
+	 * 23 or 25 hours long around DST changes still map to the right dates.
+	 */
+	class LocalDay final
 	{
-		size_t p1 = key.find('\x1f');
-		size_t p2 = key.find('\x1f', p1 + 1);
-		size_t p3 = key.find('\x1f', p2 + 1);
-		chan = key.substr(0, p1);
-		nick = key.substr(p1 + 1, p2 - (p1 + 1));
-		period = key.substr(p2 + 1, p3 - (p2 + 1));
-		period_start = key.substr(p3 + 1);
-	}
+		time_t day_begin = 0;
+		time_t day_end = 0;
+		int32_t day = 0;
 
-}
+	public:
+		int32_t Get(time_t now)
+		{
+			if (now >= day_begin && now < day_end)
+				return day;
+
+			std::tm midnight;
+			localtime_r(&now, &midnight);
+			midnight.tm_hour = 0;
+			midnight.tm_min = 0;
+			midnight.tm_sec = 0;
+			midnight.tm_isdst = -1;
+
+			day = DaysFromCivil(midnight.tm_year + 1900, static_cast<unsigned>(midnight.tm_mon) + 1,
+				static_cast<unsigned>(midnight.tm_mday));
+
+			std::tm tmv = midnight;
+			day_begin = std::mktime(&tmv);
+			tmv = midnight;
+			tmv.tm_mday++;
+			day_end = std::mktime(&tmv);
+			return day;
+		}
+	};
 
-class CommandCSSetChanstatsPlus final
-	: public Command
-{
-public:
-	CommandCSSetChanstatsPlus(Module *creator) : Command(creator, "chanserv/set/chanstatsplus", 2, 2)
+	enum Period : uint8_t
 	{
-		this->SetDesc(_("Turn chanstats+ statistics on or off"));
-		this->SetSyntax(_("\037channel\037 {ON | OFF}"));
+		PERIOD_TOTAL,
+		PERIOD_MONTHLY,
+		PERIOD_WEEKLY,
+		PERIOD_DAILY
+	};
+
+	static const char *PeriodName(Period period)
+	{
+		switch (period)
+		{
+			case PERIOD_TOTAL:
+				return "total";
+			case PERIOD_MONTHLY:
+				return "monthly";
+			case PERIOD_WEEKLY:
+				return "weekly";
+			case PERIOD_DAILY:
+				return "daily";
+		}
+		return "total";
 	}
 
-	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+	/** Interns channel and nick names so pending rows can be keyed by small integers.
+	 * Id 0 is always the empty name, used for the aggregate rows.
+	 */
+	class NameTable final
 	{
-		ChannelInfo *ci = ChannelInfo::Find(params[0]);
-		if (!ci)
+		Anope::unordered_map<uint32_t> ids;
+		std::vector<Anope::string> names = { "" };
+
+	public:
+		uint32_t Intern(const Anope::string &name)
 		{
-			source.Reply(CHAN_X_NOT_REGISTERED, params[0].c_str());
-			return;
+			if (name.empty())
+				return 0;
+
+			auto it = ids.find(name);
+			if (it != ids.end())
+				return it->second;
+
+			const uint32_t id = static_cast<uint32_t>(names.size());
+			names.push_back(name);
+			ids.emplace(name, id);
+			return id;
 		}
 
-		EventReturn MOD_RESULT;
-		FOREACH_RESULT(OnSetChannelOption, MOD_RESULT, (source, this, ci, params[1]));
-		if (MOD_RESULT == EVENT_STOP)
-			return;
+		const Anope::string &Name(uint32_t id) const
+		{
+			return names[id];
+		}
 
-		if (MOD_RESULT != EVENT_ALLOW && !source.AccessFor(ci).HasPriv("SET") && source.permission.empty() &&
-			!source.HasPriv("chanserv/administration"))
+		/** Every interned name; index 0 is the empty name. */
+		const std::vector<Anope::string> &Names() const
 		{
-			source.Reply(ACCESS_DENIED);
-			return;
+			return names;
 		}
 
-		if (params[1].equals_ci("ON"))
+		void Clear()
 		{
-			ci->Extend<bool>(EXT_CS_STATS);
-			source.Reply(_("Chanstats+ statistics are now enabled for this channel."));
-			Log(source.AccessFor(ci).HasPriv("SET") ? LOG_COMMAND : LOG_OVERRIDE, source, this, ci)
-				<< "to enable chanstatsplus";
+			ids.clear();
+			names.resize(1);
 		}
-		else if (params[1].equals_ci("OFF"))
+	};
+
+	/** Primary key of a chanstatsplus row in interned form. */
+	struct RowKey final
+	{
+		uint32_t chan;
+		uint32_t nick;
+		int32_t start;
+		Period period;
+
+		bool operator==(const RowKey &other) const
 		{
-			Log(source.AccessFor(ci).HasPriv("SET") ? LOG_COMMAND : LOG_OVERRIDE, source, this, ci)
-				<< "to disable chanstatsplus";
-			ci->Shrink<bool>(EXT_CS_STATS);
-			source.Reply(_("Chanstats+ statistics are now disabled for this channel."));
+			return chan == other.chan && nick == other.nick && start == other.start && period == other.period;
 		}
-		else
-			this->OnSyntaxError(source, "");
+	};
+
+	static inline size_t HashIds(uint32_t chan, uint32_t nick, uint64_t extra)
+	{
+		uint64_t h = (static_cast<uint64_t>(chan) << 32) | nick;
+		h ^= extra * 0x9E3779B97F4A7C15ULL;
+		h ^= h >> 29;
+		h *= 0xBF58476D1CE4E5B9ULL;
+		h ^= h >> 32;
+		return static_cast<size_t>(h);
 	}
 
-	bool OnHelp(CommandSource &source, const Anope::string &) override
+	struct RowKeyHash final
 	{
-		this->SendSyntax(source);
-		source.Reply(" ");
-		source.Reply(_("Turns chanstats+ statistics ON or OFF."));
+		size_t operator()(const RowKey &key) const
+		{
+			return HashIds(key.chan, key.nick, static_cast<uint64_t>(static_cast<uint32_t>(key.start)) << 2 | key.period);
+		}
+	};
+
+	/** Key of the in-memory aggregate: one delta per channel and nick (0 for the
+	 * channel aggregate) per local day. Everything else is derived at flush time.
+	 */
+	struct SpeakerDayKey final
+	{
+		uint32_t chan;
+		uint32_t nick;
+		int32_t day;
+
+		bool operator==(const SpeakerDayKey &other) const
+		{
+			return chan == other.chan && nick == other.nick && day == other.day;
+		}
+	};
+
+	struct SpeakerDayKeyHash final
+	{
+		size_t operator()(const SpeakerDayKey &key) const
+		{
+			return HashIds(key.chan, key.nick, static_cast<uint32_t>(key.day));
+		}
+	};
+
+	typedef std::unordered_map<RowKey, StatsDelta, RowKeyHash> RowMap;
+
+	/** One row of a flushed batch, with the names resolved. */
+	struct BatchRow final
+	{
+		Anope::string chan;
+		Anope::string nick;
+		Period period;
+		int32_t start;
+		StatsDelta delta;
+		uint64_t unique_speakers = 0;
+	};
+
+	/** Stats batches add their deltas; speakers batches raise unique_speakers of channel rows. */
+	enum BatchKind : uint8_t
+	{
+		BATCH_STATS,
+		BATCH_SPEAKERS
+	};
+
+	// Set in the row count of an encoded speakers batch.
+	static constexpr uint32_t SPEAKERS_BATCH = 0x80000000;
+
+	template<typename T>
+	static void PutRaw(std::string &out, T value)
+	{
+		out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+	}
+
+	template<typename T>
+	static bool GetRaw(const std::string &in, size_t &pos, T &value)
+	{
+		if (in.length() - pos < sizeof(value))
+			return false;
+		std::memcpy(&value, in.data() + pos, sizeof(value));
+		pos += sizeof(value);
 		return true;
 	}
-};
 
-class CommandNSSetChanstatsPlus
-	: public Command
-{
-public:
-	CommandNSSetChanstatsPlus(Module *creator, const Anope::string &sname = "nickserv/set/chanstatsplus", size_t min = 1)
-		: Command(creator, sname, min, min + 1)
+	static void PutName(std::string &out, const Anope::string &name)
 	{
-		this->SetDesc(_("Turn chanstats+ statistics on or off"));
-		this->SetSyntax("{ON | OFF}");
+		PutRaw(out, static_cast<uint16_t>(name.length()));
+		out.append(name.str());
 	}
 
-	void Run(CommandSource &source, const Anope::string &user, const Anope::string &param, bool saset = false)
+	static bool GetName(const std::string &in, size_t &pos, Anope::string &name)
 	{
-		NickAlias *na = NickAlias::Find(user);
-		if (!na)
+		uint16_t len;
+		if (!GetRaw(in, pos, len) || in.length() - pos < len)
+			return false;
+		name = in.substr(pos, len);
+		pos += len;
+		return true;
+	}
+
+	static void EncodeBatch(const std::vector<BatchRow> &rows, BatchKind kind, std::string &out)
+	{
+		PutRaw(out, static_cast<uint32_t>(rows.size()) | (kind == BATCH_SPEAKERS ? SPEAKERS_BATCH : 0));
+		for (const auto &row : rows)
 		{
-			source.Reply(NICK_X_NOT_REGISTERED, user.c_str());
-			return;
+			PutName(out, row.chan);
+			PutName(out, row.nick);
+			PutRaw(out, static_cast<uint8_t>(row.period));
+			PutRaw(out, row.start);
+			if (kind == BATCH_SPEAKERS)
+				PutRaw(out, row.unique_speakers);
+			else
+				PutRaw(out, row.delta);
 		}
+	}
 
-		EventReturn MOD_RESULT;
-		FOREACH_RESULT(OnSetNickOption, MOD_RESULT, (source, this, na->nc, param));
-		if (MOD_RESULT == EVENT_STOP)
-			return;
+	static bool DecodeBatch(const std::string &in, std::vector<BatchRow> &rows, BatchKind &kind)
+	{
+		size_t pos = 0;
+		uint32_t count;
+		if (!GetRaw(in, pos, count))
+			return false;
 
-		if (param.equals_ci("ON"))
+		kind = count & SPEAKERS_BATCH ? BATCH_SPEAKERS : BATCH_STATS;
+		count &= ~SPEAKERS_BATCH;
+
+		rows.clear();
+		rows.reserve(count);
+		for (uint32_t i = 0; i < count; ++i)
 		{
-			Log(na->nc == source.GetAccount() ? LOG_COMMAND : LOG_ADMIN, source, this)
-				<< "to enable chanstatsplus for " << na->nc->display;
-			na->nc->Extend<bool>(EXT_NS_STATS);
-			if (saset)
-				source.Reply(_("Chanstats+ statistics are now enabled for %s"), na->nc->display.c_str());
-			else
-				source.Reply(_("Chanstats+ statistics are now enabled for your nick."));
+			BatchRow row;
+			uint8_t period;
+			if (!GetName(in, pos, row.chan) || !GetName(in, pos, row.nick) || !GetRaw(in, pos, period) ||
+				period > PERIOD_DAILY || !GetRaw(in, pos, row.start))
+				return false;
+			if (kind == BATCH_SPEAKERS ? !GetRaw(in, pos, row.unique_speakers) : !GetRaw(in, pos, row.delta))
+				return false;
+			row.period = static_cast<Period>(period);
+			rows.push_back(row);
 		}
-		else if (param.equals_ci("OFF"))
+		return pos == in.length();
+	}
+
+	/** Flushes a file's data to disk. By path, opened just for the sync; a
+	 * directory is synced so a rename in it survives a crash.
+	 */
+	static bool SyncFile(const Anope::string &path, bool directory = false)
+	{
+#ifdef _WIN32
+		// NTFS journals renames itself and directories cannot be opened here.
+		if (directory)
+			return true;
+		const int fd = _open(path.c_str(), _O_WRONLY);
+		const bool ok = fd >= 0 && _commit(fd) == 0;
+		if (fd >= 0)
+			_close(fd);
+#else
+		const int fd = open(path.c_str(), directory ? O_RDONLY : O_WRONLY);
+		const bool ok = fd >= 0 && fsync(fd) == 0;
+		if (fd >= 0)
+			close(fd);
+#endif
+		return ok;
+	}
+
+	/** Append-only write-behind journal of the batches sent to SQL.
+	 *
+	 * A batch is appended and synced to disk before its UPSERT is dispatched,
+	 * and a commit marker is appended once the server has confirmed it. Batches
+	 * without a marker are replayed after an error or a restart. A batch whose
+	 * confirmation was lost (e.g. services or the host died mid-query, or before
+	 * the unsynced marker reached the disk) may therefore be counted twice, but
+	 * nothing is silently dropped. The file is rewritten with only the
+	 * uncommitted batches when it grows, and truncated whenever everything is
+	 * committed.
+	 *
+	 * Record: tag ('B' batch, 'C' commit), uint64 batch id, uint32 payload length, payload.
+	 * Values are in host byte order; the journal is not meant to be moved between hosts.
+	 */
+	class Journal final
+	{
+	public:
+		struct Entry final
 		{
-			Log(na->nc == source.GetAccount() ? LOG_COMMAND : LOG_ADMIN, source, this)
-				<< "to disable chanstatsplus for " << na->nc->display;
-			na->nc->Shrink<bool>(EXT_NS_STATS);
-			if (saset)
-				source.Reply(_("Chanstats+ statistics are now disabled for %s"), na->nc->display.c_str());
+			uint64_t offset = 0;
+			uint32_t length = 0;
+		};
+
+		typedef std::map<uint64_t, Entry> EntryMap;
+
+	private:
+		static constexpr size_t HEADER_SIZE = 1 + sizeof(uint64_t) + sizeof(uint32_t);
+
+		Anope::string path;
+		std::fstream file;
+		uint64_t size = 0;
+
+		bool WriteRecord(char tag, uint64_t id, const std::string &payload, bool sync)
+		{
+			std::string record;
+			record.reserve(HEADER_SIZE + payload.length());
+			record.push_back(tag);
+			PutRaw(record, id);
+			PutRaw(record, static_cast<uint32_t>(payload.length()));
+			record.append(payload);
+
+			file.clear();
+			file.seekp(0, std::ios::end);
+			file.write(record.data(), record.length());
+			file.flush();
+			if (!file)
+				return false;
+
+			size += record.length();
+			return !sync || SyncFile(path);
+		}
+
+		bool Reopen(bool truncate)
+		{
+			file.close();
+			auto mode = std::ios::in | std::ios::out | std::ios::binary;
+			file.open(path.str(), mode | (truncate ? std::ios::trunc : std::ios::app));
+			if (!file.is_open())
+				return false;
+
+			file.seekg(0, std::ios::end);
+			size = static_cast<uint64_t>(file.tellg());
+			return true;
+		}
+
+	public:
+		bool IsOpen() const
+		{
+			return file.is_open();
+		}
+
+		const Anope::string &GetPath() const
+		{
+			return path;
+		}
+
+		uint64_t Size() const
+		{
+			return size;
+		}
+
+		/** Opens (creating if needed) the journal and collects the uncommitted batches in it. */
+		bool Open(const Anope::string &p, EntryMap &uncommitted, uint64_t &max_id)
+		{
+			Close();
+			path = p;
+
+			std::error_code ec;
+			uint64_t filesize = std::filesystem::file_size(path.str(), ec);
+			if (ec)
+				filesize = 0;
+
+			uint64_t good = 0;
+			{
+				std::ifstream in(path.str(), std::ios::in | std::ios::binary);
+				std::string header(HEADER_SIZE, '\0');
+				while (in.read(&header[0], HEADER_SIZE))
+				{
+					size_t pos = 1;
+					uint64_t id = 0;
+					uint32_t length = 0;
+					GetRaw(header, pos, id);
+					GetRaw(header, pos, length);
+
+					// An unknown tag or a record cut short by a crash ends the journal.
+					const char tag = header[0];
+					const uint64_t end = good + HEADER_SIZE + length;
+					if ((tag != 'B' && tag != 'C') || end > filesize || !in.seekg(length, std::ios::cur))
+						break;
+
+					if (tag == 'B')
+					{
+						Entry &entry = uncommitted[id];
+						entry.offset = good + HEADER_SIZE;
+						entry.length = length;
+					}
+					else
+						uncommitted.erase(id);
+
+					max_id = std::max(max_id, id);
+					good = end;
+				}
+			}
+
+			if (filesize > good)
+				std::filesystem::resize_file(path.str(), good, ec);
+
+			return Reopen(false);
+		}
+
+		void Close()
+		{
+			if (file.is_open())
+				file.close();
+			size = 0;
+		}
+
+		bool Append(uint64_t id, const std::string &payload, Entry &entry)
+		{
+			entry.offset = size + HEADER_SIZE;
+			entry.length = static_cast<uint32_t>(payload.length());
+			return WriteRecord('B', id, payload, true);
+		}
+
+		bool Commit(uint64_t id)
+		{
+			return WriteRecord('C', id, "", false);
+		}
+
+		bool Read(const Entry &entry, std::string &payload)
+		{
+			payload.resize(entry.length);
+			file.clear();
+			file.seekg(static_cast<std::streamoff>(entry.offset));
+			return file.read(&payload[0], entry.length) && file.gcount() == static_cast<std::streamsize>(entry.length);
+		}
+
+		/** Empties the journal once every batch in it is committed. */
+		bool Truncate()
+		{
+			return Reopen(true);
+		}
+
+		/** Rewrites the journal with only the given batches, updating their offsets. */
+		bool Compact(EntryMap &keep)
+		{
+			if (keep.empty())
+				return Truncate();
+
+			const Anope::string tmp = path + ".tmp";
+			EntryMap moved;
+			{
+				std::ofstream out(tmp.str(), std::ios::out | std::ios::binary | std::ios::trunc);
+				uint64_t offset = 0;
+				std::string payload;
+				for (const auto &[id, entry] : keep)
+				{
+					if (!Read(entry, payload))
+						return false;
+
+					std::string record;
+					record.push_back('B');
+					PutRaw(record, id);
+					PutRaw(record, entry.length);
+					out.write(record.data(), record.length());
+					out.write(payload.data(), payload.length());
+
+					moved[id] = { offset + HEADER_SIZE, entry.length };
+					offset += HEADER_SIZE + entry.length;
+				}
+				out.close();
+				if (!out || !SyncFile(tmp))
+					return false;
+			}
+
+			// The rewritten journal is on disk before it replaces the live one,
+			// and the rename is on disk before the old records are gone for good.
+			file.close();
+			std::error_code ec;
+			std::filesystem::rename(tmp.str(), path.str(), ec);
+			if (ec)
+			{
+				Reopen(false);
+				return false;
+			}
+			const auto dir = std::filesystem::path(path.str()).parent_path();
+			SyncFile(dir.empty() ? "." : dir.string(), true);
+
+			keep.swap(moved);
+			return Reopen(false);
+		}
+	};
+
+	/** Round-trip times (ms) of the most recent batches. */
+	class LatencyWindow final
+	{
+		static constexpr size_t MAX_SAMPLES = 256;
+
+		std::vector<uint32_t> samples;
+		size_t next = 0;
+
+	public:
+		void Add(uint32_t ms)
+		{
+			if (samples.size() < MAX_SAMPLES)
+				samples.push_back(ms);
 			else
-				source.Reply(_("Chanstats+ statistics are now disabled for your nick."));
+				samples[next] = ms;
+			next = (next + 1) % MAX_SAMPLES;
 		}
-		else
-			this->OnSyntaxError(source, "CHANSTATPLUS");
-	}
 
-	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+		size_t Count() const
+		{
+			return samples.size();
+		}
+
+		uint32_t Percentile(unsigned pct) const
+		{
+			if (samples.empty())
+				return 0;
+
+			std::vector<uint32_t> sorted(samples);
+			const size_t rank = std::min(sorted.size() - 1, sorted.size() * pct / 100);
+			std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+			return sorted[rank];
+		}
+	};
+
+	/** splitmix64 finaliser; spreads account ids and nick hashes over all 64 bits. */
+	static uint64_t Mix64(uint64_t x)
 	{
-		this->Run(source, source.nc->display, params[0]);
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
 	}
 
-	bool OnHelp(CommandSource &source, const Anope::string &) override
+	/** HyperLogLog distinct counter: 1024 one-byte registers, ~3% standard error. */
+	class SpeakerSketch final
 	{
-		this->SendSyntax(source);
-		source.Reply(" ");
-		source.Reply(_("Turns chanstats+ statistics ON or OFF."));
-		return true;
-	}
-};
+	public:
+		static constexpr unsigned BITS = 10;
+		static constexpr size_t REGISTERS = 1 << BITS;
 
-class CommandNSSASetChanstatsPlus final
-	: public CommandNSSetChanstatsPlus
-{
-public:
-	CommandNSSASetChanstatsPlus(Module *creator) : CommandNSSetChanstatsPlus(creator, "nickserv/saset/chanstatsplus", 2)
+	private:
+		std::array<uint8_t, REGISTERS> registers{};
+
+	public:
+		/** Returns whether the estimate may have changed. */
+		bool Add(uint64_t hash)
+		{
+			const size_t idx = hash >> (64 - BITS);
+			// The guard bit bounds the rank at 64 - BITS + 1.
+			uint64_t rest = (hash << BITS) | (uint64_t(1) << (BITS - 1));
+			uint8_t rank = 1;
+			for (; !(rest & (uint64_t(1) << 63)); rest <<= 1)
+				rank++;
+
+			if (registers[idx] >= rank)
+				return false;
+			registers[idx] = rank;
+			return true;
+		}
+
+		uint64_t Estimate() const
+		{
+			double sum = 0;
+			size_t zeros = 0;
+			for (auto reg : registers)
+			{
+				sum += std::ldexp(1.0, -reg);
+				if (!reg)
+					zeros++;
+			}
+
+			const double m = REGISTERS;
+			const double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+			// Linear counting is more accurate while many registers are still empty.
+			if (estimate <= 2.5 * m && zeros)
+				return std::llround(m * std::log(m / zeros));
+			return std::llround(estimate);
+		}
+
+		void Clear()
+		{
+			registers.fill(0);
+		}
+
+		uint8_t *Data()
+		{
+			return registers.data();
+		}
+
+		const uint8_t *Data() const
+		{
+			return registers.data();
+		}
+	};
+
+	/** Unique speakers of one channel for the current month, week and day. */
+	struct ChannelSpeakers final
+	{
+		static constexpr size_t SLOTS = 3;
+
+		/** Slot index to period; the total period is not tracked. */
+		static Period SlotPeriod(size_t slot)
+		{
+			static const Period periods[SLOTS] = { PERIOD_MONTHLY, PERIOD_WEEKLY, PERIOD_DAILY };
+			return periods[slot];
+		}
+
+		static int32_t SlotStart(size_t slot, int32_t day)
+		{
+			switch (SlotPeriod(slot))
+			{
+				case PERIOD_MONTHLY:
+					return StartOfMonth(day);
+				case PERIOD_WEEKLY:
+					return StartOfWeek(day);
+				default:
+					return day;
+			}
+		}
+
+		int32_t start[SLOTS] = { INT32_MIN, INT32_MIN, INT32_MIN };
+		bool dirty[SLOTS] = { false, false, false };
+		SpeakerSketch sketch[SLOTS];
+	};
+
+	/** Rolling-window "top talkers" of one channel.
+	 *
+	 * A space-saving heavy-hitters sketch: at most `capacity` counters, and a nick
+	 * that isn't tracked takes over the counter with the lowest count, inheriting
+	 * its per-minute buckets. Counts are therefore upper bounds for nicks that
+	 * joined the board recently, but any nick with more than window-total/capacity
+	 * lines is guaranteed to be on it. Each counter keeps one bucket per minute of
+	 * the window, so memory is capacity * window regardless of channel size.
+	 */
+	class LiveBoard final
+	{
+		struct Counter final
+		{
+			Anope::string nick;
+			std::vector<uint16_t> buckets;
+			uint32_t total = 0;
+			int64_t minute = 0; // Newest minute held in buckets.
+		};
+
+		size_t capacity;
+		size_t window;
+		std::vector<Counter> counters;
+
+		void Advance(Counter &counter, int64_t now) const
+		{
+			if (now <= counter.minute)
+				return;
+
+			const int64_t steps = std::min<int64_t>(now - counter.minute, window);
+			for (int64_t k = 1; k <= steps; ++k)
+			{
+				uint16_t &bucket = counter.buckets[(counter.minute + k) % window];
+				counter.total -= bucket;
+				bucket = 0;
+			}
+			counter.minute = now;
+		}
+
+		void Bump(Counter &counter, int64_t now) const
+		{
+			Advance(counter, now);
+			uint16_t &bucket = counter.buckets[now % window];
+			if (bucket < UINT16_MAX)
+			{
+				bucket++;
+				counter.total++;
+			}
+		}
+
+	public:
+		LiveBoard(size_t cap, size_t win)
+			: capacity(cap)
+			, window(win)
+		{
+			counters.reserve(capacity);
+		}
+
+		void Add(const Anope::string &nick, int64_t now)
+		{
+			for (auto &counter : counters)
+			{
+				if (counter.nick == nick)
+				{
+					Bump(counter, now);
+					return;
+				}
+			}
+
+			if (counters.size() < capacity)
+			{
+				counters.emplace_back();
+				Counter &counter = counters.back();
+				counter.nick = nick;
+				counter.buckets.assign(window, 0);
+				counter.minute = now;
+				Bump(counter, now);
+				return;
+			}
+
+			Counter *victim = nullptr;
+			for (auto &counter : counters)
+			{
+				Advance(counter, now);
+				if (!victim || counter.total < victim->total)
+					victim = &counter;
+			}
+			victim->nick = nick;
+			Bump(*victim, now);
+		}
+
+		/** The top nicks by lines in the window, highest first. */
+		std::vector<std::pair<Anope::string, uint32_t>> Top(size_t limit, int64_t now)
+		{
+			std::vector<std::pair<Anope::string, uint32_t>> top;
+			for (auto &counter : counters)
+			{
+				Advance(counter, now);
+				if (counter.total)
+					top.emplace_back(counter.nick, counter.total);
+			}
+
+			limit = std::min(limit, top.size());
+			std::partial_sort(top.begin(), top.begin() + limit, top.end(), [](const auto &a, const auto &b) {
+				return a.second > b.second || (a.second == b.second && a.first < b.first);
+			});
+			top.resize(limit);
+			return top;
+		}
+
+		bool Idle(int64_t now)
+		{
+			for (auto &counter : counters)
+			{
+				Advance(counter, now);
+				if (counter.total)
+					return false;
+			}
+			return true;
+		}
+	};
+}
+
+/** Provided by rpc_chanstatsplus so it can drop cached results once a flush
+ * has changed them. Must stay identical to the declaration there.
+ */
+class ChanstatsPlusFlushListener
+	: public Service
+{
+public:
+	ChanstatsPlusFlushListener(Module *m) : Service(m, "ChanstatsPlusFlushListener", "rpc_chanstatsplus")
+	{
+	}
+
+	/** Called once every row of a flush has been queued on the SQL provider,
+	 * and again for batches replayed from the journal once they commit.
+	 * names holds each channel and nick the flush touched, and pairs each
+	 * (channel, nick) whose per-nick channel row it changed.
+	 */
+	virtual void OnFlushed(const std::vector<Anope::string> &names, const std::vector<std::pair<Anope::string, Anope::string>> &pairs) = 0;
+};
+
+class MChanstatsPlus;
+
+class CommandCSLiveTop final
+	: public Command
+{
+	MChanstatsPlus *stats;
+
+public:
+	CommandCSLiveTop(Module *creator, MChanstatsPlus *m)
+		: Command(creator, "chanserv/livetop", 1, 2)
+		, stats(m)
+	{
+		this->SetDesc(_("Show the most active speakers of the last minutes"));
+		this->SetSyntax(_("\037channel\037 [\037count\037]"));
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override;
+
+	bool OnHelp(CommandSource &source, const Anope::string &) override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Shows who talked the most in a channel with chanstats+ enabled\n"
+			"over the configured live window (only users who enabled chanstats+\n"
+			"on their nick are counted). Counts are kept in memory and may\n"
+			"slightly overestimate nicks that only just became active."));
+		return true;
+	}
+};
+
+class CommandOSChanstatsPlus final
+	: public Command
+{
+	MChanstatsPlus *stats;
+
+public:
+	CommandOSChanstatsPlus(Module *creator, MChanstatsPlus *m)
+		: Command(creator, "operserv/chanstatsplus", 1, 1)
+		, stats(m)
+	{
+		this->SetDesc(_("Show chanstats+ flush statistics"));
+		this->SetSyntax("STATS");
+		this->SetSyntax("COMPACT");
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override;
+
+	bool OnHelp(CommandSource &source, const Anope::string &) override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("\002STATS\002 shows the current flush batch size and interval, the\n"
+			"number of buffered and in-flight rows, the journal backlog and\n"
+			"the SQL round-trip latency of recent batches, and the result of\n"
+			"the last retention run.\n"
+			" \n"
+			"\002COMPACT\002 runs the retention job (deleting daily and weekly\n"
+			"rows older than retaindaily/retainweekly) now instead of waiting\n"
+			"for compactinterval."));
+		return true;
+	}
+};
+
+class CommandCSSetChanstatsPlus final
+	: public Command
+{
+public:
+	CommandCSSetChanstatsPlus(Module *creator) : Command(creator, "chanserv/set/chanstatsplus", 2, 2)
+	{
+		this->SetDesc(_("Turn chanstats+ statistics on or off"));
+		this->SetSyntax(_("\037channel\037 {ON | OFF}"));
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+	{
+		ChannelInfo *ci = ChannelInfo::Find(params[0]);
+		if (!ci)
+		{
+			source.Reply(CHAN_X_NOT_REGISTERED, params[0].c_str());
+			return;
+		}
+
+		EventReturn MOD_RESULT;
+		FOREACH_RESULT(OnSetChannelOption, MOD_RESULT, (source, this, ci, params[1]));
+		if (MOD_RESULT == EVENT_STOP)
+			return;
+
+		if (MOD_RESULT != EVENT_ALLOW && !source.AccessFor(ci).HasPriv("SET") && source.permission.empty() &&
+			!source.HasPriv("chanserv/administration"))
+		{
+			source.Reply(ACCESS_DENIED);
+			return;
+		}
+
+		if (params[1].equals_ci("ON"))
+		{
+			ci->Extend<bool>(EXT_CS_STATS);
+			source.Reply(_("Chanstats+ statistics are now enabled for this channel."));
+			Log(source.AccessFor(ci).HasPriv("SET") ? LOG_COMMAND : LOG_OVERRIDE, source, this, ci)
+				<< "to enable chanstatsplus";
+		}
+		else if (params[1].equals_ci("OFF"))
+		{
+			Log(source.AccessFor(ci).HasPriv("SET") ? LOG_COMMAND : LOG_OVERRIDE, source, this, ci)
+				<< "to disable chanstatsplus";
+			ci->Shrink<bool>(EXT_CS_STATS);
+			source.Reply(_("Chanstats+ statistics are now disabled for this channel."));
+		}
+		else
+			this->OnSyntaxError(source, "");
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Turns chanstats+ statistics ON or OFF."));
+		return true;
+	}
+};
+
+class CommandNSSetChanstatsPlus
+	: public Command
+{
+public:
+	CommandNSSetChanstatsPlus(Module *creator, const Anope::string &sname = "nickserv/set/chanstatsplus", size_t min = 1)
+		: Command(creator, sname, min, min + 1)
+	{
+		this->SetDesc(_("Turn chanstats+ statistics on or off"));
+		this->SetSyntax("{ON | OFF}");
+	}
+
+	void Run(CommandSource &source, const Anope::string &user, const Anope::string &param, bool saset = false)
+	{
+		NickAlias *na = NickAlias::Find(user);
+		if (!na)
+		{
+			source.Reply(NICK_X_NOT_REGISTERED, user.c_str());
+			return;
+		}
+
+		EventReturn MOD_RESULT;
+		FOREACH_RESULT(OnSetNickOption, MOD_RESULT, (source, this, na->nc, param));
+		if (MOD_RESULT == EVENT_STOP)
+			return;
+
+		if (param.equals_ci("ON"))
+		{
+			Log(na->nc == source.GetAccount() ? LOG_COMMAND : LOG_ADMIN, source, this)
+				<< "to enable chanstatsplus for " << na->nc->display;
+			na->nc->Extend<bool>(EXT_NS_STATS);
+			if (saset)
+				source.Reply(_("Chanstats+ statistics are now enabled for %s"), na->nc->display.c_str());
+			else
+				source.Reply(_("Chanstats+ statistics are now enabled for your nick."));
+		}
+		else if (param.equals_ci("OFF"))
+		{
+			Log(na->nc == source.GetAccount() ? LOG_COMMAND : LOG_ADMIN, source, this)
+				<< "to disable chanstatsplus for " << na->nc->display;
+			na->nc->Shrink<bool>(EXT_NS_STATS);
+			if (saset)
+				source.Reply(_("Chanstats+ statistics are now disabled for %s"), na->nc->display.c_str());
+			else
+				source.Reply(_("Chanstats+ statistics are now disabled for your nick."));
+		}
+		else
+			this->OnSyntaxError(source, "CHANSTATPLUS");
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+	{
+		this->Run(source, source.nc->display, params[0]);
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Turns chanstats+ statistics ON or OFF."));
+		return true;
+	}
+};
+
+class CommandNSSASetChanstatsPlus final
+	: public CommandNSSetChanstatsPlus
+{
+public:
+	CommandNSSASetChanstatsPlus(Module *creator) : CommandNSSetChanstatsPlus(creator, "nickserv/saset/chanstatsplus", 2)
+	{
+		this->ClearSyntax();
+		this->SetSyntax(_("\037nickname\037 {ON | OFF}"));
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+	{
+		this->Run(source, params[0], params[1], true);
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &) override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply(_("Turns chanstats+ statistics ON or OFF for this user."));
+		return true;
+	}
+};
+
+class ChanstatsPlusSQLInterface final
+	: public SQL::Interface
+{
+public:
+	ChanstatsPlusSQLInterface(Module *m) : SQL::Interface(m) { }
+
+	void OnResult(const SQL::Result &) override { }
+
+	void OnError(const SQL::Result &r) override
+	{
+		if (!r.GetQuery().query.empty())
+			Log(LOG_DEBUG) << "chanstats_plus: SQL error executing query " << r.finished_query << ": " << r.GetError();
+		else
+			Log(LOG_DEBUG) << "chanstats_plus: SQL error executing query: " << r.GetError();
+	}
+};
+
+class MChanstatsPlus final
+	: public Module
+{
+	SerializableExtensibleItem<bool> cs_stats;
+	SerializableExtensibleItem<bool> ns_stats;
+	// Mix64 of the account id or nick a user counts as in ChannelSpeakers; dropped when either changes.
+	ExtensibleItem<uint64_t> speaker_hash;
+
+	CommandCSSetChanstatsPlus command_cs_set;
+	CommandNSSetChanstatsPlus command_ns_set;
+	CommandNSSASetChanstatsPlus command_ns_saset;
+	CommandOSChanstatsPlus command_os;
+	CommandCSLiveTop command_cs_livetop;
+
+	ServiceReference<SQL::Provider> sql;
+	ChanstatsPlusSQLInterface sqlinterface;
+
+	Anope::string engine;
+	Anope::string prefix;
+	MessageAnalyser analyser;
+
+	time_t flush_interval = 5;
+	size_t max_pending = 100000;
+	size_t max_rows_per_query = 500;
+	size_t flush_budget = 5000;
+
+	/* Pacing: batch size and flush interval adapt to the measured SQL round-trip
+	 * time, between 1/8 of maxrowsperquery and maxrowsperquery rows and between
+	 * flushinterval and 8 * flushinterval.
+	 */
+	uint32_t target_latency = 1000;
+	size_t max_in_flight = 4;
+	size_t batch_rows = 500;
+	time_t current_interval = 5;
+	size_t in_flight = 0;
+	LatencyWindow latency;
+
+	/** A unique-speaker estimate waiting to be written. */
+	struct SpeakerRow final
+	{
+		Anope::string chan;
+		Period period;
+		int32_t start;
+		uint64_t count;
+	};
+
+	/** What is kept in memory per channel, so a message looks its channel up once. */
+	struct ChannelActivity final
+	{
+		ChannelSpeakers speakers;
+		std::optional<LiveBoard> live; // Only while live leaderboards are enabled and the channel is active.
+	};
+
+	Anope::unordered_map<ChannelActivity> activity;
+	std::vector<SpeakerRow> speaker_rows;
+	Anope::string speakers_path;
+	bool speakers_loaded = false;
+
+	size_t live_window = 0; // Minutes; 0 disables the live leaderboards.
+	size_t live_capacity = 32;
+	time_t last_live_sweep = 0;
+
+	class LiveTopEvent final
+		: public RPC::Event
+	{
+		MChanstatsPlus *parent;
+
+	public:
+		LiveTopEvent(MChanstatsPlus *p)
+			: RPC::Event(p, "anope.chanstatsplus.liveTop", 1)
+			, parent(p)
+		{
+		}
+
+		bool Run(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request) override
+		{
+			const Anope::string &channel = request.data[0];
+			const Anope::string limitstr = request.data.size() > 1 && !request.data[1].empty() ? request.data[1] : "10";
+
+			if (!parent->live_window)
+			{
+				request.Error(RPC::ERR_CUSTOM_START, "Live leaderboards are disabled");
+				return true;
+			}
+
+			auto limit = Anope::Convert<size_t>(limitstr, 10);
+			if (!limit || limit > parent->live_capacity)
+				limit = parent->live_capacity;
+
+			auto &root = request.Root<RPC::Array>();
+			uint64_t rank = 0;
+			for (const auto &[nick, lines] : parent->LiveTop(channel, limit))
+			{
+				auto &row = root.ReplyMap();
+				row.Reply("rank", ++rank);
+				row.Reply("nick", nick);
+				row.Reply("lines", static_cast<uint64_t>(lines));
+			}
+			return true;
+		}
+	};
+
+	LiveTopEvent live_top_event;
+
+	typedef std::unordered_map<SpeakerDayKey, StatsDelta, SpeakerDayKeyHash> PendingMap;
+
+	LocalDay local_day;
+	NameTable names;
+	PendingMap pending;
+
+	/* A flush swaps pending (and the names it references) into these and drains
+	 * them over the following timer ticks, at most flush_budget entries per tick,
+	 * while new events keep accumulating in pending.
+	 */
+	NameTable flush_names;
+	PendingMap flush_pending;
+	// (channel, nick) ids of the per-nick entries expanded so far, for the flush listener.
+	std::vector<std::pair<uint32_t, uint32_t>> flush_pairs;
+	RowMap flush_rows;
+	size_t flush_processed = 0;
+	time_t last_flush = 0;
+	bool catch_up = false; // pending filled up before the current flush was drained
+
+	struct OutstandingBatch final
+	{
+		Journal::Entry entry;
+		unsigned attempts = 0;
+		time_t retry_at = 0;
+		bool in_flight = false;
+		// (channel, nick) of each row while a replay is in flight, for the flush listener.
+		std::vector<std::pair<Anope::string, Anope::string>> keys;
+	};
+
+	Journal journal;
+	uint64_t max_journal_size = 64 * 1024 * 1024;
+	uint64_t next_batch_id = 1;
+	std::map<uint64_t, OutstandingBatch> batches;
+	uint64_t outstanding_bytes = 0;
+
+	// Channels, nicks and (channel, nick) pairs of replayed batches that committed
+	// since the last tick; the flush listener hears about them once per tick.
+	NameTable replayed_names;
+	std::vector<std::pair<uint32_t, uint32_t>> replayed_pairs;
+
+	/** Why an event could not be buffered. */
+	enum DropReason
+	{
+		DROP_NONE,
+		DROP_NO_SQL,
+		DROP_JOURNAL_FULL,
+		DROP_BACKLOG,
+		DROP_REASONS
+	};
+
+	uint64_t dropped_events[DROP_REASONS] = { };
+	uint64_t reported_drops[DROP_REASONS] = { };
+
+	/** Placeholder names of one row of the batched UPSERT, built once per row index. */
+	struct RowTemplate final
+	{
+		Anope::string values;
+		Anope::string params[15];
+	};
+
+	std::vector<RowTemplate> row_templates;
+	Anope::string upsert_head;
+	Anope::string upsert_tail;
+
+	class FlushTimer final
+		: public Timer
+	{
+		MChanstatsPlus *owner;
+
+	public:
+		FlushTimer(MChanstatsPlus *m)
+			: Timer(m, 1, true)
+			, owner(m)
+		{
+		}
+
+		void Tick() override
+		{
+			if (owner)
+				owner->OnFlushTick();
+		}
+	};
+
+	FlushTimer *flush_timer = nullptr;
+
+	/** Completion of one batched UPSERT; like other one-shot SQL requests it deletes itself. */
+	class BatchResult final
+		: public SQL::Interface
+	{
+		MChanstatsPlus *parent;
+		uint64_t id;
+		std::chrono::steady_clock::time_point sent = std::chrono::steady_clock::now();
+
+	public:
+		BatchResult(MChanstatsPlus *m, uint64_t batch)
+			: SQL::Interface(m)
+			, parent(m)
+			, id(batch)
+		{
+			parent->live_results.insert(this);
+			parent->in_flight++;
+		}
+
+		~BatchResult() override
+		{
+			parent->live_results.erase(this);
+			parent->in_flight--;
+		}
+
+		void OnResult(const SQL::Result &) override
+		{
+			parent->OnBatchLatency(sent);
+			parent->OnBatchCommitted(id);
+			delete this;
+		}
+
+		void OnError(const SQL::Result &r) override
+		{
+			parent->OnBatchLatency(sent);
+			parent->OnBatchFailed(id, r.GetError());
+			delete this;
+		}
+	};
+
+	// Requests the SQL provider drops without a callback when we unload.
+	std::set<BatchResult *> live_results;
+
+	/** Retention: periodically deletes old daily and weekly rows in bounded batches. */
+	enum CompactStage
+	{
+		COMPACT_DAILY,
+		COMPACT_WEEKLY,
+		COMPACT_STAGES,
+	};
+
+	/** The queries of one retention stage: COUNT, then DELETE and PROBE until
+	 * no old rows are left, then COUNT again.
+	 */
+	enum CompactStep
+	{
+		COMPACT_COUNT_BEFORE,
+		COMPACT_DELETE,
+		COMPACT_PROBE,
+		COMPACT_COUNT_AFTER,
+	};
+
+	class CompactResult final
+		: public SQL::Interface
+	{
+		MChanstatsPlus *parent;
+		CompactStep step;
+
+	public:
+		CompactResult(MChanstatsPlus *m, CompactStep s)
+			: SQL::Interface(m)
+			, parent(m)
+			, step(s)
+		{
+			parent->compact_result = this;
+		}
+
+		~CompactResult() override
+		{
+			parent->compact_result = nullptr;
+		}
+
+		void OnResult(const SQL::Result &r) override
+		{
+			parent->OnCompactResult(step, r);
+			delete this;
+		}
+
+		void OnError(const SQL::Result &r) override
+		{
+			parent->OnCompactError(r.GetError());
+			delete this;
+		}
+	};
+
+	time_t compact_interval = 0;
+	uint32_t retain_daily = 0; // Days; 0 keeps daily rows forever.
+	uint32_t retain_weekly = 0; // Weeks; 0 keeps weekly rows forever.
+	size_t compact_batch = 0;
+	bool partition_by_period = false;
+	bool sqlite = false; // SQL dialect; chosen from the provider unless configured.
+
+	// Instrumentation shown by CHANSTATSPLUS STATS.
+	time_t loaded_at = Anope::CurTime;
+	uint64_t messages_seen = 0;
+	size_t peak_pending = 0;
+	uint64_t sql_bytes = 0;
+	uint64_t flush_start_bytes = 0;
+	uint64_t last_flush_bytes = 0;
+	uint64_t flushes = 0;
+
+	ServiceReference<ChanstatsPlusFlushListener> flush_listener;
+
+	CompactResult *compact_result = nullptr;
+	bool compacting = false;
+	size_t compact_stage = COMPACT_DAILY;
+	CompactStep compact_step = COMPACT_COUNT_BEFORE;
+	int32_t compact_cutoff[COMPACT_STAGES] = { };
+	uint64_t compact_before = 0; // Old rows of this stage when it started.
+	uint64_t compact_deletes_left = 0;
+	uint64_t compact_removed[COMPACT_STAGES] = { };
+	time_t next_compact = 0;
+	time_t last_compact = 0;
+	uint64_t last_removed[COMPACT_STAGES] = { };
+
+	void RunQuery(const SQL::Query &q)
+	{
+		if (sql)
+			sql->Run(&sqlinterface, q);
+	}
+
+	Anope::string GetDisplay(User *u) const
+	{
+		if (u && u->IsIdentified() && ns_stats.HasExt(u->Account()))
+			return u->Account()->display;
+		return "";
+	}
+
+	void EnsureSchema()
+	{
+		if (!sql)
+			return;
+
+		if (sqlite)
+		{
+			EnsureSQLiteSchema();
+			return;
+		}
+
+		SQL::Query q;
+		q = "CREATE TABLE IF NOT EXISTS `" + prefix + "chanstatsplus` ("
+			"`chan` varchar(64) NOT NULL DEFAULT '',"
+			"`nick` varchar(64) NOT NULL DEFAULT '',"
+			"`period` ENUM('total','monthly','weekly','daily') NOT NULL,"
+			"`period_start` date NOT NULL,"
+			"`letters` bigint unsigned NOT NULL DEFAULT '0',"
+			"`words` bigint unsigned NOT NULL DEFAULT '0',"
+			"`lines` int unsigned NOT NULL DEFAULT '0',"
+			"`actions` int unsigned NOT NULL DEFAULT '0',"
+			"`smileys_happy` int unsigned NOT NULL DEFAULT '0',"
+			"`smileys_sad` int unsigned NOT NULL DEFAULT '0',"
+			"`smileys_other` int unsigned NOT NULL DEFAULT '0',"
+			"`kicks` int unsigned NOT NULL DEFAULT '0',"
+			"`kicked` int unsigned NOT NULL DEFAULT '0',"
+			"`modes` int unsigned NOT NULL DEFAULT '0',"
+			"`topics` int unsigned NOT NULL DEFAULT '0',"
+			"`unique_speakers` int unsigned NOT NULL DEFAULT '0',"
+			"PRIMARY KEY (`chan`,`nick`,`period`,`period_start`),"
+			"KEY `nick_idx` (`nick`),"
+			"KEY `chan_idx` (`chan`),"
+			"KEY `period_idx` (`period`,`period_start`)"
+			") ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;";
+		this->RunQuery(q);
+
+		// Tables created before unique_speakers existed get the column added.
+		q = "SELECT COUNT(*) AS `n` FROM information_schema.COLUMNS "
+			"WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = @table@ AND COLUMN_NAME = 'unique_speakers';";
+		q.SetValue("table", prefix + "chanstatsplus");
+		sql->Run(&column_check, q);
+
+		if (partition_by_period)
+		{
+			// Top-N reads and retention deletes filter on a single period, so MySQL
+			// prunes them to the partition that period hashes to. KEY partitioning
+			// picks the partition, so that one can hold other periods as well.
+			// Rebuilding the table is expensive, so only do it when it isn't
+			// partitioned yet.
+			q = "SELECT COUNT(*) AS `n` FROM information_schema.PARTITIONS "
+				"WHERE TABLE_SCHEMA = DATABASE() AND TABLE_NAME = @table@ AND PARTITION_NAME IS NOT NULL;";
+			q.SetValue("table", prefix + "chanstatsplus");
+			sql->Run(&partition_check, q);
+		}
+	}
+
+	void EnsureSQLiteSchema()
+	{
+		// WAL lets readers (rpc_chanstatsplus) run alongside the flush, and with
+		// synchronous=NORMAL a commit no longer waits for an fsync.
+		RunQuery(SQL::Query("PRAGMA journal_mode=WAL;"));
+		RunQuery(SQL::Query("PRAGMA synchronous=NORMAL;"));
+
+		const Anope::string table = prefix + "chanstatsplus";
+		RunQuery("CREATE TABLE IF NOT EXISTS `" + table + "` ("
+			"`chan` TEXT NOT NULL DEFAULT '',"
+			"`nick` TEXT NOT NULL DEFAULT '',"
+			"`period` TEXT NOT NULL CHECK (`period` IN ('total','monthly','weekly','daily')),"
+			"`period_start` TEXT NOT NULL,"
+			"`letters` INTEGER NOT NULL DEFAULT 0,"
+			"`words` INTEGER NOT NULL DEFAULT 0,"
+			"`lines` INTEGER NOT NULL DEFAULT 0,"
+			"`actions` INTEGER NOT NULL DEFAULT 0,"
+			"`smileys_happy` INTEGER NOT NULL DEFAULT 0,"
+			"`smileys_sad` INTEGER NOT NULL DEFAULT 0,"
+			"`smileys_other` INTEGER NOT NULL DEFAULT 0,"
+			"`kicks` INTEGER NOT NULL DEFAULT 0,"
+			"`kicked` INTEGER NOT NULL DEFAULT 0,"
+			"`modes` INTEGER NOT NULL DEFAULT 0,"
+			"`topics` INTEGER NOT NULL DEFAULT 0,"
+			"`unique_speakers` INTEGER NOT NULL DEFAULT 0,"
+			"PRIMARY KEY (`chan`,`nick`,`period`,`period_start`)"
+			");");
+		RunQuery("CREATE INDEX IF NOT EXISTS `" + table + "_nick_idx` ON `" + table + "` (`nick`);");
+		RunQuery("CREATE INDEX IF NOT EXISTS `" + table + "_chan_idx` ON `" + table + "` (`chan`);");
+		RunQuery("CREATE INDEX IF NOT EXISTS `" + table + "_period_idx` ON `" + table + "` (`period`,`period_start`);");
+
+		if (partition_by_period)
+			Log(this) << "chanstats_plus: partitionbyperiod is not supported by SQLite, ignoring it";
+	}
+
+	class PartitionCheck final
+		: public SQL::Interface
+	{
+		MChanstatsPlus *parent;
+
+	public:
+		PartitionCheck(MChanstatsPlus *m)
+			: SQL::Interface(m)
+			, parent(m)
+		{
+		}
+
+		void OnResult(const SQL::Result &r) override
+		{
+			if (r.Rows() && Anope::Convert<uint64_t>(r.Get(0, "n"), 0))
+				return;
+
+			Log(parent) << "chanstats_plus: partitioning " << parent->prefix << "chanstatsplus by period";
+			// LIST COLUMNS does not accept an ENUM column; KEY partitioning does.
+			parent->RunQuery("ALTER TABLE `" + parent->prefix + "chanstatsplus` PARTITION BY KEY(`period`) PARTITIONS 4;");
+		}
+
+		void OnError(const SQL::Result &r) override
+		{
+			Log(parent) << "chanstats_plus: unable to check partitioning: " << r.GetError();
+		}
+	};
+
+	PartitionCheck partition_check;
+
+	class ColumnCheck final
+		: public SQL::Interface
+	{
+		MChanstatsPlus *parent;
+
+	public:
+		ColumnCheck(MChanstatsPlus *m)
+			: SQL::Interface(m)
+			, parent(m)
+		{
+		}
+
+		void OnResult(const SQL::Result &r) override
+		{
+			if (r.Rows() && Anope::Convert<uint64_t>(r.Get(0, "n"), 0))
+				return;
+
+			Log(parent) << "chanstats_plus: adding the unique_speakers column to " << parent->prefix << "chanstatsplus";
+			parent->RunQuery("ALTER TABLE `" + parent->prefix + "chanstatsplus` ADD COLUMN `unique_speakers` int unsigned NOT NULL DEFAULT '0' AFTER `topics`;");
+		}
+
+		void OnError(const SQL::Result &r) override
+		{
+			Log(parent) << "chanstats_plus: unable to check for the unique_speakers column: " << r.GetError();
+		}
+	};
+
+	ColumnCheck column_check;
+
+	static void AddForPeriods(RowMap &rows, uint32_t chan, uint32_t nick, int32_t day, const StatsDelta &delta)
+	{
+		rows[{ chan, nick, 0, PERIOD_TOTAL }].Add(delta);
+		rows[{ chan, nick, StartOfMonth(day), PERIOD_MONTHLY }].Add(delta);
+		rows[{ chan, nick, StartOfWeek(day), PERIOD_WEEKLY }].Add(delta);
+		rows[{ chan, nick, day, PERIOD_DAILY }].Add(delta);
+	}
+
+	/** Expands one per (chan, nick, day) delta into the rows of every period and scope. */
+	static void ExpandEntry(RowMap &rows, const SpeakerDayKey &key, const StatsDelta &delta)
+	{
+		// Channel aggregate
+		AddForPeriods(rows, key.chan, 0, key.day, delta);
+
+		if (key.nick)
+		{
+			// Per-nick (in channel)
+			AddForPeriods(rows, key.chan, key.nick, key.day, delta);
+			// Per-nick (global)
+			AddForPeriods(rows, 0, key.nick, key.day, delta);
+		}
+	}
+
+	void AddEvent(const Anope::string &channel, const Anope::string &nick, const StatsDelta &delta)
+	{
+		if (delta.Empty())
+			return;
+
+		SpeakerDayKey key = { names.Intern(channel), names.Intern(nick), local_day.Get(Anope::CurTime) };
+		auto it = pending.find(key);
+		if (it == pending.end())
+		{
+			if (pending.size() >= max_pending)
+			{
+				const DropReason reason = MakeRoom();
+				if (reason != DROP_NONE)
+				{
+					// Nowhere to put it; dropping is the only way to bound memory.
+					dropped_events[reason]++;
+					return;
+				}
+
+				// A flush that just started took the name table the key was interned in.
+				key.chan = names.Intern(channel);
+				key.nick = names.Intern(nick);
+			}
+			it = pending.emplace(key, StatsDelta()).first;
+		}
+		it->second.Add(delta);
+	}
+
+	/** Called when pending is full: starts a flush right away if SQL can take it.
+	 * This runs on the message path, so it only ever swaps buffers.
+	 */
+	DropReason MakeRoom()
+	{
+		if (!sql)
+			return DROP_NO_SQL;
+		if (JournalFull())
+			return DROP_JOURNAL_FULL;
+
+		if (!Flushing())
+			return StartFlush() ? DROP_NONE : DROP_BACKLOG;
+
+		// The previous flush is still draining, so traffic is outrunning
+		// flushbudget. The next tick finishes it in one go (parking batches
+		// over maxinflight in the journal); until then pending may grow to
+		// twice maxpending.
+		catch_up = true;
+		return pending.size() < 2 * max_pending ? DROP_NONE : DROP_BACKLOG;
+	}
+
+	/** How an UPSERT refers to the value that was about to be inserted. */
+	Anope::string ExcludedValue(const Anope::string &column) const
+	{
+		return sqlite ? "excluded." + column : "VALUES(" + column + ")";
+	}
+
+	void BuildRowTemplates()
+	{
+		static const char *const params[] = {
+			"chan", "nick", "period", "pstart",
+			"letters", "words", "lines", "actions",
+			"smh", "sms", "smo",
+			"kicks", "kicked", "modes", "topics",
+		};
+
+		row_templates.resize(max_rows_per_query);
+		for (size_t i = 0; i < row_templates.size(); ++i)
+		{
+			RowTemplate &tpl = row_templates[i];
+			const Anope::string idx = Anope::ToString(i);
+			tpl.values = i ? ",(" : "(";
+			for (size_t p = 0; p < 15; ++p)
+			{
+				tpl.params[p] = params[p] + idx;
+				if (p)
+					tpl.values += ",";
+				tpl.values += "@" + tpl.params[p] + "@";
+			}
+			tpl.values += ")";
+		}
+
+		upsert_head = "INSERT INTO `" + prefix + "chanstatsplus` ("
+			"`chan`,`nick`,`period`,`period_start`,"
+			"`letters`,`words`,`lines`,`actions`,"
+			"`smileys_happy`,`smileys_sad`,`smileys_other`,"
+			"`kicks`,`kicked`,`modes`,`topics`) VALUES ";
+		// Both dialects get the same column list; only the conflict clause and
+		// the way the incoming value is named differ.
+		static const char *const columns[] = {
+			"letters", "words", "`lines`", "actions",
+			"smileys_happy", "smileys_sad", "smileys_other",
+			"kicks", "kicked", "modes", "topics",
+		};
+
+		upsert_tail = sqlite
+			? " ON CONFLICT(`chan`,`nick`,`period`,`period_start`) DO UPDATE SET "
+			: " ON DUPLICATE KEY UPDATE ";
+		for (size_t i = 0; i < sizeof(columns) / sizeof(*columns); ++i)
+		{
+			if (i)
+				upsert_tail += ",";
+			upsert_tail += Anope::string(columns[i]) + "=" + columns[i] + "+" + ExcludedValue(columns[i]);
+		}
+		upsert_tail += ";";
+	}
+
+	bool Flushing() const
+	{
+		return !flush_pending.empty() || !flush_rows.empty();
+	}
+
+	/** Swaps pending into the flush buffers. Cheap enough to do from the message path. */
+	bool StartFlush()
+	{
+		if (Flushing() || pending.empty())
+			return false;
+
+		// pending only grows between flushes, so this is the peak of the cycle.
+		peak_pending = std::max(peak_pending, pending.size());
+		flush_start_bytes = sql_bytes;
+
+		// flush_names was cleared when the previous flush finished.
+		std::swap(pending, flush_pending);
+		std::swap(names, flush_names);
+		flush_processed = 0;
+		last_flush = Anope::CurTime;
+		return true;
+	}
+
+	/** Moves up to limit rows out of flush_rows. */
+	void TakeBatch(std::vector<BatchRow> &rows, size_t limit)
+	{
+		rows.clear();
+		rows.reserve(std::min(flush_rows.size(), limit));
+		for (auto it = flush_rows.begin(); it != flush_rows.end() && rows.size() < limit; it = flush_rows.erase(it))
+			rows.push_back({ flush_names.Name(it->first.chan), flush_names.Name(it->first.nick), it->first.period, it->first.start, it->second });
+	}
+
+	/** Roughly the size of the statement sent once the parameters are substituted. */
+	static size_t QuerySize(const SQL::Query &q)
+	{
+		size_t size = q.query.length();
+		for (const auto &[name, value] : q.parameters)
+			size += value.data.length();
+		return size;
+	}
+
+	void BuildUpsert(const std::vector<BatchRow> &rows, SQL::Query &q)
+	{
+		Anope::string query = upsert_head;
+		for (size_t i = 0; i < rows.size() && i < row_templates.size(); ++i)
+		{
+			const BatchRow &row = rows[i];
+			const RowTemplate &tpl = row_templates[i];
+			query += tpl.values;
+
+			q.SetValue(tpl.params[0], row.chan);
+			q.SetValue(tpl.params[1], row.nick);
+			q.SetValue(tpl.params[2], Anope::string(PeriodName(row.period)));
+			q.SetValue(tpl.params[3], FormatDays(row.start));
+
+			q.SetValue(tpl.params[4], Anope::ToString(row.delta.letters), false);
+			q.SetValue(tpl.params[5], Anope::ToString(row.delta.words), false);
+			q.SetValue(tpl.params[6], Anope::ToString(row.delta.lines), false);
+			q.SetValue(tpl.params[7], Anope::ToString(row.delta.actions), false);
+			q.SetValue(tpl.params[8], Anope::ToString(row.delta.smileys_happy), false);
+			q.SetValue(tpl.params[9], Anope::ToString(row.delta.smileys_sad), false);
+			q.SetValue(tpl.params[10], Anope::ToString(row.delta.smileys_other), false);
+			q.SetValue(tpl.params[11], Anope::ToString(row.delta.kicks), false);
+			q.SetValue(tpl.params[12], Anope::ToString(row.delta.kicked), false);
+			q.SetValue(tpl.params[13], Anope::ToString(row.delta.modes), false);
+			q.SetValue(tpl.params[14], Anope::ToString(row.delta.topics), false);
+		}
+		query += upsert_tail;
+
+		// IMPORTANT: SQL::Query::operator= clears parameters.
+		q.query = query;
+	}
+
+	/** Whether the journal is over its size limit even after dropping committed batches. */
+	bool JournalFull()
+	{
+		if (!journal.IsOpen() || journal.Size() < max_journal_size)
+			return false;
+
+		if (outstanding_bytes < journal.Size() / 2)
+			CompactJournal();
+		return journal.Size() >= max_journal_size;
+	}
+
+	void CompactJournal()
+	{
+		Journal::EntryMap keep;
+		for (const auto &[id, batch] : batches)
+			keep[id] = batch.entry;
+
+		if (!journal.Compact(keep))
+		{
+			Log(this) << "chanstats_plus: unable to compact journal " << journal.GetPath();
+			return;
+		}
+
+		for (const auto &[id, entry] : keep)
+			batches[id].entry = entry;
+	}
+
+	/** Appends a batch to the journal as uncommitted. */
+	bool JournalBatch(uint64_t id, const std::vector<BatchRow> &rows, BatchKind kind)
+	{
+		if (!journal.IsOpen())
+			return false;
+
+		std::string payload;
+		EncodeBatch(rows, kind, payload);
+
+		OutstandingBatch batch;
+		if (!journal.Append(id, payload, batch.entry))
+		{
+			Log(this) << "chanstats_plus: unable to write batch " << id << " to journal " << journal.GetPath();
+			return false;
+		}
+
+		batches[id] = batch;
+		outstanding_bytes += batch.entry.length;
+		return true;
+	}
+
+	/** Whether another batch may leave memory: the journal has room, and a
+	 * request slot is free or the batch can wait in the journal for one.
+	 */
+	bool CanDispatch(bool force_sync)
+	{
+		return !JournalFull() && (force_sync || in_flight < max_in_flight || journal.IsOpen());
+	}
+
+	/** Journals a batch and sends it. Rows only leave memory once they are in the journal.
+	 * With maxinflight batches outstanding the batch is only journaled, and
+	 * RetryBatches sends it as the server catches up.
+	 */
+	void DispatchBatch(const std::vector<BatchRow> &rows, BatchKind kind, bool force_sync)
+	{
+		const uint64_t id = next_batch_id++;
+		const bool journaled = JournalBatch(id, rows, kind);
+		if (journaled && !force_sync && in_flight >= max_in_flight)
+			return;
+		SendBatch(id, rows, kind, force_sync);
+	}
+
+	void SendBatch(uint64_t id, const std::vector<BatchRow> &rows, BatchKind kind, bool force_sync)
+	{
+		SQL::Query q;
+		if (kind == BATCH_SPEAKERS)
+			BuildSpeakersUpsert(rows, q);
+		else
+			BuildUpsert(rows, q);
+		sql_bytes += QuerySize(q);
+
+		if (force_sync)
+		{
+			const auto sent = std::chrono::steady_clock::now();
+			auto res = sql->RunQuery(q);
+			OnBatchLatency(sent);
+			if (res)
+				OnBatchCommitted(id);
+			else
+				OnBatchFailed(id, res.GetError());
+			return;
+		}
+
+		auto it = batches.find(id);
+		if (it != batches.end())
+			it->second.in_flight = true;
+		sql->Run(new BatchResult(this, id), q);
+	}
+
+	void OnBatchLatency(std::chrono::steady_clock::time_point sent)
+	{
+		const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - sent);
+		const uint32_t ms = static_cast<uint32_t>(std::min<int64_t>(elapsed.count(), UINT32_MAX));
+		latency.Add(ms);
+
+		const size_t min_rows = std::max<size_t>(1, max_rows_per_query / 8);
+		if (ms > target_latency)
+		{
+			// Too slow: halve the batch and back off the flush cadence so
+			// more updates to the same rows coalesce in memory.
+			batch_rows = std::max(min_rows, batch_rows / 2);
+			current_interval = std::min(current_interval * 2, flush_interval * 8);
+		}
+		else if (ms < target_latency / 2)
+		{
+			batch_rows = std::min(max_rows_per_query, batch_rows + std::max<size_t>(1, batch_rows / 8));
+			if (current_interval > flush_interval)
+				current_interval--;
+		}
+	}
+
+	void OnBatchCommitted(uint64_t id)
+	{
+		auto it = batches.find(id);
+		if (it == batches.end())
+			return;
+
+		for (const auto &[chan, nick] : it->second.keys)
+		{
+			const uint32_t chan_id = replayed_names.Intern(chan);
+			const uint32_t nick_id = replayed_names.Intern(nick);
+			if (chan_id && nick_id)
+				replayed_pairs.emplace_back(chan_id, nick_id);
+		}
+
+		outstanding_bytes -= it->second.entry.length;
+		batches.erase(it);
+
+		if (!journal.IsOpen())
+			return;
+
+		if (batches.empty())
+			journal.Truncate(); // Nothing left to replay.
+		else
+			journal.Commit(id);
+	}
+
+	void OnBatchFailed(uint64_t id, const Anope::string &error)
+	{
+		auto it = batches.find(id);
+		if (it == batches.end())
+		{
+			Log(this) << "chanstats_plus: SQL error flushing stats, batch lost (no journal): " << error;
+			return;
+		}
+
+		OutstandingBatch &batch = it->second;
+		batch.in_flight = false;
+		batch.keys.clear();
+		batch.attempts++;
+		// 5s, 10s, 20s, ... up to 5 minutes.
+		batch.retry_at = Anope::CurTime + std::min<time_t>(300, time_t(5) << std::min(batch.attempts - 1, 6U));
+
+		if (batch.attempts == 1)
+			Log(this) << "chanstats_plus: SQL error flushing stats, batch " << id << " kept in journal for retry: " << error;
+		else
+			Log(LOG_DEBUG) << "chanstats_plus: retry " << batch.attempts << " of batch " << id << " failed: " << error;
+	}
+
+	/** Re-sends journaled batches that failed (or were left over from a previous run). */
+	void RetryBatches(size_t budget)
+	{
+		std::string payload;
+		std::vector<BatchRow> rows;
+		BatchKind kind;
+		for (auto it = batches.begin(); it != batches.end() && budget;)
+		{
+			const uint64_t id = it->first;
+			OutstandingBatch &batch = it->second;
+			++it;
+
+			if (batch.in_flight || batch.retry_at > Anope::CurTime)
+				continue;
+
+			if (in_flight >= max_in_flight)
+				return;
+
+			if (!journal.Read(batch.entry, payload) || !DecodeBatch(payload, rows, kind))
+			{
+				Log(this) << "chanstats_plus: batch " << id << " in journal " << journal.GetPath() << " is unreadable, dropping it";
+				OnBatchCommitted(id);
+				continue;
+			}
+
+			// Parked and retried batches reach SQL after their flush was announced,
+			// so the listener hears about them again once they commit.
+			if (flush_listener)
+			{
+				batch.keys.clear();
+				for (const auto &row : rows)
+					batch.keys.emplace_back(row.chan, row.nick);
+			}
+
+			SendBatch(id, rows, kind, false);
+			budget -= std::min(budget, rows.size());
+		}
+	}
+
+	/** Tells the flush listener about the names in table and the (channel, nick) pairs in ids. */
+	void NotifyFlushListener(const NameTable &table, std::vector<std::pair<uint32_t, uint32_t>> &ids)
+	{
+		// The same pair shows up once per day (or batch) it was written for.
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+		std::vector<std::pair<Anope::string, Anope::string>> pairs;
+		pairs.reserve(ids.size());
+		for (const auto &[chan, nick] : ids)
+			pairs.emplace_back(table.Name(chan), table.Name(nick));
+		flush_listener->OnFlushed(table.Names(), pairs);
+	}
+
+	void NotifyReplayed()
+	{
+		if (replayed_names.Names().size() <= 1)
+			return;
+
+		if (flush_listener)
+			NotifyFlushListener(replayed_names, replayed_pairs);
+		replayed_names.Clear();
+		replayed_pairs.clear();
+	}
+
+	/** Advances the current flush by at most budget entries and rows.
+	 * First the swapped-out deltas are expanded into their period rows (rows shared
+	 * between nicks, like the channel aggregate, are merged here), then the rows
+	 * are sent as batched UPSERTs.
+	 */
+	void PumpFlush(size_t budget, bool force_sync)
+	{
+		if (!sql || !Flushing())
+			return;
+
+		for (; budget && !flush_pending.empty(); --budget)
+		{
+			auto it = flush_pending.begin();
+			ExpandEntry(flush_rows, it->first, it->second);
+			if (it->first.nick)
+				flush_pairs.emplace_back(it->first.chan, it->first.nick);
+			flush_pending.erase(it);
+		}
+
+		if (!flush_pending.empty())
+			return;
+
+		std::vector<BatchRow> rows;
+		while (budget && !flush_rows.empty())
+		{
+			// Backpressure: leave the rows in memory until the journal has room
+			// (and, without a journal, until a request slot is free). Batches
+			// over maxinflight wait in the journal so the flush still finishes.
+			if (!CanDispatch(force_sync))
+				return;
+
+			TakeBatch(rows, std::min(batch_rows, row_templates.size()));
+			DispatchBatch(rows, BATCH_STATS, force_sync);
+
+			flush_processed += rows.size();
+			budget -= std::min(budget, rows.size());
+		}
+
+		if (!flush_rows.empty())
+			return;
+
+		// Queries run in order on the provider, so anything read after this sees the
+		// flush, except batches that are parked or waiting for a retry; NotifyReplayed
+		// announces those once they commit.
+		if (flush_listener)
+			NotifyFlushListener(flush_names, flush_pairs);
+
+		// Every row has been handed to SQL, so no id is referenced anymore.
+		flush_names.Clear();
+		flush_pairs.clear();
+		last_flush_bytes = sql_bytes - flush_start_bytes;
+		flushes++;
+		Log(LOG_DEBUG) << "chanstats_plus: flushed " << flush_processed << " rows";
+	}
+
+	void OpenJournal(const Anope::string &path)
+	{
+		if (journal.IsOpen() && !batches.empty())
+		{
+			Log(this) << "chanstats_plus: not switching journal while " << batches.size() << " batches in "
+				<< journal.GetPath() << " are uncommitted";
+			return;
+		}
+
+		journal.Close();
+		if (path.empty())
+			return;
+
+		Journal::EntryMap uncommitted;
+		uint64_t max_id = 0;
+		if (!journal.Open(path, uncommitted, max_id))
+		{
+			Log(this) << "chanstats_plus: unable to open journal " << path << ", flushed stats will not survive SQL errors";
+			return;
+		}
+
+		next_batch_id = std::max(next_batch_id, max_id + 1);
+		for (const auto &[id, entry] : uncommitted)
+		{
+			batches[id].entry = entry;
+			outstanding_bytes += entry.length;
+		}
+
+		if (!uncommitted.empty())
+			Log(this) << "chanstats_plus: replaying " << uncommitted.size() << " uncommitted batches from " << path;
+	}
+
+	static const char *CompactPeriod(size_t stage)
+	{
+		return stage == COMPACT_DAILY ? "daily" : "weekly";
+	}
+
+	void StartCompaction()
 	{
-		this->ClearSyntax();
-		this->SetSyntax(_("\037nickname\037 {ON | OFF}"));
+		const int32_t today = local_day.Get(Anope::CurTime);
+		compact_cutoff[COMPACT_DAILY] = today - static_cast<int32_t>(retain_daily);
+		compact_cutoff[COMPACT_WEEKLY] = StartOfWeek(today) - 7 * static_cast<int32_t>(retain_weekly);
+		std::fill(std::begin(compact_removed), std::end(compact_removed), 0);
+		compact_stage = retain_daily ? COMPACT_DAILY : COMPACT_WEEKLY;
+		compact_step = COMPACT_COUNT_BEFORE;
+		compacting = true;
 	}
 
-	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+	void FinishCompaction()
 	{
-		this->Run(source, params[0], params[1], true);
+		compacting = false;
+		last_compact = Anope::CurTime;
+		next_compact = Anope::CurTime + compact_interval;
+		std::copy(std::begin(compact_removed), std::end(compact_removed), std::begin(last_removed));
+
+		if (compact_removed[COMPACT_DAILY] || compact_removed[COMPACT_WEEKLY])
+			Log(this) << "chanstats_plus: retention removed " << compact_removed[COMPACT_DAILY] << " daily rows before "
+				<< FormatDays(compact_cutoff[COMPACT_DAILY]) << " and " << compact_removed[COMPACT_WEEKLY]
+				<< " weekly rows before " << FormatDays(compact_cutoff[COMPACT_WEEKLY]);
 	}
 
-	bool OnHelp(CommandSource &source, const Anope::string &) override
+	/** Issues the next step of the retention job; at most one query is in flight,
+	 * and it is a single bounded DELETE or an indexed SELECT ... LIMIT 1 probe,
+	 * so the table is never locked for long. The provider does not report
+	 * affected rows, so each stage counts the old rows once before and once
+	 * after its DELETEs and reports the difference.
+	 */
+	void PumpCompaction()
 	{
-		this->SendSyntax(source);
-		source.Reply(" ");
-		source.Reply(_("Turns chanstats+ statistics ON or OFF for this user."));
-		return true;
+		if (!compacting)
+		{
+			if ((!retain_daily && !retain_weekly) || Anope::CurTime < next_compact)
+				return;
+			StartCompaction();
+		}
+
+		if (compact_result)
+			return;
+
+		if (compact_stage == COMPACT_DAILY && !retain_daily)
+			compact_stage++;
+		if (compact_stage == COMPACT_WEEKLY && !retain_weekly)
+			compact_stage++;
+		if (compact_stage == COMPACT_STAGES)
+		{
+			FinishCompaction();
+			return;
+		}
+
+		const Anope::string where = " FROM `" + prefix + "chanstatsplus` WHERE `period` = @period@ AND `period_start` < @cutoff@";
+		SQL::Query q;
+		switch (compact_step)
+		{
+			case COMPACT_COUNT_BEFORE:
+			case COMPACT_COUNT_AFTER:
+				q = "SELECT COUNT(*) AS `n`" + where + ";";
+				break;
+			case COMPACT_PROBE:
+				q = "SELECT 1 AS `n`" + where + " LIMIT 1;";
+				break;
+			case COMPACT_DELETE:
+				// DELETE ... LIMIT needs a compile-time option in SQLite.
+				if (sqlite)
+					q = "DELETE FROM `" + prefix + "chanstatsplus` WHERE rowid IN (SELECT rowid" + where + " LIMIT " + Anope::ToString(compact_batch) + ");";
+				else
+					q = "DELETE" + where + " LIMIT " + Anope::ToString(compact_batch) + ";";
+				break;
+		}
+		q.SetValue("period", Anope::string(CompactPeriod(compact_stage)));
+		q.SetValue("cutoff", FormatDays(compact_cutoff[compact_stage]));
+		sql->Run(new CompactResult(this, compact_step), q);
 	}
-};
 
-class ChanstatsPlusSQLInterface final
-	: public SQL::Interface
-{
-public:
-	ChanstatsPlusSQLInterface(Module *m) : SQL::Interface(m) { }
+	void OnCompactResult(CompactStep step, const SQL::Result &r)
+	{
+		if (!compacting)
+			return;
 
-	void OnResult(const SQL::Result &) override { }
+		switch (step)
+		{
+			case COMPACT_COUNT_BEFORE:
+				compact_before = r.Rows() ? Anope::Convert<uint64_t>(r.Get(0, "n"), 0) : 0;
+				// Enough DELETEs for what is there now, plus one in case a replayed
+				// batch adds old rows meanwhile; whatever is left waits for the next run.
+				compact_deletes_left = (compact_before + compact_batch - 1) / compact_batch + 1;
+				if (compact_before)
+					compact_step = COMPACT_DELETE;
+				else
+					NextCompactStage();
+				break;
+			case COMPACT_DELETE:
+				compact_deletes_left--;
+				compact_step = COMPACT_PROBE;
+				break;
+			case COMPACT_PROBE:
+				compact_step = r.Rows() && compact_deletes_left ? COMPACT_DELETE : COMPACT_COUNT_AFTER;
+				break;
+			case COMPACT_COUNT_AFTER:
+			{
+				// A replayed batch can add old rows while we delete; only count what went away.
+				const uint64_t after = r.Rows() ? Anope::Convert<uint64_t>(r.Get(0, "n"), 0) : 0;
+				compact_removed[compact_stage] += compact_before > after ? compact_before - after : 0;
+				NextCompactStage();
+				break;
+			}
+		}
+	}
 
-	void OnError(const SQL::Result &r) override
+	void NextCompactStage()
 	{
-		if (!r.GetQuery().query.empty())
-			Log(LOG_DEBUG) << "chanstats_plus: SQL error executing query " << r.finished_query << ": " << r.GetError();
-		else
-			Log(LOG_DEBUG) << "chanstats_plus: SQL error executing query: " << r.GetError();
+		compact_stage++;
+		compact_step = COMPACT_COUNT_BEFORE;
 	}
-};
 
-class MChanstatsPlus final
-	: public Module
-{
-	SerializableExtensibleItem<bool> cs_stats;
-	SerializableExtensibleItem<bool> ns_stats;
+	void OnCompactError(const Anope::string &error)
+	{
+		Log(this) << "chanstats_plus: retention of " << CompactPeriod(compact_stage) << " rows failed: " << error;
+		FinishCompaction();
+	}
 
-	CommandCSSetChanstatsPlus command_cs_set;
-	CommandNSSetChanstatsPlus command_ns_set;
-	CommandNSSASetChanstatsPlus command_ns_saset;
+	/** Counts one channel message. */
+	StatsDelta AnalyseMessage(const Anope::string &msg) const
+	{
+		std::string_view text(msg.str());
+		StatsDelta d;
 
-	ServiceReference<SQL::Provider> sql;
-	ChanstatsPlusSQLInterface sqlinterface;
+		if (IsCTCPAction(msg))
+		{
+			// "\x01ACTION <text>\x01" -> "<text>"
+			d.actions = 1;
+			text.remove_prefix(8);
+			if (!text.empty() && text.back() == '\x01')
+				text.remove_suffix(1);
+		}
 
-	Anope::string engine;
-	Anope::string prefix;
-	Anope::string SmileysHappy;
-	Anope::string SmileysSad;
-	Anope::string SmileysOther;
+		MessageCounts counts;
+		analyser.Analyse(text, counts);
 
-	time_t flush_interval = 5;
-	size_t max_pending = 100000;
-	size_t max_rows_per_query = 500;
+		d.lines = 1;
+		d.letters = counts.letters;
+		d.words = counts.words;
+		d.smileys_happy = counts.smileys[SMILEY_HAPPY];
+		d.smileys_sad = counts.smileys[SMILEY_SAD];
+		d.smileys_other = counts.smileys[SMILEY_OTHER];
 
-	Anope::unordered_map<StatsDelta> pending;
+		const uint64_t smiley_count = d.smileys_happy + d.smileys_sad + d.smileys_other;
+		if (smiley_count >= d.words)
+			d.words = 0;
+		else
+			d.words -= smiley_count;
+		return d;
+	}
 
-	class FlushTimer final
-		: public Timer
+	void CountSpeaker(const Anope::string &channel, ChannelSpeakers &cs, User *u)
 	{
-		MChanstatsPlus *owner;
+		uint64_t *hash = speaker_hash.Get(u);
+		if (!hash)
+		{
+			// Account ids are stable across nick changes; unidentified users count by nick.
+			hash = speaker_hash.Set(u);
+			*hash = Mix64(u->IsIdentified() ? u->Account()->GetId() : Anope::hash_ci()(u->nick));
+		}
+		const int32_t day = local_day.Get(Anope::CurTime);
 
-	public:
-		FlushTimer(MChanstatsPlus *m, time_t interval)
-			: Timer(m, interval, true)
-			, owner(m)
+		for (size_t slot = 0; slot < ChannelSpeakers::SLOTS; ++slot)
 		{
+			const int32_t start = ChannelSpeakers::SlotStart(slot, day);
+			if (cs.start[slot] != start)
+			{
+				// The period rolled over; keep the final estimate of the old one.
+				if (cs.dirty[slot])
+					speaker_rows.push_back({ channel, ChannelSpeakers::SlotPeriod(slot), cs.start[slot], cs.sketch[slot].Estimate() });
+				cs.sketch[slot].Clear();
+				cs.start[slot] = start;
+				cs.dirty[slot] = false;
+			}
+			if (cs.sketch[slot].Add(*hash))
+				cs.dirty[slot] = true;
 		}
+	}
 
-		void Tick() override
+	/** Writes the estimates that changed since the last flush and forgets channels idle since last month.
+	 * unique_speakers only ever grows within a period, so GREATEST()/MAX() makes resending harmless.
+	 */
+	void FlushSpeakers()
+	{
+		const int32_t month = StartOfMonth(local_day.Get(Anope::CurTime));
+		for (auto it = activity.begin(); it != activity.end();)
 		{
-			if (owner)
-				owner->Flush(false);
+			ChannelSpeakers &cs = it->second.speakers;
+			bool current = false;
+			for (size_t slot = 0; slot < ChannelSpeakers::SLOTS; ++slot)
+			{
+				if (cs.dirty[slot])
+				{
+					speaker_rows.push_back({ it->first, ChannelSpeakers::SlotPeriod(slot), cs.start[slot], cs.sketch[slot].Estimate() });
+					cs.dirty[slot] = false;
+				}
+				if (cs.start[slot] >= month)
+					current = true;
+			}
+
+			if (current || it->second.live)
+				++it;
+			else
+				it = activity.erase(it);
 		}
-	};
 
-	FlushTimer *flush_timer = nullptr;
+		if (!sql)
+			return;
 
-	void RunQuery(const SQL::Query &q)
+		std::vector<BatchRow> rows;
+		while (!speaker_rows.empty() && CanDispatch(false))
+		{
+			TakeSpeakerBatch(rows);
+			DispatchBatch(rows, BATCH_SPEAKERS, false);
+		}
+	}
+
+	/** Moves up to maxrowsperquery estimates out of speaker_rows. */
+	void TakeSpeakerBatch(std::vector<BatchRow> &rows)
 	{
-		if (sql)
-			sql->Run(&sqlinterface, q);
+		rows.clear();
+		const size_t count = std::min(speaker_rows.size(), max_rows_per_query);
+		for (size_t i = 0; i < count; ++i)
+		{
+			const SpeakerRow &row = speaker_rows[i];
+			rows.push_back({ row.chan, "", row.period, row.start, StatsDelta(), row.count });
+		}
+		speaker_rows.erase(speaker_rows.begin(), speaker_rows.begin() + count);
 	}
 
-	Anope::string GetDisplay(User *u) const
+	void BuildSpeakersUpsert(const std::vector<BatchRow> &rows, SQL::Query &q)
 	{
-		if (u && u->IsIdentified() && ns_stats.HasExt(u->Account()))
-			return u->Account()->display;
-		return "";
+		Anope::string query = "INSERT INTO `" + prefix + "chanstatsplus` (`chan`,`nick`,`period`,`period_start`,`unique_speakers`) VALUES ";
+		for (size_t i = 0; i < rows.size(); ++i)
+		{
+			const BatchRow &row = rows[i];
+			const Anope::string idx = Anope::ToString(i);
+			if (i)
+				query += ",";
+			query += "(@chan" + idx + "@,@nick" + idx + "@,@period" + idx + "@,@pstart" + idx + "@,@count" + idx + "@)";
+
+			q.SetValue("chan" + idx, row.chan);
+			q.SetValue("nick" + idx, row.nick);
+			q.SetValue("period" + idx, Anope::string(PeriodName(row.period)));
+			q.SetValue("pstart" + idx, FormatDays(row.start));
+			q.SetValue("count" + idx, Anope::ToString(row.unique_speakers), false);
+		}
+		if (sqlite)
+			query += " ON CONFLICT(`chan`,`nick`,`period`,`period_start`) DO UPDATE SET unique_speakers=MAX(unique_speakers,excluded.unique_speakers);";
+		else
+			query += " ON DUPLICATE KEY UPDATE unique_speakers=GREATEST(unique_speakers,VALUES(unique_speakers));";
+
+		// IMPORTANT: SQL::Query::operator= clears parameters.
+		q.query = query;
 	}
 
-	void EnsureSchema()
+	/** Loads the sketches saved by SaveSpeakers. They are marked dirty so the
+	 * next flush rewrites their estimates (harmless, see FlushSpeakers).
+	 */
+	void LoadSpeakers()
 	{
-		if (!sql)
+		std::ifstream in(speakers_path.str(), std::ios::in | std::ios::binary);
+		if (!in.is_open())
 			return;
 
-		SQL::Query q;
-		q = "CREATE TABLE IF NOT EXISTS `" + prefix + "chanstatsplus` ("
-			"`chan` varchar(64) NOT NULL DEFAULT '',"
-			"`nick` varchar(64) NOT NULL DEFAULT '',"
-			"`period` ENUM('total','monthly','weekly','daily') NOT NULL,"
-			"`period_start` date NOT NULL,"
-			"`letters` bigint unsigned NOT NULL DEFAULT '0',"
-			"`words` bigint unsigned NOT NULL DEFAULT '0',"
-			"`lines` int unsigned NOT NULL DEFAULT '0',"
-			"`actions` int unsigned NOT NULL DEFAULT '0',"
-			"`smileys_happy` int unsigned NOT NULL DEFAULT '0',"
-			"`smileys_sad` int unsigned NOT NULL DEFAULT '0',"
-			"`smileys_other` int unsigned NOT NULL DEFAULT '0',"
-			"`kicks` int unsigned NOT NULL DEFAULT '0',"
-			"`kicked` int unsigned NOT NULL DEFAULT '0',"
-			"`modes` int unsigned NOT NULL DEFAULT '0',"
-			"`topics` int unsigned NOT NULL DEFAULT '0',"
-			"PRIMARY KEY (`chan`,`nick`,`period`,`period_start`),"
-			"KEY `nick_idx` (`nick`),"
-			"KEY `chan_idx` (`chan`),"
-			"KEY `period_idx` (`period`,`period_start`)"
-			") ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;";
-		this->RunQuery(q);
+		const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		size_t pos = 0;
+		uint32_t count;
+		if (!GetRaw(data, pos, count))
+			return;
+
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			Anope::string channel;
+			if (!GetName(data, pos, channel))
+				break;
+
+			ChannelSpeakers cs;
+			bool ok = true;
+			for (size_t slot = 0; ok && slot < ChannelSpeakers::SLOTS; ++slot)
+			{
+				ok = GetRaw(data, pos, cs.start[slot]) && data.length() - pos >= SpeakerSketch::REGISTERS;
+				if (!ok)
+					break;
+				std::memcpy(cs.sketch[slot].Data(), data.data() + pos, SpeakerSketch::REGISTERS);
+				pos += SpeakerSketch::REGISTERS;
+				cs.dirty[slot] = true;
+			}
+			if (!ok)
+			{
+				Log(this) << "chanstats_plus: " << speakers_path << " is truncated, ignoring the rest of it";
+				break;
+			}
+			activity[channel].speakers = cs;
+		}
 	}
 
-	void AddForPeriods(const Anope::string &chan, const Anope::string &nick, const StatsDelta &delta)
+	void SaveSpeakers()
 	{
-		if (delta.Empty())
+		if (speakers_path.empty())
 			return;
 
-		const time_t now = Anope::CurTime;
-		const Anope::string day = FormatDateYMD(StartOfDay(now));
-		const Anope::string week = FormatDateYMD(StartOfWeek(now));
-		const Anope::string month = FormatDateYMD(StartOfMonth(now));
-		const Anope::string total = "1970-01-01";
+		std::string data;
+		PutRaw(data, static_cast<uint32_t>(activity.size()));
+		for (const auto &[channel, state] : activity)
+		{
+			const ChannelSpeakers &cs = state.speakers;
+			PutName(data, channel);
+			for (size_t slot = 0; slot < ChannelSpeakers::SLOTS; ++slot)
+			{
+				PutRaw(data, cs.start[slot]);
+				data.append(reinterpret_cast<const char *>(cs.sketch[slot].Data()), SpeakerSketch::REGISTERS);
+			}
+		}
 
-		struct PeriodRow final
+		const Anope::string tmp = speakers_path + ".tmp";
 		{
-			const char *name;
-			const Anope::string *start;
-		};
+			std::ofstream out(tmp.str(), std::ios::out | std::ios::binary | std::ios::trunc);
+			out.write(data.data(), data.length());
+			out.flush();
+			if (!out)
+			{
+				Log(this) << "chanstats_plus: unable to write " << tmp;
+				return;
+			}
+		}
 
-		const PeriodRow rows[] = {
-			{"total", &total},
-			{"monthly", &month},
-			{"weekly", &week},
-			{"daily", &day},
-		};
+		std::error_code ec;
+		std::filesystem::rename(tmp.str(), speakers_path.str(), ec);
+		if (ec)
+			Log(this) << "chanstats_plus: unable to rename " << tmp << " to " << speakers_path << ": " << ec.message();
+	}
 
-		for (const auto &row : rows)
+	void SweepLiveBoards()
+	{
+		if (Anope::CurTime - last_live_sweep < 60)
+			return;
+
+		last_live_sweep = Anope::CurTime;
+		const int64_t now = Anope::CurTime / 60;
+		for (auto &[channel, state] : activity)
 		{
-			Anope::string key = MakeKey(chan, nick, row.name, *row.start);
-			pending[key].Add(delta);
+			if (state.live && state.live->Idle(now))
+				state.live.reset();
 		}
 	}
 
-	void AddEvent(const Anope::string &channel, const Anope::string &nick, const StatsDelta &delta)
+	void OnFlushTick()
 	{
-		// Channel aggregate
-		AddForPeriods(channel, "", delta);
+		SweepLiveBoards();
 
-		if (!nick.empty())
+		static const char *const drop_reasons[DROP_REASONS] = {
+			"",
+			"the SQL provider is unavailable",
+			"the journal is full",
+			"SQL is not keeping up and there is no journal to park batches in",
+		};
+		for (size_t reason = DROP_NO_SQL; reason < DROP_REASONS; ++reason)
 		{
-			// Per-nick (in channel)
-			AddForPeriods(channel, nick, delta);
-			// Per-nick (global)
-			AddForPeriods("", nick, delta);
+			if (dropped_events[reason] == reported_drops[reason])
+				continue;
+
+			Log(this) << "chanstats_plus: dropped " << (dropped_events[reason] - reported_drops[reason]) << " events, "
+				<< drop_reasons[reason];
+			reported_drops[reason] = dropped_events[reason];
 		}
 
-		if (pending.size() >= max_pending)
-			Flush(false);
+		if (!sql)
+			return;
+
+		RetryBatches(flush_budget);
+		NotifyReplayed();
+		PumpCompaction();
+
+		// Drain the whole flush this tick and start the next one without
+		// waiting for the interval.
+		const bool behind = catch_up;
+		catch_up = false;
+		if (behind)
+			PumpFlush(SIZE_MAX, false);
+
+		if (!Flushing())
+		{
+			if (!behind && Anope::CurTime - last_flush < current_interval)
+				return;
+			FlushSpeakers();
+			if (!StartFlush())
+				return;
+		}
+		PumpFlush(flush_budget, false);
 	}
 
+	/** Drains everything synchronously; used on unload. */
 	void Flush(bool force_sync)
 	{
-		if (!sql || pending.empty())
-			return;
-
-		size_t processed = 0;
-		while (!pending.empty())
-		{
-			SQL::Query q;
-			Anope::string query = "INSERT INTO `" + prefix + "chanstatsplus` ("
-				"`chan`,`nick`,`period`,`period_start`,"
-				"`letters`,`words`,`lines`,`actions`,"
-				"`smileys_happy`,`smileys_sad`,`smileys_other`,"
-				"`kicks`,`kicked`,`modes`,`topics`) VALUES ";
-
-			size_t rowcount = 0;
-			for (auto it = pending.begin(); it != pending.end() && rowcount < max_rows_per_query;)
-			{
-				Anope::string chan, nick, period, period_start;
-				SplitKey(it->first, chan, nick, period, period_start);
-
-				const StatsDelta delta = it->second;
-				it = pending.erase(it);
-
-				const Anope::string idx = Anope::ToString(rowcount);
-				if (rowcount)
-					query += ",";
-				query += "(@chan" + idx + "@,@nick" + idx + "@,@period" + idx + "@,@pstart" + idx + "@,";
-				query += "@letters" + idx + "@,@words" + idx + "@,@lines" + idx + "@,@actions" + idx + "@,";
-				query += "@smh" + idx + "@,@sms" + idx + "@,@smo" + idx + "@,";
-				query += "@kicks" + idx + "@,@kicked" + idx + "@,@modes" + idx + "@,@topics" + idx + "@)";
-
-				q.SetValue("chan" + idx, chan);
-				q.SetValue("nick" + idx, nick);
-				q.SetValue("period" + idx, period);
-				q.SetValue("pstart" + idx, period_start);
-
-				q.SetValue("letters" + idx, Anope::ToString(delta.letters), false);
-				q.SetValue("words" + idx, Anope::ToString(delta.words), false);
-				q.SetValue("lines" + idx, Anope::ToString(delta.lines), false);
-				q.SetValue("actions" + idx, Anope::ToString(delta.actions), false);
-				q.SetValue("smh" + idx, Anope::ToString(delta.smileys_happy), false);
-				q.SetValue("sms" + idx, Anope::ToString(delta.smileys_sad), false);
-				q.SetValue("smo" + idx, Anope::ToString(delta.smileys_other), false);
-				q.SetValue("kicks" + idx, Anope::ToString(delta.kicks), false);
-				q.SetValue("kicked" + idx, Anope::ToString(delta.kicked), false);
-				q.SetValue("modes" + idx, Anope::ToString(delta.modes), false);
-				q.SetValue("topics" + idx, Anope::ToString(delta.topics), false);
-
-				rowcount++;
-			}
-
-			query += " ON DUPLICATE KEY UPDATE "
-				"letters=letters+VALUES(letters),"
-				"words=words+VALUES(words),"
-				"`lines`=`lines`+VALUES(`lines`),"
-				"actions=actions+VALUES(actions),"
-				"smileys_happy=smileys_happy+VALUES(smileys_happy),"
-				"smileys_sad=smileys_sad+VALUES(smileys_sad),"
-				"smileys_other=smileys_other+VALUES(smileys_other),"
-				"kicks=kicks+VALUES(kicks),"
-				"kicked=kicked+VALUES(kicked),"
-				"modes=modes+VALUES(modes),"
-				"topics=topics+VALUES(topics);";
-
-			// IMPORTANT: SQL::Query::operator= clears parameters.
-			q.query = query;
-
-			if (force_sync)
-				sql->RunQuery(q);
-			else
-				this->RunQuery(q);
+		PumpFlush(SIZE_MAX, force_sync);
+		if (StartFlush())
+			PumpFlush(SIZE_MAX, force_sync);
+	}
 
-			processed += rowcount;
+	/** Writes whatever Flush() could not send (SQL is gone or the journal is
+	 * full) to the journal, ignoring maxjournalsize, so the next load replays it.
+	 * Used on unload.
+	 */
+	void SpillToJournal()
+	{
+		size_t spilled = 0, lost = 0;
+		std::vector<BatchRow> rows;
+		do
+		{
+			for (const auto &[key, delta] : flush_pending)
+				ExpandEntry(flush_rows, key, delta);
+			flush_pending.clear();
+			flush_pairs.clear();
+
+			while (!flush_rows.empty())
+			{
+				TakeBatch(rows, max_rows_per_query);
+				if (JournalBatch(next_batch_id++, rows, BATCH_STATS))
+					spilled += rows.size();
+				else
+					lost += rows.size();
+			}
+			flush_names.Clear();
+		}
+		while (StartFlush());
+
+		while (!speaker_rows.empty())
+		{
+			TakeSpeakerBatch(rows);
+			if (JournalBatch(next_batch_id++, rows, BATCH_SPEAKERS))
+				spilled += rows.size();
+			else
+				lost += rows.size();
 		}
 
-		if (processed)
-			Log(LOG_DEBUG) << "chanstats_plus: flushed " << processed << " rows";
+		if (spilled)
+			Log(this) << "chanstats_plus: wrote " << spilled << " unsent rows to " << journal.GetPath() << " for the next load";
+		if (lost)
+			Log(this) << "chanstats_plus: lost " << lost << " unsent rows, there is no journal to keep them in";
 	}
 
 public:
@@ -594,33 +2771,103 @@ public:
 		: Module(modname, creator, EXTRA | VENDOR)
 		, cs_stats(this, EXT_CS_STATS)
 		, ns_stats(this, EXT_NS_STATS)
+		, speaker_hash(this, "chanstats_plus_speaker_hash")
 		, command_cs_set(this)
 		, command_ns_set(this)
 		, command_ns_saset(this)
+		, command_os(this, this)
+		, command_cs_livetop(this, this)
 		, sql("", "")
 		, sqlinterface(this)
+		, live_top_event(this)
+		, flush_listener("ChanstatsPlusFlushListener", "rpc_chanstatsplus")
+		, partition_check(this)
+		, column_check(this)
 	{
 	}
 
 	~MChanstatsPlus() override
 	{
 		Flush(true);
+		SpillToJournal();
 		delete flush_timer;
 		flush_timer = nullptr;
+
+		// Anything still in flight stays uncommitted in the journal and is replayed on the next load.
+		while (!live_results.empty())
+			delete *live_results.begin();
+		delete compact_result;
+		journal.Close();
+		SaveSpeakers();
 	}
 
 	void OnReload(Configuration::Conf &conf) override
 	{
 		const auto &block = conf.GetModule(this);
 		prefix = block.Get<const Anope::string>("prefix", "anope_");
-		SmileysHappy = block.Get<const Anope::string>("smileyshappy");
-		SmileysSad = block.Get<const Anope::string>("smileyssad");
-		SmileysOther = block.Get<const Anope::string>("smileysother");
+
+		std::vector<Anope::string> smileys[SMILEY_KINDS];
+		const char *smileykeys[SMILEY_KINDS] = { "smileyshappy", "smileyssad", "smileysother" };
+		for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+		{
+			spacesepstream sep(block.Get<const Anope::string>(smileykeys[kind]));
+			Anope::string token;
+			while (sep.GetToken(token))
+			{
+				if (!token.empty())
+					smileys[kind].push_back(token);
+			}
+		}
+		analyser.Build(smileys);
+
 		engine = block.Get<const Anope::string>("engine");
+		const Anope::string dialect = block.Get<const Anope::string>("dialect");
+		sqlite = dialect.empty() ? engine.find_ci("sqlite") == 0 : dialect.equals_ci("sqlite");
 
 		flush_interval = block.Get<time_t>("flushinterval", "5s");
 		max_pending = block.Get<size_t>("maxpending", "100000");
 		max_rows_per_query = block.Get<size_t>("maxrowsperquery", "500");
+		flush_budget = block.Get<size_t>("flushbudget", "5000");
+		if (!max_rows_per_query)
+			max_rows_per_query = 1;
+		if (!flush_budget)
+			flush_budget = max_rows_per_query;
+		BuildRowTemplates();
+
+		const size_t window = block.Get<time_t>("livewindow", "0") / 60;
+		const size_t capacity = std::max<size_t>(1, block.Get<size_t>("livecapacity", "32"));
+		if (window != live_window || capacity != live_capacity)
+		{
+			for (auto &[channel, state] : activity)
+				state.live.reset();
+		}
+		live_window = window;
+		live_capacity = capacity;
+
+		target_latency = block.Get<uint32_t>("targetlatency", "1000");
+		max_in_flight = std::max<size_t>(1, block.Get<size_t>("maxinflight", "4"));
+		batch_rows = std::min(std::max<size_t>(batch_rows, max_rows_per_query / 8), max_rows_per_query);
+		current_interval = std::max(flush_interval, std::min(current_interval, flush_interval * 8));
+
+		max_journal_size = block.Get<uint64_t>("maxjournalsize", "65536") * 1024;
+		const Anope::string journal_file = block.Get<const Anope::string>("journal", "chanstats_plus.journal");
+		const Anope::string journal_path = journal_file.empty() ? "" : Anope::ExpandData(journal_file);
+		if (journal_path != journal.GetPath() || !journal.IsOpen())
+			OpenJournal(journal_path);
+
+		retain_daily = block.Get<uint32_t>("retaindaily", "0");
+		retain_weekly = block.Get<uint32_t>("retainweekly", "0");
+		compact_interval = std::max<time_t>(60, block.Get<time_t>("compactinterval", "6h"));
+		compact_batch = std::max<size_t>(1, block.Get<size_t>("compactbatch", "5000"));
+		partition_by_period = block.Get<bool>("partitionbyperiod");
+		if (!compacting)
+			next_compact = std::min(next_compact, Anope::CurTime + compact_interval);
+
+		const Anope::string speakers_file = block.Get<const Anope::string>("speakers", "chanstats_plus.speakers");
+		speakers_path = speakers_file.empty() ? "" : Anope::ExpandData(speakers_file);
+		if (!speakers_loaded && !speakers_path.empty())
+			LoadSpeakers();
+		speakers_loaded = true;
 
 		this->sql = ServiceReference<SQL::Provider>("SQL::Provider", engine);
 		if (!sql)
@@ -632,7 +2879,85 @@ public:
 		EnsureSchema();
 
 		delete flush_timer;
-		flush_timer = new FlushTimer(this, flush_interval);
+		flush_timer = new FlushTimer(this);
+	}
+
+	void OnSaveDatabase() override
+	{
+		SaveSpeakers();
+	}
+
+	std::vector<std::pair<Anope::string, uint32_t>> LiveTop(const Anope::string &channel, size_t limit)
+	{
+		auto it = activity.find(channel);
+		if (it == activity.end() || !it->second.live)
+			return {};
+		return it->second.live->Top(limit, Anope::CurTime / 60);
+	}
+
+	size_t LiveWindow() const
+	{
+		return live_window;
+	}
+
+	size_t LiveCapacity() const
+	{
+		return live_capacity;
+	}
+
+	bool HasStats(ChannelInfo *ci) const
+	{
+		return cs_stats.HasExt(ci);
+	}
+
+	void SendStats(CommandSource &source)
+	{
+		source.Reply(_("Batch size: %zu rows (max %zu), flush interval: %lds (configured %lds)"),
+			batch_rows, max_rows_per_query, static_cast<long>(current_interval), static_cast<long>(flush_interval));
+		source.Reply(_("Pending: %zu entries; flushing: %zu entries, %zu rows"),
+			pending.size(), flush_pending.size(), flush_rows.size());
+		source.Reply(_("In flight: %zu of %zu batches; uncommitted in journal: %zu batches (%llu bytes on disk)"),
+			in_flight, max_in_flight, batches.size(), static_cast<unsigned long long>(journal.Size()));
+		source.Reply(_("SQL latency over the last %zu batches: p50 %u ms, p90 %u ms, p99 %u ms (target %u ms)"),
+			latency.Count(), latency.Percentile(50), latency.Percentile(90), latency.Percentile(99), target_latency);
+		const time_t uptime = std::max<time_t>(1, Anope::CurTime - loaded_at);
+		source.Reply(_("Messages: %llu (%llu/s on average), peak pending: %zu entries"),
+			static_cast<unsigned long long>(messages_seen), static_cast<unsigned long long>(messages_seen / uptime), peak_pending);
+		source.Reply(_("SQL generated: %llu bytes in %llu flushes, last flush %llu bytes"),
+			static_cast<unsigned long long>(sql_bytes), static_cast<unsigned long long>(flushes),
+			static_cast<unsigned long long>(last_flush_bytes));
+		if (dropped_events[DROP_NO_SQL] || dropped_events[DROP_JOURNAL_FULL] || dropped_events[DROP_BACKLOG])
+		{
+			source.Reply(_("Dropped events: %llu without SQL, %llu with the journal full, %llu behind SQL"),
+				static_cast<unsigned long long>(dropped_events[DROP_NO_SQL]),
+				static_cast<unsigned long long>(dropped_events[DROP_JOURNAL_FULL]),
+				static_cast<unsigned long long>(dropped_events[DROP_BACKLOG]));
+		}
+
+		if (compacting)
+			source.Reply(_("Retention: running, %s rows; removed %llu daily and %llu weekly rows so far"),
+				CompactPeriod(compact_stage), static_cast<unsigned long long>(compact_removed[COMPACT_DAILY]),
+				static_cast<unsigned long long>(compact_removed[COMPACT_WEEKLY]));
+		else if (last_compact)
+			source.Reply(_("Retention: last run %s, removed %llu daily and %llu weekly rows"),
+				Anope::strftime(last_compact, source.GetAccount()).c_str(),
+				static_cast<unsigned long long>(last_removed[COMPACT_DAILY]),
+				static_cast<unsigned long long>(last_removed[COMPACT_WEEKLY]));
+	}
+
+	void Compact(CommandSource &source)
+	{
+		if (!retain_daily && !retain_weekly)
+			source.Reply(_("Retention is disabled; set retaindaily and/or retainweekly."));
+		else if (!sql)
+			source.Reply(_("No database connection to %s."), engine.c_str());
+		else if (compacting)
+			source.Reply(_("Retention is already running."));
+		else
+		{
+			next_compact = 0;
+			source.Reply(_("Retention will run within a second; see \002STATS\002 for the result."));
+		}
 	}
 
 	void OnChanInfo(CommandSource &source, ChannelInfo *ci, InfoFormatter &info, bool show_all) override
@@ -692,30 +3017,36 @@ public:
 		if (!c || !c->ci || !cs_stats.HasExt(c->ci))
 			return;
 
-		Anope::string effective = msg;
-		StatsDelta d;
+		messages_seen++;
+		const StatsDelta d = AnalyseMessage(msg);
 
-		if (IsCTCPAction(msg))
+		const Anope::string nick = GetDisplay(u);
+		AddEvent(c->name, nick, d);
+
+		ChannelActivity &state = activity[c->name];
+		CountSpeaker(c->name, state.speakers, u);
+
+		if (live_window && !nick.empty())
 		{
-			d.actions = 1;
-			effective = StripCTCPAction(msg);
+			if (!state.live)
+				state.live.emplace(live_capacity, live_window);
+			state.live->Add(nick, Anope::CurTime / 60);
 		}
+	}
 
-		d.lines = 1;
-		d.letters = static_cast<uint64_t>(effective.length());
-		d.words = static_cast<uint64_t>(CountWords(effective));
-
-		d.smileys_happy = static_cast<uint64_t>(CountSmileys(effective, SmileysHappy));
-		d.smileys_sad = static_cast<uint64_t>(CountSmileys(effective, SmileysSad));
-		d.smileys_other = static_cast<uint64_t>(CountSmileys(effective, SmileysOther));
+	void OnUserNickChange(User *u, const Anope::string &) override
+	{
+		speaker_hash.Unset(u);
+	}
 
-		const uint64_t smiley_count = d.smileys_happy + d.smileys_sad + d.smileys_other;
-		if (smiley_count >= d.words)
-			d.words = 0;
-		else
-			d.words -= smiley_count;
+	void OnUserLogin(User *u) override
+	{
+		speaker_hash.Unset(u);
+	}
 
-		AddEvent(c->name, GetDisplay(u), d);
+	void OnNickLogout(User *u) override
+	{
+		speaker_hash.Unset(u);
 	}
 
 private:
@@ -730,4 +3061,46 @@ private:
 	}
 };
 
+void CommandCSLiveTop::Execute(CommandSource &source, const std::vector<Anope::string> &params)
+{
+	ChannelInfo *ci = ChannelInfo::Find(params[0]);
+	if (!ci)
+	{
+		source.Reply(CHAN_X_NOT_REGISTERED, params[0].c_str());
+		return;
+	}
+
+	if (!stats->LiveWindow() || !stats->HasStats(ci))
+	{
+		source.Reply(_("Live statistics are not available for \002%s\002."), ci->name.c_str());
+		return;
+	}
+
+	size_t limit = 5;
+	if (params.size() > 1)
+		limit = Anope::Convert<size_t>(params[1], limit);
+	limit = std::max<size_t>(1, std::min(limit, stats->LiveCapacity()));
+
+	const auto top = stats->LiveTop(ci->name, limit);
+	if (top.empty())
+	{
+		source.Reply(_("Nobody has talked in \002%s\002 in the last %zu minutes."), ci->name.c_str(), stats->LiveWindow());
+		return;
+	}
+
+	source.Reply(_("Top speakers in \002%s\002 over the last %zu minutes:"), ci->name.c_str(), stats->LiveWindow());
+	for (size_t i = 0; i < top.size(); ++i)
+		source.Reply(_("%zu. %s (%u lines)"), i + 1, top[i].first.c_str(), top[i].second);
+}
+
+void CommandOSChanstatsPlus::Execute(CommandSource &source, const std::vector<Anope::string> &params)
+{
+	if (params[0].equals_ci("STATS"))
+		stats->SendStats(source);
+	else if (params[0].equals_ci("COMPACT"))
+		stats->Compact(source);
+	else
+		this->OnSyntaxError(source, "");
+}
+
 MODULE_INIT(MChanstatsPlus)
@@ -8,109 +8,645 @@
  * Keep a history of topics per channel, allow listing and setting from the history
  *
  * Syntax: SET TOPICHISTORY channel {ON | OFF}
- * Syntax: TOPICHISTORY channel {LIST | CLEAR | SET entry-num}
+ * Syntax: TOPICHISTORY channel {LIST | CLEAR | SET entry-num | SEARCH [+page] text}
+ * Syntax: (OperServ) TOPICHISTORY {SEARCH [+page] text | MEMORY [count]}
  *
  * Configuration to put into your chanserv config:
  * module { name = "cs_topichistory"; maxhistory = 3; }
  * command { service = "ChanServ"; name = "SET TOPICHISTORY"; command = "chanserv/set/topichistory"; }
  * command { service = "ChanServ"; name = "TOPICHISTORY"; command = "chanserv/topichistory"; group = "chanserv/management"; }
+ * command { service = "OperServ"; name = "TOPICHISTORY"; command = "operserv/topichistory"; permission = "operserv/topichistory"; }
  *
  */
 
 #include "module.h"
 
 
-/* Individual Topic History entries */
-struct TopicHistoryEntry : Serializable
+/* This is set during load and config reload */
+unsigned maxhistory = 0;
+
+/* A channel's record must fit the TEXT column db_sql stores it in */
+static const size_t MAX_RECORD_BYTES = 65535;
+
+/* A single historical topic */
+struct TopicHistoryEntry
 {
- public:
-	Anope::string chan;
 	Anope::string topic;
 	Anope::string setter;
-	time_t when;
+	time_t when = 0;
+};
 
-	TopicHistoryEntry() : Serializable("TopicHistory") { }
+/* Setters are interned: each distinct nick is stored once, however many entries it set */
+class TopicHistorySetters
+{
+	std::unordered_map<Anope::string, size_t, Anope::hash_cs> refs;
 
-	TopicHistoryEntry(ChannelInfo *c, const Anope::string &ctopic, const Anope::string &csetter, time_t ctime = Anope::CurTime) : Serializable("TopicHistory")
+ public:
+	const Anope::string *Acquire(const Anope::string &setter)
 	{
-		this->chan = c->name;
-		this->topic = ctopic;
-		this->setter = csetter;
-		this->when = ctime;
+		auto it = this->refs.emplace(setter, 0).first;
+		++it->second;
+		return &it->first;
 	}
 
-	~TopicHistoryEntry();
+	void Release(const Anope::string *setter)
+	{
+		if (!setter)
+			return;
 
-	void Serialize(Serialize::Data &data) const
+		auto it = this->refs.find(*setter);
+		if (it != this->refs.end() && !--it->second)
+			this->refs.erase(it);
+	}
+
+	size_t size() const
 	{
-		data["chan"] << this->chan;
-		data["topic"] << this->topic;
-		data["setter"] << this->setter;
-		data["when"] << this->when;
+		return this->refs.size();
 	}
 
-	static Serializable* Unserialize(Serializable *obj, Serialize::Data &data);
+	size_t Bytes() const;
 };
 
-/* Per channel List of Topic History Entries */
-struct TopicHistoryList : Serialize::Checker<std::vector<TopicHistoryEntry *> >
+TopicHistorySetters topichistory_setters;
+
+/* Heap memory used by a string beyond its own size */
+static size_t HeapBytes(const Anope::string &str)
+{
+	static const size_t inline_capacity = std::string().capacity();
+	return str.str().capacity() > inline_capacity ? str.str().capacity() + 1 : 0;
+}
+
+/* The distinct words of a topic, lowercased, for the search index. A word is a run
+ * of letters and digits; formatting codes and punctuation separate words.
+ */
+static std::vector<Anope::string> TopicWords(const Anope::string &text)
 {
+	std::vector<Anope::string> words;
+	Anope::string word;
+	for (size_t i = 0; i <= text.length(); ++i)
+	{
+		const unsigned char c = i < text.length() ? text[i] : ' ';
+		if (std::isalnum(c) || c >= 0x80)
+		{
+			word += static_cast<char>(std::tolower(c));
+			continue;
+		}
+
+		if (!word.empty() && std::find(words.begin(), words.end(), word) == words.end())
+			words.push_back(word);
+		word.clear();
+	}
+	return words;
+}
+
+size_t TopicHistorySetters::Bytes() const
+{
+	size_t bytes = sizeof(*this) + this->refs.bucket_count() * sizeof(void *);
+	for (const auto &[setter, _] : this->refs)
+		bytes += sizeof(std::pair<const Anope::string, size_t>) + 2 * sizeof(void *) + HeapBytes(setter);
+	return bytes;
+}
+
+/* Per channel Topic History: a ring buffer holding the current topic and up to
+ * maxhistory historical topics, stored as one record per channel.
+ *
+ * Only the newest topic is kept in full. Every older one is stored as the bytes
+ * that differ from the topic set after it: how much of its start and end it
+ * shares with that topic, and the middle part in between.
+ */
+struct TopicHistoryList : Serializable
+{
+ private:
+	struct Packed
+	{
+		const Anope::string *setter = nullptr;
+		time_t when = 0;
+		/* Hash of the full topic, for the index */
+		size_t hash = 0;
+		/* Never reused or changed, so the word index survives entries moving between slots */
+		uint64_t id = 0;
+		uint16_t prefix = 0;
+		uint16_t suffix = 0;
+		/* Number of words this entry added to the word index */
+		uint16_t words = 0;
+		/* Bytes this entry takes in the record */
+		uint16_t encoded = 0;
+		Anope::string middle;
+	};
+
+	/* Grown as entries arrive, up to capacity slots, and only wrapped around once full */
+	std::vector<Packed> ring;
+	size_t capacity = 0;
+	/* Sequence number of the next entry; entry seq is kept in ring[seq % ring.size()] */
+	uint64_t next = 0;
+	size_t count = 0;
+	/* Length of Encode(), kept at most MAX_RECORD_BYTES by dropping the oldest entries */
+	size_t record_bytes = 0;
+	/* Topic hash to sequence number, so a repeated topic is found without comparing every entry */
+	std::unordered_multimap<size_t, uint64_t> index;
+
+	uint64_t next_id = 0;
+	/* Word hash to the ids of the entries containing it, ascending. Ids of entries that
+	 * are gone are left behind and skipped, until they outnumber the live ones and the
+	 * index is rebuilt.
+	 */
+	std::unordered_map<size_t, std::vector<uint64_t> > words;
+	size_t live_words = 0;
+	size_t stale_words = 0;
+
+	Packed &Slot(uint64_t seq)
+	{
+		return this->ring[seq % this->ring.size()];
+	}
+
+	void Unindex(uint64_t seq)
+	{
+		auto range = this->index.equal_range(this->Slot(seq).hash);
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			if (it->second == seq)
+			{
+				this->index.erase(it);
+				return;
+			}
+		}
+	}
+
+	/* Stores topic in entry as its difference from newer */
+	static void Delta(Packed &entry, const Anope::string &topic, const Anope::string &newer)
+	{
+		const size_t shared = std::min<size_t>(std::min(topic.length(), newer.length()), UINT16_MAX);
+		size_t prefix = 0;
+		while (prefix < shared && topic[prefix] == newer[prefix])
+			++prefix;
+		size_t suffix = 0;
+		while (suffix < shared - prefix && topic[topic.length() - 1 - suffix] == newer[newer.length() - 1 - suffix])
+			++suffix;
+
+		entry.prefix = prefix;
+		entry.suffix = suffix;
+		entry.middle = topic.substr(prefix, topic.length() - prefix - suffix);
+	}
+
+	static Anope::string Expand(const Packed &entry, const Anope::string &newer)
+	{
+		return newer.substr(0, entry.prefix) + entry.middle + newer.substr(newer.length() - entry.suffix);
+	}
+
+	void IndexWords(Packed &entry, const Anope::string &topic)
+	{
+		const std::vector<Anope::string> topicwords = TopicWords(topic);
+		entry.words = std::min<size_t>(topicwords.size(), UINT16_MAX);
+		for (size_t i = 0; i < entry.words; ++i)
+			this->words[Anope::hash_cs()(topicwords[i])].push_back(entry.id);
+		this->live_words += entry.words;
+	}
+
+	void UnindexWords(const Packed &entry)
+	{
+		this->live_words -= entry.words;
+		this->stale_words += entry.words;
+	}
+
+	void RebuildWords()
+	{
+		this->words.clear();
+		this->live_words = this->stale_words = 0;
+
+		const std::vector<TopicHistoryEntry> entries = this->List();
+		for (size_t i = entries.size(); i > 0; --i)
+			this->IndexWords(this->Slot(this->next - i), entries[i - 1].topic);
+	}
+
+	void CheckWords()
+	{
+		if (this->stale_words > this->live_words + 64)
+			this->RebuildWords();
+	}
+
+	/* Position of the entry with the given id, or -1. Ids grow from the oldest entry to the newest. */
+	int Position(uint64_t id)
+	{
+		size_t lo = 0, hi = this->count;
+		while (lo < hi)
+		{
+			const size_t mid = (lo + hi) / 2;
+			const uint64_t midid = this->Slot(this->next - 1 - mid).id;
+			if (midid == id)
+				return mid;
+			if (midid > id)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return -1;
+	}
+
+	void Clear()
+	{
+		for (const auto &entry : this->ring)
+			topichistory_setters.Release(entry.setter);
+		std::vector<Packed>().swap(this->ring);
+		this->next = 0;
+		this->count = 0;
+		this->record_bytes = 0;
+		this->index.clear();
+		this->words.clear();
+		this->live_words = this->stale_words = 0;
+	}
+
+	/* Empties the ring and refills it with entries (newest first), keeping as many as fit */
+	void Rebuild(size_t newcapacity, std::vector<TopicHistoryEntry> &entries)
+	{
+		this->Clear();
+		this->capacity = newcapacity;
+		std::vector<Packed>(std::min(entries.size(), newcapacity)).swap(this->ring);
+		for (size_t i = std::min(entries.size(), newcapacity); i > 0; --i)
+			this->Push(entries[i - 1]);
+	}
+
+	/* Doubles the ring, up to capacity; every entry keeps its sequence number */
+	void Grow()
+	{
+		std::vector<Packed> grown(std::min(this->capacity, std::max<size_t>(4, this->ring.size() * 2)));
+		for (uint64_t seq = this->next - this->count; seq < this->next; ++seq)
+			grown[seq % grown.size()] = std::move(this->Slot(seq));
+		this->ring.swap(grown);
+	}
+
+	/* Nothing is encoded against the oldest entry, so it can simply go */
+	void DropOldest()
+	{
+		const uint64_t seq = this->next - this->count;
+		Packed &oldest = this->Slot(seq);
+		this->Unindex(seq);
+		this->UnindexWords(oldest);
+		this->record_bytes -= oldest.encoded;
+		topichistory_setters.Release(oldest.setter);
+		oldest = Packed();
+		--this->count;
+	}
+
+	/* Bytes entry takes in Encode(), including the space separating it from the next */
+	static size_t EncodedSize(const TopicHistoryEntry &entry)
+	{
+		return Anope::ToString(entry.when).length() + entry.setter.length() + Anope::ToString(entry.topic.length()).length() + entry.topic.length() + 4;
+	}
+
+	void Push(const TopicHistoryEntry &entry)
+	{
+		if (this->count == this->ring.size() && this->ring.size() < this->capacity)
+			this->Grow();
+		if (this->count == this->ring.size())
+			this->DropOldest();
+
+		const uint64_t seq = this->next++;
+		++this->count;
+
+		/* The previous newest topic becomes a delta against this one */
+		if (this->count > 1)
+		{
+			Packed &prev = this->Slot(seq - 1);
+			Anope::string full = std::move(prev.middle);
+			Delta(prev, full, entry.topic);
+		}
+
+		Packed &slot = this->Slot(seq);
+		slot.setter = topichistory_setters.Acquire(entry.setter);
+		slot.when = entry.when;
+		slot.hash = Anope::hash_cs()(entry.topic);
+		slot.id = this->next_id++;
+		slot.prefix = slot.suffix = 0;
+		slot.middle = entry.topic;
+		slot.encoded = std::min<size_t>(EncodedSize(entry), UINT16_MAX);
+		this->record_bytes += slot.encoded;
+		this->index.emplace(slot.hash, seq);
+		this->IndexWords(slot, entry.topic);
+
+		/* Long topics can fill the record before the ring is full */
+		while (this->record_bytes > MAX_RECORD_BYTES && this->count > 1)
+			this->DropOldest();
+	}
+
  public:
-	TopicHistoryList(Extensible *) : Serialize::Checker<std::vector<TopicHistoryEntry *> >("TopicHistory") { }
+	Anope::string chan;
+	/* Set once loaded from a record, so leftover per-entry records from older versions are ignored */
+	bool loaded = false;
+
+	TopicHistoryList(Extensible *obj) : Serializable("TopicHistoryList")
+	{
+		this->chan = anope_dynamic_static_cast<ChannelInfo *>(obj)->name;
+	}
 
 	~TopicHistoryList()
 	{
-		for (unsigned i = (*this)->size(); i > 0; --i)
-			delete (*this)->at(i - 1);
+		this->Clear();
 	}
-};
 
-TopicHistoryEntry::~TopicHistoryEntry()
-{
-	ChannelInfo *ci = ChannelInfo::Find(this->chan);
-	if (!ci)
-		return;
+	size_t size() const
+	{
+		return this->count;
+	}
+
+	bool empty() const
+	{
+		return !this->count;
+	}
+
+	/* Entry 0 is the newest (the current topic); older topics are expanded from it */
+	TopicHistoryEntry at(size_t i)
+	{
+		Anope::string topic = this->Slot(this->next - 1).middle;
+		for (size_t pos = 1; pos <= i; ++pos)
+			topic = Expand(this->Slot(this->next - 1 - pos), topic);
+
+		const Packed &entry = this->Slot(this->next - 1 - i);
+		return { topic, *entry.setter, entry.when };
+	}
+
+	/* All entries, newest first */
+	std::vector<TopicHistoryEntry> List()
+	{
+		std::vector<TopicHistoryEntry> entries;
+		Anope::string topic;
+		for (size_t i = 0; i < this->count; ++i)
+		{
+			const Packed &entry = this->Slot(this->next - 1 - i);
+			topic = i ? Expand(entry, topic) : entry.middle;
+			entries.push_back({ topic, *entry.setter, entry.when });
+		}
+		return entries;
+	}
+
+	/* Returns the position of the given topic, or -1 */
+	int Find(const Anope::string &topic)
+	{
+		auto range = this->index.equal_range(Anope::hash_cs()(topic));
+		for (auto it = range.first; it != range.second; ++it)
+		{
+			const size_t pos = this->next - 1 - it->second;
+			if (this->at(pos).topic == topic)
+				return pos;
+		}
+		return -1;
+	}
+
+	/* Adds a new current topic, dropping the oldest one when full */
+	void PushFront(const Anope::string &topic, const Anope::string &setter, time_t when)
+	{
+		if (this->capacity != maxhistory + 1)
+		{
+			std::vector<TopicHistoryEntry> entries = this->List();
+			this->Rebuild(maxhistory + 1, entries);
+		}
+		this->Push({ topic, setter, when });
+		this->CheckWords();
+		this->QueueUpdate();
+	}
+
+	/* Removes an entry, moving the newer ones down a slot */
+	void Erase(size_t i)
+	{
+		if (i >= this->count)
+			return;
+
+		const uint64_t newest = this->next - 1;
+		const uint64_t erased = newest - i;
+
+		/* The next older entry was encoded against the erased one; re-encode it against the erased one's newer neighbour */
+		if (i + 1 < this->count)
+		{
+			const Anope::string topic = this->at(i + 1).topic;
+			Packed &older = this->Slot(erased - 1);
+			if (i)
+				Delta(older, topic, this->at(i - 1).topic);
+			else
+			{
+				older.prefix = older.suffix = 0;
+				older.middle = topic;
+			}
+		}
+
+		this->Unindex(erased);
+		this->UnindexWords(this->Slot(erased));
+		this->record_bytes -= this->Slot(erased).encoded;
+		topichistory_setters.Release(this->Slot(erased).setter);
+		for (uint64_t seq = erased; seq < newest; ++seq)
+		{
+			this->Unindex(seq + 1);
+			this->Slot(seq) = std::move(this->Slot(seq + 1));
+			this->index.emplace(this->Slot(seq).hash, seq);
+		}
+
+		this->Slot(newest) = Packed();
+		--this->next;
+		--this->count;
+		this->CheckWords();
+		this->QueueUpdate();
+	}
+
+	/* The entries containing every word in query (as split by TopicWords), newest first */
+	std::vector<std::pair<size_t, TopicHistoryEntry> > Search(const std::vector<Anope::string> &query)
+	{
+		std::vector<std::pair<size_t, TopicHistoryEntry> > results;
+		if (query.empty() || !this->count)
+			return results;
+
+		/* Walk the shortest posting list and look the others up */
+		std::vector<const std::vector<uint64_t> *> postings;
+		for (const auto &word : query)
+		{
+			auto it = this->words.find(Anope::hash_cs()(word));
+			if (it == this->words.end())
+				return results;
+			postings.push_back(&it->second);
+		}
+		std::sort(postings.begin(), postings.end(), [](const auto *a, const auto *b) { return a->size() < b->size(); });
+
+		std::vector<size_t> candidates;
+		const uint64_t oldest = this->Slot(this->next - this->count).id;
+		for (auto it = postings[0]->rbegin(); it != postings[0]->rend() && *it >= oldest; ++it)
+		{
+			bool all = true;
+			for (size_t i = 1; all && i < postings.size(); ++i)
+				all = std::binary_search(postings[i]->begin(), postings[i]->end(), *it);
+
+			const int pos = all ? this->Position(*it) : -1;
+			if (pos >= 0)
+				candidates.push_back(pos);
+		}
+		if (candidates.empty())
+			return results;
+
+		/* Word hashes can collide, so check the candidates' actual words */
+		const std::vector<TopicHistoryEntry> entries = this->List();
+		for (size_t pos : candidates)
+		{
+			const std::vector<Anope::string> topicwords = TopicWords(entries[pos].topic);
+			bool all = true;
+			for (size_t i = 0; all && i < query.size(); ++i)
+				all = std::find(topicwords.begin(), topicwords.end(), query[i]) != topicwords.end();
+			if (all)
+				results.emplace_back(pos, entries[pos]);
+		}
+		return results;
+	}
 
-	TopicHistoryList *entries = ci->GetExt<TopicHistoryList>("topichistorylist");
-	if (!entries)
-		return;
+	/* Approximate memory used by this list, not counting the shared setters */
+	size_t Bytes() const
+	{
+		size_t bytes = sizeof(*this) + HeapBytes(this->chan) + this->ring.capacity() * sizeof(Packed);
+		for (const auto &entry : this->ring)
+			bytes += HeapBytes(entry.middle);
+		bytes += this->index.bucket_count() * sizeof(void *) + this->index.size() * (sizeof(std::pair<const size_t, uint64_t>) + 2 * sizeof(void *));
+		bytes += this->words.bucket_count() * sizeof(void *);
+		for (const auto &[_, ids] : this->words)
+			bytes += sizeof(std::pair<const size_t, std::vector<uint64_t> >) + 2 * sizeof(void *) + ids.capacity() * sizeof(uint64_t);
+		return bytes;
+	}
 
-	std::vector<TopicHistoryEntry *>::iterator it = std::find((*entries)->begin(), (*entries)->end(), this);
-	if (it != (*entries)->end())
-		(*entries)->erase(it);
+	/* Entries are stored newest first as "<when> <setter> <length> <topic>", space separated.
+	 * Topics are length prefixed as they may contain anything but CR, LF and NUL. Push()
+	 * keeps this within MAX_RECORD_BYTES.
+	 */
+	Anope::string Encode()
+	{
+		Anope::string buf;
+		for (const auto &entry : this->List())
+		{
+			if (!buf.empty())
+				buf += " ";
+			buf += Anope::ToString(entry.when) + " " + entry.setter + " " + Anope::ToString(entry.topic.length()) + " " + entry.topic;
+		}
+		return buf;
+	}
+
+	void Decode(const Anope::string &buf)
+	{
+		std::vector<TopicHistoryEntry> entries;
+		size_t pos = 0;
+		while (pos < buf.length())
+		{
+			const size_t sp1 = buf.find(' ', pos);
+			const size_t sp2 = sp1 == Anope::string::npos ? sp1 : buf.find(' ', sp1 + 1);
+			const size_t sp3 = sp2 == Anope::string::npos ? sp2 : buf.find(' ', sp2 + 1);
+			if (sp3 == Anope::string::npos)
+				break;
+
+			TopicHistoryEntry entry;
+			entry.when = Anope::Convert<time_t>(buf.substr(pos, sp1 - pos), 0);
+			entry.setter = buf.substr(sp1 + 1, sp2 - sp1 - 1);
+			const size_t len = Anope::Convert<size_t>(buf.substr(sp2 + 1, sp3 - sp2 - 1), 0);
+			if (sp3 + 1 + len > buf.length())
+				break;
+			entry.topic = buf.substr(sp3 + 1, len);
+			entries.push_back(std::move(entry));
+			pos = sp3 + 1 + len + 1;
+		}
+
+		/* A record cut short (e.g. by an older version overflowing the column) keeps the topics before the cut */
+		if (pos < buf.length())
+			Log(LOG_NORMAL, "topichistory") << "Topic history of " << this->chan << " is damaged, keeping the " << entries.size() << " topics before byte " << pos;
+
+		this->Rebuild(maxhistory + 1, entries);
+	}
+};
+
+/* Search results are shown this many at a time */
+static const unsigned SEARCH_PAGE = 10;
+
+/* Splits "[+page] text" into the page number (from 1), the text and its words */
+static std::vector<Anope::string> SearchQuery(const Anope::string &params, unsigned &page, Anope::string &text)
+{
+	page = 1;
+	text = params;
+	if (params[0] == '+')
+	{
+		const size_t sp = params.find(' ');
+		const Anope::string num = params.substr(1, sp == Anope::string::npos ? sp : sp - 1);
+		if (num.is_pos_number_only())
+		{
+			page = std::max(1u, Anope::Convert<unsigned>(num, 1));
+			text = sp == Anope::string::npos ? "" : params.substr(sp + 1);
+		}
+	}
+	return TopicWords(text);
 }
 
-Serializable* TopicHistoryEntry::Unserialize(Serializable *obj, Serialize::Data &data)
+/* Sends one page of search results; channel is empty for per-channel searches */
+struct TopicHistoryMatch
 {
-	Anope::string schan, stopic, ssetter;
-	time_t swhen;
+	Anope::string channel;
+	size_t number;
+	TopicHistoryEntry entry;
+};
 
-	data["chan"] >> schan;
+static void SendSearchPage(CommandSource &source, const std::vector<TopicHistoryMatch> &matches, unsigned page, const Anope::string &command, const Anope::string &text)
+{
+	const unsigned pages = (matches.size() + SEARCH_PAGE - 1) / SEARCH_PAGE;
+	page = std::min(page, pages);
+
+	ListFormatter list(source.GetAccount());
+	if (!matches[0].channel.empty())
+		list.AddColumn("Channel");
+	list.AddColumn("Number").AddColumn("Set").AddColumn("By").AddColumn("Topic");
+	for (size_t i = (page - 1) * SEARCH_PAGE; i < matches.size() && i < page * SEARCH_PAGE; ++i)
+	{
+		const TopicHistoryMatch &match = matches[i];
+
+		ListFormatter::ListEntry le;
+		le["Channel"] = match.channel;
+		le["Number"] = Anope::ToString(match.number);
+		le["Set"] = Anope::strftime(match.entry.when, NULL, true);
+		le["By"] = match.entry.setter;
+		le["Topic"] = match.entry.topic;
+		list.AddEntry(le);
+	}
 
-	ChannelInfo *ci = ChannelInfo::Find(schan);
-	if (!ci)
-		return NULL;
+	source.Reply("Topics matching \002%s\002 (page %u of %u, %zu matches):", text.c_str(), page, pages, matches.size());
+	list.SendTo(source);
+	if (page < pages)
+		source.Reply("Use \002%s +%u %s\002 for the next page.", command.c_str(), page + 1, text.c_str());
+	else
+		source.Reply("End of topic history matches.");
+}
 
-	if (obj)
+struct TopicHistoryListType final
+	: public Serialize::Type
+{
+	TopicHistoryListType()
+		: Serialize::Type("TopicHistoryList")
 	{
-		TopicHistoryEntry *entry = anope_dynamic_static_cast<TopicHistoryEntry *>(obj);
-		entry->chan = ci->name;
-		data["topic"] >> entry->topic;
-		data["setter"] >> entry->setter;
-		data["when"] >> entry->when;
-		return entry;
 	}
 
-	data["topic"] >> stopic;
-	data["setter"] >> ssetter;
-	data["when"] >> swhen;
-	TopicHistoryEntry *entry = new TopicHistoryEntry(ci, stopic, ssetter, swhen);
+	void Serialize(Serializable *obj, Serialize::Data &data) const override
+	{
+		auto *entries = static_cast<TopicHistoryList *>(obj);
 
-	TopicHistoryList *entries = ci->Require<TopicHistoryList>("topichistorylist");
-	(*entries)->insert((*entries)->begin(), entry);
-	return entry;
-}
+		data["chan"] << entries->chan;
+		data["entries"] << entries->Encode();
+	}
+
+	Serializable *Unserialize(Serializable *obj, Serialize::Data &data) const override
+	{
+		Anope::string schan, sentries;
+		data["chan"] >> schan;
+
+		ChannelInfo *ci = ChannelInfo::Find(schan);
+		if (!ci)
+			return NULL;
+
+		TopicHistoryList *entries = obj ? anope_dynamic_static_cast<TopicHistoryList *>(obj) : ci->Require<TopicHistoryList>("topichistorylist");
+		data["entries"] >> sentries;
+		entries->Decode(sentries);
+		entries->loaded = true;
+		return entries;
+	}
+};
 
+/* Older versions stored one "TopicHistory" record per entry; these are
+ * folded into the channel's list on load and not written back.
+ */
 struct TopicHistoryEntryType final
 	: public Serialize::Type
 {
@@ -121,32 +657,42 @@ struct TopicHistoryEntryType final
 
 	void Serialize(Serializable *obj, Serialize::Data &data) const override
 	{
-		const auto *entry = static_cast<const TopicHistoryEntry *>(obj);
-
-		data["chan"] << entry->chan;
-		data["topic"] << entry->topic;
-		data["setter"] << entry->setter;
-		data["when"] << entry->when;
 	}
 
 	Serializable *Unserialize(Serializable *obj, Serialize::Data &data) const override
 	{
-		return TopicHistoryEntry::Unserialize(obj, data);
+		Anope::string schan, stopic, ssetter;
+		time_t swhen = 0;
+
+		data["chan"] >> schan;
+
+		ChannelInfo *ci = ChannelInfo::Find(schan);
+		if (!ci)
+			return NULL;
+
+		TopicHistoryList *entries = ci->Require<TopicHistoryList>("topichistorylist");
+		if (entries->loaded)
+			return NULL;
+
+		data["topic"] >> stopic;
+		data["setter"] >> ssetter;
+		data["when"] >> swhen;
+		if (entries->Find(stopic) < 0)
+			entries->PushFront(stopic, ssetter, swhen);
+		return NULL;
 	}
 };
 
-/* This is set during load and config reload */
-unsigned maxhistory = 0;
-
 class CommandCSTopicHistory : public Command
 {
  private:
 	void DoList(CommandSource &source, ChannelInfo *ci)
 	{
-		TopicHistoryList *entries = ci->Require<TopicHistoryList>("topichistorylist");
+		/* Listing must not create an empty history for the channel */
+		TopicHistoryList *entries = ci->GetExt<TopicHistoryList>("topichistorylist");
 
 		/* First entry is the current topic, we hide that */
-		if ((*entries)->size() <= 1)
+		if (!entries || entries->size() <= 1)
 		{
 			source.Reply("Topic history list for \002%s\002 is empty.", ci->name.c_str());
 			return;
@@ -156,15 +702,16 @@ class CommandCSTopicHistory : public Command
 
 		ListFormatter list(source.GetAccount());
 		list.AddColumn("Number").AddColumn("Set").AddColumn("By").AddColumn("Topic");
-		for (unsigned i = 1; i < (*entries)->size(); ++i)
+		const std::vector<TopicHistoryEntry> topics = entries->List();
+		for (unsigned i = 1; i < topics.size(); ++i)
 		{
-			TopicHistoryEntry *entry = (*entries)->at(i);
+			const TopicHistoryEntry &entry = topics[i];
 
 			ListFormatter::ListEntry le;
 			le["Number"] = Anope::ToString(i);
-			le["Set"] = Anope::strftime(entry->when, NULL, true);
-			le["By"] = entry->setter;
-			le["Topic"] = entry->topic;
+			le["Set"] = Anope::strftime(entry.when, NULL, true);
+			le["By"] = entry.setter;
+			le["Topic"] = entry.topic;
 			list.AddEntry(le);
 		}
 
@@ -175,11 +722,11 @@ class CommandCSTopicHistory : public Command
 
 	void DoClear(CommandSource &source, ChannelInfo *ci)
 	{
-		/* Removing the List deletes all entries tied to it */
+		/* Removing the List deletes its record */
 		ci->Shrink<TopicHistoryList>("topichistorylist");
 		/* Create a new List and add the current topic, just like when enabling the option */
 		TopicHistoryList *entries = ci->Require<TopicHistoryList>("topichistorylist");
-		if ((*entries)->empty())
+		if (entries->empty())
 		{
 			Anope::string topic;
 			Anope::string setter;
@@ -205,7 +752,7 @@ class CommandCSTopicHistory : public Command
 					when = Anope::CurTime;
 				if (setter.empty())
 					setter = "unknown";
-				(*entries)->push_back(new TopicHistoryEntry(ci, topic, setter, when));
+				entries->PushFront(topic, setter, when);
 			}
 		}
 
@@ -213,11 +760,40 @@ class CommandCSTopicHistory : public Command
 		source.Reply("Topic history for \002%s\002 has been cleared.", ci->name.c_str());
 	}
 
+	void DoSearch(CommandSource &source, ChannelInfo *ci, const Anope::string &params)
+	{
+		unsigned page;
+		Anope::string text;
+		const std::vector<Anope::string> query = SearchQuery(params, page, text);
+		if (query.empty())
+		{
+			this->OnSyntaxError(source, "SEARCH");
+			return;
+		}
+
+		TopicHistoryList *entries = ci->GetExt<TopicHistoryList>("topichistorylist");
+
+		std::vector<TopicHistoryMatch> matches;
+		if (entries)
+		{
+			for (auto &[number, entry] : entries->Search(query))
+				matches.push_back({ "", number, std::move(entry) });
+		}
+
+		if (matches.empty())
+		{
+			source.Reply("No topics in the history of \002%s\002 match \002%s\002.", ci->name.c_str(), text.c_str());
+			return;
+		}
+
+		SendSearchPage(source, matches, page, source.command + " " + ci->name + " SEARCH", text);
+	}
+
 	void DoSet(CommandSource &source, ChannelInfo *ci, const Anope::string &entrynum)
 	{
 		TopicHistoryList *entries = ci->Require<TopicHistoryList>("topichistorylist");
 
-		if ((*entries)->empty())
+		if (entries->empty())
 		{
 			source.Reply("Topic history list for \002%s\002 is empty.", ci->name.c_str());
 			return;
@@ -232,9 +808,9 @@ class CommandCSTopicHistory : public Command
 		{
 			unsigned i = std::stoi(entrynum.str());
 			// Index 0 is the current topic (hidden); valid history entries are 1..size-1.
-			if (i >= 1 && i < (*entries)->size())
+			if (i >= 1 && i < entries->size())
 			{
-				if (ci->c->topic == (*entries)->at(i)->topic)
+				if (ci->c->topic == entries->at(i).topic)
 				{
 					source.Reply("History entry number \002%u\002 is already the topic for \002%s\002.", i, ci->name.c_str());
 					return;
@@ -242,7 +818,7 @@ class CommandCSTopicHistory : public Command
 
 				bool has_topiclock = ci->HasExt("TOPICLOCK");
 				ci->Shrink<bool>("TOPICLOCK");
-				ci->c->ChangeTopic(source.GetNick(), (*entries)->at(i)->topic, Anope::CurTime);
+				ci->c->ChangeTopic(source.GetNick(), entries->at(i).topic, Anope::CurTime);
 				if (has_topiclock)
 					ci->Extend<bool>("TOPICLOCK");
 
@@ -265,6 +841,7 @@ class CommandCSTopicHistory : public Command
 		this->SetSyntax("\037channel\037 LIST");
 		this->SetSyntax("\037channel\037 CLEAR");
 		this->SetSyntax("\037channel\037 SET \037entry-num\037");
+		this->SetSyntax("\037channel\037 SEARCH [+\037page\037] \037text\037");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
@@ -282,6 +859,8 @@ class CommandCSTopicHistory : public Command
 			this->DoList(source, ci);
 		else if (subcmd.equals_ci("CLEAR"))
 			this->DoClear(source, ci);
+		else if (subcmd.equals_ci("SEARCH") && params.size() == 3)
+			this->DoSearch(source, ci, params[2]);
 		else if (!ci->c)
 			source.Reply(CHAN_X_NOT_IN_USE, ci->name.c_str());
 		else if (subcmd.equals_ci("SET") && params.size() == 3)
@@ -303,6 +882,11 @@ class CommandCSTopicHistory : public Command
 		source.Reply(" ");
 		source.Reply("The \002SET\002 command sets the channel topic\n"
 			     "to the specified historical topic.");
+		source.Reply(" ");
+		source.Reply("The \002SEARCH\002 command lists the stored topics that\n"
+			     "contain every word of \037text\037 (whole words, case\n"
+			     "insensitive), %u per page; use \037+page\037 for later pages.\n"
+			     "Number 0 is the current topic.", SEARCH_PAGE);
 
 		return true;
 	}
@@ -353,7 +937,7 @@ class CommandCSSetTopicHistory : public Command
 			 * Avoid creating blank/epoch entries when the channel is not in use or has no topic.
 			 */
 			TopicHistoryList *entries = ci->Require<TopicHistoryList>("topichistorylist");
-			if ((*entries)->empty())
+			if (entries->empty())
 			{
 				Anope::string topic;
 				Anope::string setter;
@@ -379,7 +963,7 @@ class CommandCSSetTopicHistory : public Command
 						when = Anope::CurTime;
 					if (setter.empty())
 						setter = "unknown";
-					(*entries)->push_back(new TopicHistoryEntry(ci, topic, setter, when));
+					entries->PushFront(topic, setter, when);
 				}
 			}
 		}
@@ -406,6 +990,7 @@ class CommandCSSetTopicHistory : public Command
 		source.Reply("The \002OFF\002 command clears the list and disables the option.");
 		source.Reply(" ");
 		source.Reply("There is a maximum Topic History list size of %d topics.", maxhistory);
+		source.Reply("Channels with long topics may keep fewer, as each channel's history is stored in at most 64 KiB.");
 		source.Reply(" ");
 
 		/* Look up and display the proper Bot nick and Command name for using this option */
@@ -420,30 +1005,157 @@ class CommandCSSetTopicHistory : public Command
 	}
 };
 
+class CommandOSTopicHistory : public Command
+{
+ private:
+	void DoMemory(CommandSource &source, const std::vector<Anope::string> &params)
+	{
+		size_t count = 10;
+		if (params.size() > 1)
+			count = Anope::Convert<size_t>(params[1], count);
+
+		size_t channels = 0, topics = 0, bytes = 0;
+		std::vector<std::pair<size_t, ChannelInfo *> > largest;
+		for (const auto &[_, ci] : *RegisteredChannelList)
+		{
+			TopicHistoryList *entries = ci->GetExt<TopicHistoryList>("topichistorylist");
+			if (!entries)
+				continue;
+
+			const size_t chanbytes = entries->Bytes();
+			++channels;
+			topics += entries->size();
+			bytes += chanbytes;
+			largest.emplace_back(chanbytes, ci);
+		}
+
+		const size_t setterbytes = topichistory_setters.Bytes();
+		source.Reply("Topic history for \002%zu\002 channels holds \002%zu\002 topics in \002%zu\002 bytes (%zu per channel, %zu per topic).",
+			channels, topics, bytes, channels ? bytes / channels : 0, topics ? bytes / topics : 0);
+		source.Reply("\002%zu\002 distinct setters use \002%zu\002 bytes.", topichistory_setters.size(), setterbytes);
+
+		if (!count || largest.empty())
+			return;
+
+		count = std::min(count, largest.size());
+		std::partial_sort(largest.begin(), largest.begin() + count, largest.end(), std::greater<>());
+
+		ListFormatter list(source.GetAccount());
+		list.AddColumn("Channel").AddColumn("Topics").AddColumn("Bytes");
+		for (size_t i = 0; i < count; ++i)
+		{
+			ChannelInfo *ci = largest[i].second;
+
+			ListFormatter::ListEntry le;
+			le["Channel"] = ci->name;
+			le["Topics"] = Anope::ToString(ci->GetExt<TopicHistoryList>("topichistorylist")->size());
+			le["Bytes"] = Anope::ToString(largest[i].first);
+			list.AddEntry(le);
+		}
+
+		list.SendTo(source);
+	}
+
+	void DoSearch(CommandSource &source, const Anope::string &params)
+	{
+		unsigned page;
+		Anope::string text;
+		const std::vector<Anope::string> query = SearchQuery(params, page, text);
+		if (query.empty())
+		{
+			this->OnSyntaxError(source, "SEARCH");
+			return;
+		}
+
+		Log(LOG_ADMIN, source, this) << "SEARCH " << text;
+
+		/* The word index rules out most channels without expanding any of their topics */
+		std::vector<TopicHistoryMatch> matches;
+		for (const auto &[_, ci] : *RegisteredChannelList)
+		{
+			TopicHistoryList *entries = ci->GetExt<TopicHistoryList>("topichistorylist");
+			if (!entries)
+				continue;
+
+			for (auto &[number, entry] : entries->Search(query))
+				matches.push_back({ ci->name, number, std::move(entry) });
+		}
+
+		if (matches.empty())
+		{
+			source.Reply("No stored topics match \002%s\002.", text.c_str());
+			return;
+		}
+
+		/* Most recent first */
+		std::stable_sort(matches.begin(), matches.end(), [](const TopicHistoryMatch &a, const TopicHistoryMatch &b) {
+			return a.entry.when > b.entry.when;
+		});
+		SendSearchPage(source, matches, page, source.command + " SEARCH", text);
+	}
+
+ public:
+	CommandOSTopicHistory(Module *creator) : Command(creator, "operserv/topichistory", 1, 2)
+	{
+		this->SetDesc("Search topic histories and show their memory usage");
+		this->SetSyntax("SEARCH [+\037page\037] \037text\037");
+		this->SetSyntax("MEMORY [\037count\037]");
+	}
+
+	void Execute(CommandSource &source, const std::vector<Anope::string> &params) override
+	{
+		if (params[0].equals_ci("SEARCH") && params.size() > 1)
+			this->DoSearch(source, params[1]);
+		else if (params[0].equals_ci("MEMORY"))
+			this->DoMemory(source, params);
+		else
+			this->OnSyntaxError(source, "");
+	}
+
+	bool OnHelp(CommandSource &source, const Anope::string &subcommand) override
+	{
+		this->SendSyntax(source);
+		source.Reply(" ");
+		source.Reply("The \002SEARCH\002 command lists the stored topics of every\n"
+			     "channel that contain every word of \037text\037 (whole words,\n"
+			     "case insensitive), most recent first, %u per page.", SEARCH_PAGE);
+		source.Reply(" ");
+		source.Reply("The \002MEMORY\002 command shows how much memory the topic\n"
+			     "history of all channels uses, the bytes per channel and per\n"
+			     "topic, and the \037count\037 channels using the most (10 by default).\n"
+			     "Setters are shared between channels and counted separately.");
+
+		return true;
+	}
+};
+
 class CSTopicHistory : public Module
 {
 	SerializableExtensibleItem<bool> topichistory;
 	ExtensibleItem<TopicHistoryList> topichistorylist;
 	CommandCSTopicHistory commandcstopichistory;
 	CommandCSSetTopicHistory commandcssettopichistory;
+	CommandOSTopicHistory commandostopichistory;
+	TopicHistoryListType topichistorylist_type;
 	TopicHistoryEntryType topichistory_type;
 
  public:
 
 	CSTopicHistory(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, THIRD),
 		topichistory(this, "TOPICHISTORY"), topichistorylist(this, "topichistorylist"),
-		commandcstopichistory(this), commandcssettopichistory(this)
+		commandcstopichistory(this), commandcssettopichistory(this), commandostopichistory(this)
 	{
 		if (Anope::VersionMajor() != 2 || Anope::VersionMinor() > 1)
 			throw ModuleException("Requires version 2.1.x of Anope.");
 
 		this->SetAuthor("genius3000");
-		this->SetVersion("1.0.3");
+		this->SetVersion("1.1.0");
 	}
 
 	void OnReload(Configuration::Conf &conf) override
 	{
-		/* A default of 3 seems decent and set safe limits; 20 is more than enough I think...
+		/* A default of 3 seems decent; older topics are delta encoded, so deep histories stay cheap...
+		 * Deep histories of long topics are cut short by MAX_RECORD_BYTES rather than this.
 		 * NOTE: We actually allow 1 more than "maxhistory" and hide the first entry (index 0)
 		 *       This hides the current topic and shows "maxhistory" historical topics
 		 */
@@ -451,8 +1163,8 @@ class CSTopicHistory : public Module
 
 		if (maxhistory < 1)
 			maxhistory = 1;
-		else if (maxhistory > 20)
-			maxhistory = 20;
+		else if (maxhistory > 500)
+			maxhistory = 500;
 	}
 
 	void OnTopicUpdated(User *source, Channel *c, const Anope::string &user, const Anope::string &topic) override
@@ -467,31 +1179,19 @@ class CSTopicHistory : public Module
 
 		TopicHistoryList *entries = c->ci->Require<TopicHistoryList>("topichistorylist");
 
-		/* If the new topic matches an existing one, delete the current entry */
-		if (!(*entries)->empty())
-		{
-			for (unsigned i = 0; i < (*entries)->size(); ++i)
-			{
-				if (topic == (*entries)->at(i)->topic)
-				{
-					delete (*entries)->at(i);
-					break;
-				}
-			}
-		}
-
-		/* Remove the oldest topic when the list is full for the channel */
-		if ((*entries)->size() >= (maxhistory + 1))
-			delete (*entries)->at((*entries)->size() - 1);
+		/* A repeated topic moves to the front rather than being stored twice */
+		int dup = entries->Find(topic);
+		if (dup >= 0)
+			entries->Erase(dup);
 
 		/* The below code is doing:
 		 * - If source isn't given, try to find string 'user' (could be a UUID)
 		 * - get the topic set time so a channel creation doesn't trick us into using current time
-		 * - add this entry to the beginning to keep them in chronological order
+		 * - add this entry to the front (dropping the oldest when full) to keep them in chronological order
 		 */
 		User *u = source ? source : User::Find(user);
 		time_t ts = c->ci->last_topic_time ? c->ci->last_topic_time : Anope::CurTime;
-		(*entries)->insert((*entries)->begin(), new TopicHistoryEntry(c->ci, topic, u ? u->nick : "unknown", ts));
+		entries->PushFront(topic, u ? u->nick : "unknown", ts);
 	}
 
 	void OnChanInfo(CommandSource &source, ChannelInfo *ci, InfoFormatter &info, bool show_hidden) override
@@ -13,8 +13,16 @@
  *   module {
  *     name = "rpc_chanstatsplus"
  *     engine = "mysql/dbstats"
+ *     dialect = ""
  *     prefix = "anope_"
  *     maxlimit = 100
+ *     timeout = 10s
+ *     cachettl = 30s
+ *     cachesize = 1000
+ *     slowquery = 1000
+ *     leaderboards = "lines"
+ *     leaderboardsize = 100
+ *     leaderboardrebuild = 1d
  *   }
  */
 
@@ -23,7 +31,11 @@
 #include "modules/rpc.h"
 #include "modules/sql.h"
 
+#include <chrono>
 #include <ctime>
+#include <functional>
+#include <list>
+#include <set>
 
 namespace
 {
@@ -31,6 +43,7 @@ namespace
 	{
 		ERR_NO_SUCH_STATS = RPC::ERR_CUSTOM_START,
 		ERR_DB_ERROR = RPC::ERR_CUSTOM_START + 1,
+		ERR_TIMEOUT = RPC::ERR_CUSTOM_START + 2,
 	};
 
 	static bool IsValidPeriod(const Anope::string &period)
@@ -108,6 +121,7 @@ namespace
 		tmv.tm_hour = 0;
 		tmv.tm_min = 0;
 		tmv.tm_sec = 0;
+		tmv.tm_isdst = -1;
 		return std::mktime(&tmv);
 	}
 
@@ -119,6 +133,7 @@ namespace
 		tmv.tm_hour = 0;
 		tmv.tm_min = 0;
 		tmv.tm_sec = 0;
+		tmv.tm_isdst = -1;
 		return std::mktime(&tmv);
 	}
 
@@ -128,9 +143,12 @@ namespace
 		std::tm tmv;
 		localtime_r(&ts, &tmv);
 		int wday = tmv.tm_wday; // 0=Sun..6=Sat
-		int days_from_monday = (wday + 6) % 7;
-		time_t day_start = StartOfDay(ts);
-		return day_start - static_cast<time_t>(days_from_monday) * 86400;
+		tmv.tm_mday -= (wday + 6) % 7;
+		tmv.tm_hour = 0;
+		tmv.tm_min = 0;
+		tmv.tm_sec = 0;
+		tmv.tm_isdst = -1;
+		return std::mktime(&tmv);
 	}
 
 	static Anope::string DefaultPeriodStart(const Anope::string &period)
@@ -166,14 +184,74 @@ namespace
 		out.Reply("modes", Anope::Convert<uint64_t>(res.Get(row, "modes"), 0));
 		out.Reply("topics", Anope::Convert<uint64_t>(res.Get(row, "topics"), 0));
 	}
+
+	static void ReplyRanked(const SQL::Result &res, RPC::Request &request)
+	{
+		auto &root = request.Root<RPC::Array>();
+		for (int i = 0; i < res.Rows(); ++i)
+		{
+			auto &row = root.ReplyMap();
+			row.Reply("rank", static_cast<uint64_t>(i + 1));
+			ReplyRow(res, i, row);
+		}
+	}
+
+	static void ReplyColumn(const SQL::Result &res, RPC::Request &request, const Anope::string &column)
+	{
+		auto &root = request.Root<RPC::Array>();
+		for (int i = 0; i < res.Rows(); ++i)
+			root.Reply(res.Get(i, column));
+	}
+
+	/** Continuation tokens are opaque to clients; today they carry the last key returned. */
+	static Anope::string EncodeCursor(const Anope::string &last)
+	{
+		Anope::string cursor;
+		Anope::B64Encode("k:" + last, cursor);
+		return cursor;
+	}
+
+	static bool DecodeCursor(const Anope::string &cursor, Anope::string &last)
+	{
+		last.clear();
+		if (cursor.empty())
+			return true;
+
+		Anope::string decoded;
+		Anope::B64Decode(cursor, decoded);
+		if (decoded.length() < 2 || decoded.substr(0, 2) != "k:")
+			return false;
+		last = decoded.substr(2);
+		return true;
+	}
 }
 
+/** Notified by chanstats_plus after each flush. Must stay identical to the
+ * declaration there.
+ */
+class ChanstatsPlusFlushListener
+	: public Service
+{
+public:
+	ChanstatsPlusFlushListener(Module *m) : Service(m, "ChanstatsPlusFlushListener", "rpc_chanstatsplus")
+	{
+	}
+
+	/** Called once every row of a flush has been queued on the SQL provider,
+	 * and again for batches replayed from the journal once they commit.
+	 * names holds each channel and nick the flush touched, and pairs each
+	 * (channel, nick) whose per-nick channel row it changed.
+	 */
+	virtual void OnFlushed(const std::vector<Anope::string> &names, const std::vector<std::pair<Anope::string, Anope::string>> &pairs) = 0;
+};
+
 class MRPCChanstatsPlus final
 	: public Module
 {
 	Anope::string engine;
 	Anope::string prefix;
 	size_t max_limit = 100;
+	bool sqlite = false;
 	ServiceReference<SQL::Provider> sql;
 
 	Anope::string Table() const
@@ -181,6 +259,664 @@ class MRPCChanstatsPlus final
 		return prefix + "chanstatsplus";
 	}
 
+	Anope::string BoardTable() const
+	{
+		return prefix + "chanstatsplus_top";
+	}
+
+	/** SQLite stores period_start as YYYY-MM-DD text already. */
+	Anope::string PeriodStartColumn(const Anope::string &alias = "") const
+	{
+		const Anope::string column = alias.empty() ? "`period_start`" : "`" + alias + "`.`period_start`";
+		if (sqlite)
+			return alias.empty() ? column : column + " AS `period_start`";
+		return "DATE_FORMAT(" + column + ",'%Y-%m-%d') AS `period_start`";
+	}
+
+	/** What a cached result depends on: its key, and the channel and nick whose
+	 * flushes invalidate it (both empty for network-wide leaderboards).
+	 */
+	struct CacheScope final
+	{
+		Anope::string key;
+		Anope::string chan;
+		Anope::string nick;
+	};
+
+	struct CacheEntry final
+	{
+		CacheScope scope;
+		time_t expires;
+		SQL::Result result;
+	};
+
+	time_t cache_ttl = 0;
+	size_t cache_size = 0;
+	// Most recently used first.
+	std::list<CacheEntry> cache;
+	Anope::unordered_map<std::list<CacheEntry>::iterator> cache_index;
+	// Bumped by every invalidation so results that were in flight meanwhile aren't cached.
+	uint64_t cache_generation = 0;
+	uint64_t cache_hits = 0;
+	uint64_t cache_misses = 0;
+	uint64_t cache_invalidations = 0;
+
+	static CacheScope Scope(const Anope::string &method, const Anope::string &chan, const Anope::string &nick,
+		const Anope::string &period, const Anope::string &period_start, const Anope::string &extra = "")
+	{
+		return { method + "\x1f" + chan + "\x1f" + nick + "\x1f" + period + "\x1f" + period_start + "\x1f" + extra, chan, nick };
+	}
+
+	const SQL::Result *CacheFind(const CacheScope &scope)
+	{
+		if (!cache_ttl)
+			return nullptr;
+
+		auto it = cache_index.find(scope.key);
+		if (it == cache_index.end())
+		{
+			cache_misses++;
+			return nullptr;
+		}
+
+		if (it->second->expires <= Anope::CurTime)
+		{
+			cache.erase(it->second);
+			cache_index.erase(it);
+			cache_misses++;
+			return nullptr;
+		}
+
+		cache.splice(cache.begin(), cache, it->second);
+		cache_hits++;
+		return &cache.front().result;
+	}
+
+	void CacheStore(const CacheScope &scope, uint64_t generation, const SQL::Result &result)
+	{
+		if (!cache_ttl || !cache_size || generation != cache_generation)
+			return;
+
+		auto it = cache_index.find(scope.key);
+		if (it != cache_index.end())
+		{
+			cache.erase(it->second);
+			cache_index.erase(it);
+		}
+
+		cache.push_front({ scope, Anope::CurTime + cache_ttl, result });
+		cache_index[scope.key] = cache.begin();
+		while (cache.size() > cache_size)
+		{
+			cache_index.erase(cache.back().scope.key);
+			cache.pop_back();
+		}
+	}
+
+	void CacheClear()
+	{
+		cache.clear();
+		cache_index.clear();
+		cache_generation++;
+	}
+
+	class FlushListener final
+		: public ChanstatsPlusFlushListener
+	{
+		MRPCChanstatsPlus *parent;
+
+	public:
+		FlushListener(MRPCChanstatsPlus *m)
+			: ChanstatsPlusFlushListener(m)
+			, parent(m)
+		{
+		}
+
+		void OnFlushed(const std::vector<Anope::string> &names, const std::vector<std::pair<Anope::string, Anope::string>> &pairs) override
+		{
+			parent->OnFlushed(names, pairs);
+		}
+	};
+
+	void OnFlushed(const std::vector<Anope::string> &names, const std::vector<std::pair<Anope::string, Anope::string>> &pairs)
+	{
+		RefreshLeaderboards(names, pairs);
+
+		cache_generation++;
+		if (cache.empty())
+			return;
+
+		Anope::unordered_map<bool> touched;
+		for (const auto &name : names)
+		{
+			if (!name.empty())
+				touched[name] = true;
+		}
+
+		for (auto it = cache.begin(); it != cache.end();)
+		{
+			const CacheScope &scope = it->scope;
+			// Network-wide results change with every flush.
+			const bool stale = (scope.chan.empty() && scope.nick.empty()) || touched.count(scope.chan) || touched.count(scope.nick);
+			if (!stale)
+			{
+				++it;
+				continue;
+			}
+
+			cache_index.erase(scope.key);
+			it = cache.erase(it);
+			cache_invalidations++;
+		}
+	}
+
+	/** Runs the leaderboard maintenance queries. The queries of a rebuild mark
+	 * the leaderboards ready once the last of them has succeeded.
+	 */
+	class LeaderboardInterface final
+		: public SQL::Interface
+	{
+		MRPCChanstatsPlus *parent;
+		bool build;
+
+	public:
+		LeaderboardInterface(MRPCChanstatsPlus *m, bool b)
+			: SQL::Interface(m)
+			, parent(m)
+			, build(b)
+		{
+		}
+
+		void OnResult(const SQL::Result &) override
+		{
+			if (build && parent->board_building && !--parent->board_building)
+				parent->boards_ready = !parent->board_build_failed;
+		}
+
+		void OnError(const SQL::Result &r) override
+		{
+			Log(parent) << "rpc_chanstatsplus: leaderboard query failed: " << r.GetError();
+			if (!build)
+				return;
+
+			parent->board_build_failed = true;
+			if (parent->board_building && !--parent->board_building)
+				parent->boards_ready = false;
+		}
+	};
+
+	// Materialised leaderboards: the top board_size rows of every channel
+	// (board = channel name), of all channels ("*channels") and of all nicks
+	// ("*nicks"), per configured metric, for the current periods only.
+	std::vector<Anope::string> board_metrics;
+	size_t board_size = 0;
+	time_t board_rebuild = 0;
+	time_t next_board_rebuild = 0;
+	// The monthly/weekly/daily starts the boards hold; old periods are dropped when it changes.
+	Anope::string board_starts;
+	bool boards_ready = false;
+	size_t board_building = 0;
+	bool board_build_failed = false;
+	LeaderboardInterface board_query;
+	LeaderboardInterface board_build;
+
+	static const size_t BOARD_CHUNK = 250;
+
+	/** Whether top-N reads with these parameters can be answered from the leaderboards. */
+	bool UseLeaderboard(const Anope::string &metric, const Anope::string &period, const Anope::string &period_start, size_t limit) const
+	{
+		if (!boards_ready || limit > board_size || period_start != DefaultPeriodStart(period))
+			return false;
+
+		for (const auto &board_metric : board_metrics)
+		{
+			if (board_metric.equals_ci(metric))
+				return true;
+		}
+		return false;
+	}
+
+	/** Reads the rows of a leaderboard. Uses the same @period@, @pstart@ and @limit@
+	 * parameters as the full-table queries, plus @board@ and @metric@.
+	 */
+	Anope::string LeaderboardQuery(const Anope::string &ordercol, const Anope::string &tiecol) const
+	{
+		return "SELECT `m`.`chan`,`m`.`nick`,`m`.`period`," + PeriodStartColumn("m") + ","
+			"`m`.`letters`,`m`.`words`,`m`.`lines`,`m`.`actions`,"
+			"`m`.`smileys_happy`,`m`.`smileys_sad`,`m`.`smileys_other`,"
+			"`m`.`kicks`,`m`.`kicked`,`m`.`modes`,`m`.`topics` "
+			"FROM `" + BoardTable() + "` AS `t` "
+			"JOIN `" + Table() + "` AS `m` ON `m`.`chan`=`t`.`chan` AND `m`.`nick`=`t`.`nick` "
+			"AND `m`.`period`=`t`.`period` AND `m`.`period_start`=`t`.`period_start` "
+			"WHERE `t`.`board`=@board@ AND `t`.`period`=@period@ AND `t`.`period_start`=@pstart@ AND `t`.`metric`=@metric@ "
+			"ORDER BY `m`." + ordercol + " DESC, `m`." + tiecol + " ASC "
+			"LIMIT @limit@";
+	}
+
+	/** Matches the rows of the current total/monthly/weekly/daily periods. */
+	static Anope::string CurrentPeriods(SQL::Query &q)
+	{
+		q.SetValue("ptotal", DefaultPeriodStart("total"));
+		q.SetValue("pmonthly", DefaultPeriodStart("monthly"));
+		q.SetValue("pweekly", DefaultPeriodStart("weekly"));
+		q.SetValue("pdaily", DefaultPeriodStart("daily"));
+		return "((`period`='total' AND `period_start`=@ptotal@) OR (`period`='monthly' AND `period_start`=@pmonthly@) "
+			"OR (`period`='weekly' AND `period_start`=@pweekly@) OR (`period`='daily' AND `period_start`=@pdaily@))";
+	}
+
+	static Anope::string InList(SQL::Query &q, const Anope::string &param, const std::vector<Anope::string> &names, size_t first)
+	{
+		Anope::string in;
+		for (size_t i = first; i < names.size() && i < first + BOARD_CHUNK; ++i)
+		{
+			const Anope::string name = param + Anope::ToString(i - first);
+			in += (in.empty() ? "@" : ",@") + name + "@";
+			q.SetValue(name, names[i]);
+		}
+		return in;
+	}
+
+	/** Matches up to BOARD_CHUNK (channel, nick) pairs starting at first. An
+	 * OR of equalities rather than a row-value IN, which older MySQL versions
+	 * cannot use the primary key for.
+	 */
+	static Anope::string PairFilter(SQL::Query &q, const std::vector<std::pair<Anope::string, Anope::string>> &pairs, size_t first)
+	{
+		Anope::string filter;
+		for (size_t i = first; i < pairs.size() && i < first + BOARD_CHUNK; ++i)
+		{
+			const Anope::string idx = Anope::ToString(i - first);
+			filter += Anope::string(filter.empty() ? "(" : " OR ") + "(`chan`=@c" + idx + "@ AND `nick`=@n" + idx + "@)";
+			q.SetValue("c" + idx, pairs[i].first);
+			q.SetValue("n" + idx, pairs[i].second);
+		}
+		return filter + ")";
+	}
+
+	enum BoardKind
+	{
+		// One board per channel: its (channel, nick) rows.
+		BOARD_CHANNEL,
+		// "*channels": the channel aggregate rows.
+		BOARD_CHANNELS,
+		// "*nicks": the network-wide per-nick rows.
+		BOARD_NICKS,
+	};
+
+	/** Selects the rows of one kind of board for one metric, in the current
+	 * periods and matching filter (an SQL condition, or empty for all rows).
+	 * When ranked, each row also gets its rank on its board as `rn`.
+	 */
+	Anope::string BoardRows(BoardKind kind, const Anope::string &metric, SQL::Query &q, const Anope::string &filter, bool ranked) const
+	{
+		// metric comes from IsValidMetric() and is lowercased, so it is safe to inline.
+		const Anope::string column = MetricColumn(metric);
+		Anope::string board, where, partition, tiecol;
+		switch (kind)
+		{
+			case BOARD_CHANNEL:
+				board = "`chan`";
+				where = "`chan` != '' AND `nick` != ''";
+				partition = "`chan`,`period`,`period_start`";
+				tiecol = "`nick`";
+				break;
+			case BOARD_CHANNELS:
+				board = "'*channels'";
+				where = "`chan` != '' AND `nick` = ''";
+				partition = "`period`,`period_start`";
+				tiecol = "`chan`";
+				break;
+			case BOARD_NICKS:
+				board = "'*nicks'";
+				where = "`chan` = '' AND `nick` != ''";
+				partition = "`period`,`period_start`";
+				tiecol = "`nick`";
+				break;
+		}
+
+		return "SELECT " + board + " AS `board`,`period`,`period_start`,'" + metric + "' AS `metric`,`chan`,`nick`," + column + " AS `value`"
+			+ (ranked ? ",ROW_NUMBER() OVER (PARTITION BY " + partition + " ORDER BY " + column + " DESC," + tiecol + ") AS `rn`" : "")
+			+ " FROM `" + Table() + "` WHERE " + where + (filter.empty() ? "" : " AND " + filter) + " AND " + CurrentPeriods(q);
+	}
+
+	/** Upserts the current values of the given board rows. */
+	void UpsertBoardRows(SQL::Query &q, const Anope::string &rows)
+	{
+		q.query = "INSERT INTO `" + BoardTable() + "` (`board`,`period`,`period_start`,`metric`,`chan`,`nick`,`value`) "
+			"SELECT `board`,`period`,`period_start`,`metric`,`chan`,`nick`,`value` FROM (" + rows + ") AS `changed` ";
+		// SQLite needs a WHERE to tell the upsert clause apart from a join constraint.
+		if (sqlite)
+			q.query += "WHERE true ON CONFLICT (`board`,`period`,`period_start`,`metric`,`chan`,`nick`) DO UPDATE SET `value`=excluded.`value`;";
+		else
+			q.query += "ON DUPLICATE KEY UPDATE `value`=VALUES(`value`);";
+		sql->Run(&board_query, q);
+	}
+
+	/** Drops the rows of the given boards that rank below board_size. */
+	void TrimBoards(SQL::Query &q, const Anope::string &boards)
+	{
+		const Anope::string ranked = "SELECT " + Anope::string(sqlite ? "rowid," : "") + "`board`,`period`,`period_start`,`metric`,`chan`,`nick`,"
+			"ROW_NUMBER() OVER (PARTITION BY `board`,`period`,`period_start`,`metric` ORDER BY `value` DESC,`chan`,`nick`) AS `rn` "
+			"FROM `" + BoardTable() + "` WHERE `board` IN (" + boards + ") AND " + CurrentPeriods(q);
+		if (sqlite)
+			q.query = "DELETE FROM `" + BoardTable() + "` WHERE rowid IN (SELECT rowid FROM (" + ranked + ") WHERE `rn` > @size@);";
+		else
+			q.query = "DELETE `t` FROM `" + BoardTable() + "` AS `t` JOIN (" + ranked + ") AS `r` "
+				"USING (`board`,`period`,`period_start`,`metric`,`chan`,`nick`) WHERE `r`.`rn` > @size@;";
+		q.SetValue("size", Anope::ToString(board_size), false);
+		sql->Run(&board_query, q);
+	}
+
+	void EnsureLeaderboards()
+	{
+		if (sqlite)
+		{
+			sql->Run(&board_query, SQL::Query("CREATE TABLE IF NOT EXISTS `" + BoardTable() + "` ("
+				"`board` TEXT NOT NULL,"
+				"`period` TEXT NOT NULL,"
+				"`period_start` TEXT NOT NULL,"
+				"`metric` TEXT NOT NULL,"
+				"`chan` TEXT NOT NULL DEFAULT '',"
+				"`nick` TEXT NOT NULL DEFAULT '',"
+				"`value` INTEGER NOT NULL DEFAULT 0,"
+				"PRIMARY KEY (`board`,`period`,`period_start`,`metric`,`chan`,`nick`)"
+				");"));
+			return;
+		}
+
+		sql->Run(&board_query, SQL::Query("CREATE TABLE IF NOT EXISTS `" + BoardTable() + "` ("
+			"`board` varchar(64) NOT NULL,"
+			"`period` ENUM('total','monthly','weekly','daily') NOT NULL,"
+			"`period_start` date NOT NULL,"
+			"`metric` varchar(16) NOT NULL,"
+			"`chan` varchar(64) NOT NULL DEFAULT '',"
+			"`nick` varchar(64) NOT NULL DEFAULT '',"
+			"`value` bigint unsigned NOT NULL DEFAULT '0',"
+			"PRIMARY KEY (`board`,`period`,`period_start`,`metric`,`chan`,`nick`)"
+			") ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;"));
+	}
+
+	/** Recomputes every leaderboard from the stats table. Runs on reload, so
+	 * flushes made while this module wasn't loaded are picked up, and every
+	 * leaderboardrebuild to catch rows written outside a flush (journal retries).
+	 */
+	void RebuildLeaderboards()
+	{
+		if (!sql || board_metrics.empty())
+			return;
+
+		next_board_rebuild = board_rebuild ? Anope::CurTime + board_rebuild : 0;
+		board_starts = DefaultPeriodStart("monthly") + DefaultPeriodStart("weekly") + DefaultPeriodStart("daily");
+		board_building = board_metrics.size() + 1;
+		board_build_failed = false;
+
+		sql->Run(&board_build, SQL::Query("DELETE FROM `" + BoardTable() + "`;"));
+		for (const auto &metric : board_metrics)
+		{
+			SQL::Query q;
+			const Anope::string rows = BoardRows(BOARD_CHANNEL, metric, q, "", true)
+				+ " UNION ALL " + BoardRows(BOARD_CHANNELS, metric, q, "", true)
+				+ " UNION ALL " + BoardRows(BOARD_NICKS, metric, q, "", true);
+			q.query = "INSERT INTO `" + BoardTable() + "` (`board`,`period`,`period_start`,`metric`,`chan`,`nick`,`value`) "
+				"SELECT `board`,`period`,`period_start`,`metric`,`chan`,`nick`,`value` "
+				"FROM (" + rows + ") AS `ranked` "
+				"WHERE `rn` <= @size@;";
+			q.SetValue("size", Anope::ToString(board_size), false);
+			sql->Run(&board_build, q);
+		}
+	}
+
+	/** Brings the leaderboards up to date after a flush. Counters only grow
+	 * within a period, so a row that isn't on a board can only get onto it by
+	 * changing: upserting the changed rows and trimming each touched board back
+	 * to board_size keeps the boards exact.
+	 */
+	void RefreshLeaderboards(const std::vector<Anope::string> &names, const std::vector<std::pair<Anope::string, Anope::string>> &pairs)
+	{
+		if (!sql || board_metrics.empty())
+			return;
+
+		if (next_board_rebuild && Anope::CurTime >= next_board_rebuild)
+		{
+			RebuildLeaderboards();
+			return;
+		}
+
+		// A new day, week or month starts with empty boards; the old ones are never read again.
+		const Anope::string starts = DefaultPeriodStart("monthly") + DefaultPeriodStart("weekly") + DefaultPeriodStart("daily");
+		if (starts != board_starts)
+		{
+			SQL::Query q;
+			q.query = "DELETE FROM `" + BoardTable() + "` WHERE NOT " + CurrentPeriods(q) + ";";
+			sql->Run(&board_query, q);
+			board_starts = starts;
+		}
+
+		std::vector<Anope::string> chans, nicks;
+		for (const auto &name : names)
+		{
+			if (name.empty())
+				continue;
+			if (IRCD ? IRCD->IsChannelValid(name) : name[0] == '#')
+				chans.push_back(name);
+			else
+				nicks.push_back(name);
+		}
+
+		for (const auto &metric : board_metrics)
+		{
+			for (size_t c = 0; c < chans.size(); c += BOARD_CHUNK)
+			{
+				SQL::Query q;
+				UpsertBoardRows(q, BoardRows(BOARD_CHANNELS, metric, q, "`chan` IN (" + InList(q, "c", chans, c) + ")", false));
+			}
+
+			// Channel boards are keyed on (channel, nick), so only the pairs the flush wrote are re-read.
+			for (size_t p = 0; p < pairs.size(); p += BOARD_CHUNK)
+			{
+				SQL::Query q;
+				UpsertBoardRows(q, BoardRows(BOARD_CHANNEL, metric, q, PairFilter(q, pairs, p), false));
+			}
+
+			for (size_t n = 0; n < nicks.size(); n += BOARD_CHUNK)
+			{
+				SQL::Query q;
+				UpsertBoardRows(q, BoardRows(BOARD_NICKS, metric, q, "`nick` IN (" + InList(q, "n", nicks, n) + ")", false));
+			}
+		}
+
+		// Trimming covers every metric at once.
+		for (size_t c = 0; c < chans.size(); c += BOARD_CHUNK)
+		{
+			SQL::Query q;
+			TrimBoards(q, InList(q, "c", chans, c));
+		}
+
+		SQL::Query q;
+		TrimBoards(q, "'*channels','*nicks'");
+	}
+
+	/** Per-method query counters. latency[0] counts queries that took under
+	 * 1 ms, latency[i] those under 2^i ms, and the last bucket everything slower.
+	 */
+	struct MethodStats final
+	{
+		static constexpr size_t BUCKETS = 16;
+
+		uint64_t queries = 0;
+		uint64_t cached = 0;
+		uint64_t rows = 0;
+		uint64_t errors = 0;
+		uint64_t timeouts = 0;
+		uint64_t slow = 0;
+		uint64_t latency[BUCKETS] = { };
+	};
+
+	// Keyed by RPC method name.
+	std::map<Anope::string, MethodStats> method_stats;
+	// In milliseconds; 0 disables the slow query log.
+	uint64_t slow_query = 0;
+
+	void RecordQuery(const RPC::Request &request, const SQL::Result &r, std::chrono::steady_clock::time_point started, bool error)
+	{
+		const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+
+		auto &stats = method_stats[request.name];
+		stats.queries++;
+		if (error)
+			stats.errors++;
+		else
+			stats.rows += r.Rows();
+
+		size_t bucket = 0;
+		for (int64_t bound = 1000; bucket < MethodStats::BUCKETS - 1 && elapsed >= bound; bound *= 2)
+			bucket++;
+		stats.latency[bucket]++;
+
+		const uint64_t ms = elapsed / 1000;
+		if (!slow_query || ms < slow_query)
+			return;
+
+		stats.slow++;
+		Anope::string params;
+		for (const auto &param : request.data)
+			params += (params.empty() ? "\"" : ", \"") + param + "\"";
+		Log(this) << "rpc_chanstatsplus: slow query (" << ms << " ms): " << request.name << "(" << params << ")";
+		Log(LOG_DEBUG) << "rpc_chanstatsplus: slow query SQL: " << r.finished_query;
+	}
+
+	typedef std::function<void(const SQL::Result &, RPC::Request &)> ResultHandler;
+
+	/** An RPC request whose query is running on the SQL provider. The reply is
+	 * sent when the result arrives, or with ERR_TIMEOUT if that takes too long.
+	 */
+	class PendingRequest final
+		: public SQL::Interface
+	{
+		class TimeoutTimer final
+			: public Timer
+		{
+			PendingRequest *pending;
+
+		public:
+			TimeoutTimer(Module *m, time_t secs, PendingRequest *p)
+				: Timer(m, secs, false)
+				, pending(p)
+			{
+			}
+
+			void Tick() override
+			{
+				// One-shot timers are deleted by the timer manager after ticking.
+				pending->timer = nullptr;
+				pending->Fail(ERR_TIMEOUT, "Query timed out");
+			}
+		};
+
+		MRPCChanstatsPlus *parent;
+		RPC::Request request;
+		// request.reply refers to the HTTP server's reply for this call, which can be
+		// gone by the time the query finishes, so Send() answers from this copy.
+		HTTP::Reply repl;
+		Reference<HTTP::Client> client;
+		Reference<RPC::ServiceInterface> iface;
+		ResultHandler handler;
+		CacheScope scope;
+		uint64_t generation;
+		std::chrono::steady_clock::time_point started;
+		TimeoutTimer *timer = nullptr;
+		bool answered = false;
+
+		void Send()
+		{
+			answered = true;
+			if (!iface || !client)
+				return;
+
+			request.reply = this->repl;
+			iface->Reply(request);
+			client->SendReply(&request.reply);
+		}
+
+	public:
+		PendingRequest(MRPCChanstatsPlus *m, RPC::ServiceInterface *i, HTTP::Client *c, RPC::Request &req, ResultHandler &&h, const CacheScope &cs)
+			: SQL::Interface(m)
+			, parent(m)
+			, request(req)
+			, repl(request.reply)
+			, client(c)
+			, iface(i)
+			, handler(std::move(h))
+			, scope(cs)
+			, generation(m->cache_generation)
+			, started(std::chrono::steady_clock::now())
+		{
+			if (parent->timeout)
+				timer = new TimeoutTimer(m, parent->timeout, this);
+			parent->pending.insert(this);
+		}
+
+		~PendingRequest() override
+		{
+			delete timer;
+			parent->pending.erase(this);
+		}
+
+		void OnResult(const SQL::Result &r) override
+		{
+			parent->RecordQuery(request, r, started, false);
+			parent->CacheStore(scope, generation, r);
+			if (!answered)
+			{
+				handler(r, request);
+				Send();
+			}
+			delete this;
+		}
+
+		void OnError(const SQL::Result &r) override
+		{
+			parent->RecordQuery(request, r, started, true);
+			if (!answered)
+			{
+				request.Error(ERR_DB_ERROR, r.GetError());
+				Send();
+			}
+			delete this;
+		}
+
+		/** Answers with an error now. The query keeps running and this is deleted when it finishes. */
+		void Fail(int64_t code, const Anope::string &error)
+		{
+			if (answered)
+				return;
+
+			if (code == ERR_TIMEOUT)
+				parent->method_stats[request.name].timeouts++;
+			request.Error(code, error);
+			Send();
+		}
+	};
+
+	time_t timeout = 10;
+	// Requests the SQL provider drops without a callback when we unload.
+	std::set<PendingRequest *> pending;
+
+	/** Answers from the cache, or runs the query without blocking and answers from its result. */
+	bool RunAsync(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request, const SQL::Query &q,
+		const CacheScope &scope, ResultHandler &&handler)
+	{
+		if (const SQL::Result *cached = CacheFind(scope))
+		{
+			method_stats[request.name].cached++;
+			handler(*cached, request);
+			return true;
+		}
+
+		sql->Run(new PendingRequest(this, iface, client, request, std::move(handler), scope), q);
+		return false;
+	}
+
 	bool EnsureSQL(RPC::Request &request)
 	{
 		if (sql)
@@ -190,14 +926,14 @@ class MRPCChanstatsPlus final
 		return false;
 	}
 
-	bool SelectOne(RPC::Request &request, const Anope::string &chan, const Anope::string &nick, const Anope::string &period,
+	bool SelectOne(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request, const Anope::string &chan, const Anope::string &nick, const Anope::string &period,
 		const Anope::string &period_start)
 	{
 		if (!EnsureSQL(request))
 			return true;
 
 		SQL::Query q;
-		q.query = "SELECT `chan`,`nick`,`period`,DATE_FORMAT(`period_start`,'%Y-%m-%d') AS `period_start`,"
+		q.query = "SELECT `chan`,`nick`,`period`," + PeriodStartColumn() + ","
 			"`letters`,`words`,`lines`,`actions`,"
 			"`smileys_happy`,`smileys_sad`,`smileys_other`,"
 			"`kicks`,`kicked`,`modes`,`topics` "
@@ -209,21 +945,118 @@ class MRPCChanstatsPlus final
 		q.SetValue("period", period);
 		q.SetValue("pstart", period_start);
 
-		auto res = sql->RunQuery(q);
-		if (!res)
+		const auto scope = Scope("one", chan, nick, period, period_start);
+		return RunAsync(iface, client, request, q, scope, [](const SQL::Result &res, RPC::Request &req) {
+			if (res.Rows() < 1)
+				req.Error(ERR_NO_SUCH_STATS, "No stats found");
+			else
+				ReplyRow(res, 0, req.Root());
+		});
+	}
+
+	/** Fetches the rows of many channels (keycol "chan", aggregate rows with nick='')
+	 * or nicks (keycol "nick", global rows with chan='') with a single IN () query.
+	 * The reply has one entry per requested key, in request order, with
+	 * "found": false for keys without stats.
+	 */
+	bool SelectMany(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request, const Anope::string &method,
+		const Anope::string &keycol, const std::vector<Anope::string> &keys, const Anope::string &period, const Anope::string &period_start)
+	{
+		// keycol is a literal identifier from the events, never user input.
+		const Anope::string othercol = keycol == "chan" ? "nick" : "chan";
+
+		SQL::Query q;
+		Anope::string in;
+		Anope::string keylist;
+		Anope::unordered_map<bool> seen;
+		for (const auto &key : keys)
 		{
-			request.Error(ERR_DB_ERROR, res.GetError());
-			return true;
+			keylist += key + "\x1f";
+			if (!seen.emplace(key, true).second)
+				continue;
+
+			const Anope::string param = "k" + Anope::ToString(seen.size());
+			in += (in.empty() ? "@" : ",@") + param + "@";
+			q.SetValue(param, key);
 		}
 
-		if (res.Rows() < 1)
+		q.query = "SELECT `chan`,`nick`,`period`," + PeriodStartColumn() + ","
+			"`letters`,`words`,`lines`,`actions`,"
+			"`smileys_happy`,`smileys_sad`,`smileys_other`,"
+			"`kicks`,`kicked`,`modes`,`topics` "
+			"FROM `" + Table() + "` "
+			"WHERE `" + othercol + "`='' AND `period`=@period@ AND `period_start`=@pstart@ AND `" + keycol + "` IN (" + in + ")";
+		q.SetValue("period", period);
+		q.SetValue("pstart", period_start);
+
+		const auto scope = Scope(method, "", "", period, period_start, keylist);
+		return RunAsync(iface, client, request, q, scope, [keycol, keys](const SQL::Result &res, RPC::Request &req) {
+			Anope::unordered_map<int> rows;
+			for (int i = 0; i < res.Rows(); ++i)
+				rows.emplace(res.Get(i, keycol), i);
+
+			auto &root = req.Root<RPC::Array>();
+			for (const auto &key : keys)
+			{
+				auto &entry = root.ReplyMap();
+				entry.Reply("key", key);
+
+				auto it = rows.find(key);
+				entry.Reply("found", it != rows.end());
+				if (it != rows.end())
+					ReplyRow(res, it->second, entry);
+			}
+		});
+	}
+
+	/** Lists the distinct values of keycol for the rows where filtercol matches.
+	 * With an offset this is the old LIMIT/OFFSET paging and the reply is an array.
+	 * Without one it seeks past `after` on the (chan, nick, ...) primary key or the
+	 * nick index, so every page costs the same, and the reply is
+	 * {"<keycol>s": [...], "next": cursor}; next is empty on the last page.
+	 */
+	bool ListKeys(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request, const Anope::string &method,
+		const Anope::string &keycol, const Anope::string &filtercol, const Anope::string &filter, const Anope::string &period,
+		const Anope::string &period_start, size_t limit, const size_t *offset, const Anope::string &after)
+	{
+		// keycol and filtercol are literal identifiers from the events, never user input.
+		SQL::Query q;
+		q.query = "SELECT `" + keycol + "` "
+			"FROM `" + Table() + "` "
+			"WHERE `" + filtercol + "`=@filter@ AND `" + keycol + "` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
+			+ (!offset && !after.empty() ? "AND `" + keycol + "` > @after@ " : "") +
+			"GROUP BY `" + keycol + "` "
+			"ORDER BY `" + keycol + "` ASC "
+			"LIMIT @limit@" + (offset ? " OFFSET @offset@" : "");
+		q.SetValue("filter", filter);
+		q.SetValue("period", period);
+		q.SetValue("pstart", period_start);
+		q.SetValue("after", after);
+		q.SetValue("limit", Anope::ToString(limit), false);
+		if (offset)
+			q.SetValue("offset", Anope::ToString(*offset), false);
+
+		const Anope::string page = offset ? Anope::ToString(*offset) : "after:" + after;
+		const auto scope = Scope(method, filtercol == "chan" ? filter : "", filtercol == "nick" ? filter : "", period, period_start,
+			Anope::ToString(limit) + "/" + page);
+
+		if (offset)
 		{
-			request.Error(ERR_NO_SUCH_STATS, "No stats found");
-			return true;
+			return RunAsync(iface, client, request, q, scope, [keycol](const SQL::Result &res, RPC::Request &req) {
+				ReplyColumn(res, req, keycol);
+			});
 		}
 
-		ReplyRow(res, 0, request.Root());
-		return true;
+		return RunAsync(iface, client, request, q, scope, [keycol, limit](const SQL::Result &res, RPC::Request &req) {
+			auto &root = req.Root();
+			auto &keys = root.ReplyArray(keycol + "s");
+			for (int i = 0; i < res.Rows(); ++i)
+				keys.Reply(res.Get(i, keycol));
+
+			// A short page is the last one.
+			const bool more = res.Rows() > 0 && static_cast<size_t>(res.Rows()) >= limit;
+			root.Reply("next", more ? EncodeCursor(res.Get(res.Rows() - 1, keycol)) : Anope::string());
+		});
 	}
 
 	class GetChannelEvent final
@@ -259,7 +1092,7 @@ class MRPCChanstatsPlus final
 				return true;
 			}
 
-			return parent->SelectOne(request, channel, nick, period, period_start);
+			return parent->SelectOne(iface, client, request, channel, nick, period, period_start);
 		}
 	};
 
@@ -296,7 +1129,7 @@ class MRPCChanstatsPlus final
 				return true;
 			}
 
-			return parent->SelectOne(request, channel, nick, period, period_start);
+			return parent->SelectOne(iface, client, request, channel, nick, period, period_start);
 		}
 	};
 
@@ -351,34 +1184,26 @@ class MRPCChanstatsPlus final
 
 			const Anope::string ordercol = MetricColumn(metric);
 			SQL::Query q;
-			q.query = "SELECT `chan`,`nick`,`period`,DATE_FORMAT(`period_start`,'%Y-%m-%d') AS `period_start`,"
-				"`letters`,`words`,`lines`,`actions`,"
-				"`smileys_happy`,`smileys_sad`,`smileys_other`,"
-				"`kicks`,`kicked`,`modes`,`topics` "
-				"FROM `" + parent->Table() + "` "
-				"WHERE `chan`=@chan@ AND `period`=@period@ AND `period_start`=@pstart@ AND `nick` != '' "
-				"ORDER BY " + ordercol + " DESC, `nick` ASC "
-				"LIMIT @limit@";
+			if (parent->UseLeaderboard(metric, period, period_start, limit))
+				q.query = parent->LeaderboardQuery(ordercol, "`nick`");
+			else
+				q.query = "SELECT `chan`,`nick`,`period`," + parent->PeriodStartColumn() + ","
+					"`letters`,`words`,`lines`,`actions`,"
+					"`smileys_happy`,`smileys_sad`,`smileys_other`,"
+					"`kicks`,`kicked`,`modes`,`topics` "
+					"FROM `" + parent->Table() + "` "
+					"WHERE `chan`=@chan@ AND `period`=@period@ AND `period_start`=@pstart@ AND `nick` != '' "
+					"ORDER BY " + ordercol + " DESC, `nick` ASC "
+					"LIMIT @limit@";
+			q.SetValue("board", channel);
+			q.SetValue("metric", metric.lower());
 			q.SetValue("chan", channel);
 			q.SetValue("period", period);
 			q.SetValue("pstart", period_start);
 			q.SetValue("limit", Anope::ToString(limit), false);
 
-			auto res = parent->sql->RunQuery(q);
-			if (!res)
-			{
-				request.Error(ERR_DB_ERROR, res.GetError());
-				return true;
-			}
-
-			auto &root = request.Root<RPC::Array>();
-			for (int i = 0; i < res.Rows(); ++i)
-			{
-				auto &row = root.ReplyMap();
-				row.Reply("rank", static_cast<uint64_t>(i + 1));
-				ReplyRow(res, i, row);
-			}
-			return true;
+			const auto scope = parent->Scope("top", channel, "", period, period_start, metric + "/" + Anope::ToString(limit));
+			return parent->RunAsync(iface, client, request, q, scope, ReplyRanked);
 		}
 	};
 
@@ -432,33 +1257,25 @@ class MRPCChanstatsPlus final
 
 			const Anope::string ordercol = MetricColumn(metric);
 			SQL::Query q;
-			q.query = "SELECT `chan`,`nick`,`period`,DATE_FORMAT(`period_start`,'%Y-%m-%d') AS `period_start`,"
-				"`letters`,`words`,`lines`,`actions`,"
-				"`smileys_happy`,`smileys_sad`,`smileys_other`,"
-				"`kicks`,`kicked`,`modes`,`topics` "
-				"FROM `" + parent->Table() + "` "
-				"WHERE `nick`='' AND `chan` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
-				"ORDER BY " + ordercol + " DESC, `chan` ASC "
-				"LIMIT @limit@";
+			if (parent->UseLeaderboard(metric, period, period_start, limit))
+				q.query = parent->LeaderboardQuery(ordercol, "`chan`");
+			else
+				q.query = "SELECT `chan`,`nick`,`period`," + parent->PeriodStartColumn() + ","
+					"`letters`,`words`,`lines`,`actions`,"
+					"`smileys_happy`,`smileys_sad`,`smileys_other`,"
+					"`kicks`,`kicked`,`modes`,`topics` "
+					"FROM `" + parent->Table() + "` "
+					"WHERE `nick`='' AND `chan` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
+					"ORDER BY " + ordercol + " DESC, `chan` ASC "
+					"LIMIT @limit@";
+			q.SetValue("board", Anope::string("*channels"));
+			q.SetValue("metric", metric.lower());
 			q.SetValue("period", period);
 			q.SetValue("pstart", period_start);
 			q.SetValue("limit", Anope::ToString(limit), false);
 
-			auto res = parent->sql->RunQuery(q);
-			if (!res)
-			{
-				request.Error(ERR_DB_ERROR, res.GetError());
-				return true;
-			}
-
-			auto &root = request.Root<RPC::Array>();
-			for (int i = 0; i < res.Rows(); ++i)
-			{
-				auto &row = root.ReplyMap();
-				row.Reply("rank", static_cast<uint64_t>(i + 1));
-				ReplyRow(res, i, row);
-			}
-			return true;
+			const auto scope = parent->Scope("topChannels", "", "", period, period_start, metric + "/" + Anope::ToString(limit));
+			return parent->RunAsync(iface, client, request, q, scope, ReplyRanked);
 		}
 	};
 
@@ -512,33 +1329,25 @@ class MRPCChanstatsPlus final
 
 			const Anope::string ordercol = MetricColumn(metric);
 			SQL::Query q;
-			q.query = "SELECT `chan`,`nick`,`period`,DATE_FORMAT(`period_start`,'%Y-%m-%d') AS `period_start`,"
-				"`letters`,`words`,`lines`,`actions`,"
-				"`smileys_happy`,`smileys_sad`,`smileys_other`,"
-				"`kicks`,`kicked`,`modes`,`topics` "
-				"FROM `" + parent->Table() + "` "
-				"WHERE `chan`='' AND `nick` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
-				"ORDER BY " + ordercol + " DESC, `nick` ASC "
-				"LIMIT @limit@";
+			if (parent->UseLeaderboard(metric, period, period_start, limit))
+				q.query = parent->LeaderboardQuery(ordercol, "`nick`");
+			else
+				q.query = "SELECT `chan`,`nick`,`period`," + parent->PeriodStartColumn() + ","
+					"`letters`,`words`,`lines`,`actions`,"
+					"`smileys_happy`,`smileys_sad`,`smileys_other`,"
+					"`kicks`,`kicked`,`modes`,`topics` "
+					"FROM `" + parent->Table() + "` "
+					"WHERE `chan`='' AND `nick` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
+					"ORDER BY " + ordercol + " DESC, `nick` ASC "
+					"LIMIT @limit@";
+			q.SetValue("board", Anope::string("*nicks"));
+			q.SetValue("metric", metric.lower());
 			q.SetValue("period", period);
 			q.SetValue("pstart", period_start);
 			q.SetValue("limit", Anope::ToString(limit), false);
 
-			auto res = parent->sql->RunQuery(q);
-			if (!res)
-			{
-				request.Error(ERR_DB_ERROR, res.GetError());
-				return true;
-			}
-
-			auto &root = request.Root<RPC::Array>();
-			for (int i = 0; i < res.Rows(); ++i)
-			{
-				auto &row = root.ReplyMap();
-				row.Reply("rank", static_cast<uint64_t>(i + 1));
-				ReplyRow(res, i, row);
-			}
-			return true;
+			const auto scope = parent->Scope("topNicksGlobal", "", "", period, period_start, metric + "/" + Anope::ToString(limit));
+			return parent->RunAsync(iface, client, request, q, scope, ReplyRanked);
 		}
 	};
 
@@ -576,6 +1385,15 @@ class MRPCChanstatsPlus final
 
 			auto offset = Anope::Convert<size_t>(offsetstr, 0);
 
+			// A sixth parameter, even empty, selects keyset pagination.
+			const bool keyset = request.data.size() > 5;
+			Anope::string after;
+			if (keyset && !DecodeCursor(request.data[5], after))
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Invalid cursor");
+				return true;
+			}
+
 			if (period_start.empty())
 				period_start = DefaultPeriodStart(period);
 			else if (!IsDateYMD(period_start))
@@ -587,30 +1405,8 @@ class MRPCChanstatsPlus final
 			if (!parent->EnsureSQL(request))
 				return true;
 
-			SQL::Query q;
-			q.query = "SELECT `nick` "
-				"FROM `" + parent->Table() + "` "
-				"WHERE `chan`=@chan@ AND `nick` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
-				"GROUP BY `nick` "
-				"ORDER BY `nick` ASC "
-				"LIMIT @limit@ OFFSET @offset@";
-			q.SetValue("chan", channel);
-			q.SetValue("period", period);
-			q.SetValue("pstart", period_start);
-			q.SetValue("limit", Anope::ToString(limit), false);
-			q.SetValue("offset", Anope::ToString(offset), false);
-
-			auto res = parent->sql->RunQuery(q);
-			if (!res)
-			{
-				request.Error(ERR_DB_ERROR, res.GetError());
-				return true;
-			}
-
-			auto &root = request.Root<RPC::Array>();
-			for (int i = 0; i < res.Rows(); ++i)
-				root.Reply(res.Get(i, "nick"));
-			return true;
+			return parent->ListKeys(iface, client, request, "listNicksInChannel", "nick", "chan", channel, period, period_start, limit,
+				keyset ? nullptr : &offset, after);
 		}
 	};
 
@@ -648,6 +1444,15 @@ class MRPCChanstatsPlus final
 
 			auto offset = Anope::Convert<size_t>(offsetstr, 0);
 
+			// A sixth parameter, even empty, selects keyset pagination.
+			const bool keyset = request.data.size() > 5;
+			Anope::string after;
+			if (keyset && !DecodeCursor(request.data[5], after))
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Invalid cursor");
+				return true;
+			}
+
 			if (period_start.empty())
 				period_start = DefaultPeriodStart(period);
 			else if (!IsDateYMD(period_start))
@@ -659,29 +1464,165 @@ class MRPCChanstatsPlus final
 			if (!parent->EnsureSQL(request))
 				return true;
 
-			SQL::Query q;
-			q.query = "SELECT `chan` "
-				"FROM `" + parent->Table() + "` "
-				"WHERE `nick`=@nick@ AND `chan` != '' AND `period`=@period@ AND `period_start`=@pstart@ "
-				"GROUP BY `chan` "
-				"ORDER BY `chan` ASC "
-				"LIMIT @limit@ OFFSET @offset@";
-			q.SetValue("nick", nick);
-			q.SetValue("period", period);
-			q.SetValue("pstart", period_start);
-			q.SetValue("limit", Anope::ToString(limit), false);
-			q.SetValue("offset", Anope::ToString(offset), false);
+			return parent->ListKeys(iface, client, request, "listChannelsForNick", "chan", "nick", nick, period, period_start, limit,
+				keyset ? nullptr : &offset, after);
+		}
+	};
+
+	class GetChannelsEvent final
+		: public RPC::Event
+	{
+		MRPCChanstatsPlus *parent;
 
-			auto res = parent->sql->RunQuery(q);
-			if (!res)
+	public:
+		GetChannelsEvent(MRPCChanstatsPlus *p)
+			: RPC::Event(p, "anope.chanstatsplus.getChannels", 3)
+			, parent(p)
+		{
+		}
+
+		bool Run(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request) override
+		{
+			Anope::string period = !request.data[0].empty() ? request.data[0] : "total";
+			Anope::string period_start = request.data[1];
+			const std::vector<Anope::string> keys(request.data.begin() + 2, request.data.end());
+
+			if (!IsValidPeriod(period))
 			{
-				request.Error(ERR_DB_ERROR, res.GetError());
+				request.Error(RPC::ERR_INVALID_PARAMS, "Invalid period (expected total/monthly/weekly/daily)");
 				return true;
 			}
 
-			auto &root = request.Root<RPC::Array>();
-			for (int i = 0; i < res.Rows(); ++i)
-				root.Reply(res.Get(i, "chan"));
+			if (period_start.empty())
+				period_start = DefaultPeriodStart(period);
+			else if (!IsDateYMD(period_start))
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Invalid period_start (expected YYYY-MM-DD)");
+				return true;
+			}
+
+			if (keys.size() > parent->max_limit)
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Too many channels (at most " + Anope::ToString(parent->max_limit) + ")");
+				return true;
+			}
+
+			for (const auto &key : keys)
+			{
+				if (key.empty() || key.length() > 64 || (IRCD && !IRCD->IsChannelValid(key)))
+				{
+					request.Error(RPC::ERR_INVALID_PARAMS, "Invalid channel: " + key);
+					return true;
+				}
+			}
+
+			if (!parent->EnsureSQL(request))
+				return true;
+
+			return parent->SelectMany(iface, client, request, "getChannels", "chan", keys, period, period_start);
+		}
+	};
+
+	class GetNicksEvent final
+		: public RPC::Event
+	{
+		MRPCChanstatsPlus *parent;
+
+	public:
+		GetNicksEvent(MRPCChanstatsPlus *p)
+			: RPC::Event(p, "anope.chanstatsplus.getNicks", 3)
+			, parent(p)
+		{
+		}
+
+		bool Run(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request) override
+		{
+			Anope::string period = !request.data[0].empty() ? request.data[0] : "total";
+			Anope::string period_start = request.data[1];
+			const std::vector<Anope::string> keys(request.data.begin() + 2, request.data.end());
+
+			if (!IsValidPeriod(period))
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Invalid period (expected total/monthly/weekly/daily)");
+				return true;
+			}
+
+			if (period_start.empty())
+				period_start = DefaultPeriodStart(period);
+			else if (!IsDateYMD(period_start))
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Invalid period_start (expected YYYY-MM-DD)");
+				return true;
+			}
+
+			if (keys.size() > parent->max_limit)
+			{
+				request.Error(RPC::ERR_INVALID_PARAMS, "Too many nicks (at most " + Anope::ToString(parent->max_limit) + ")");
+				return true;
+			}
+
+			for (const auto &key : keys)
+			{
+				if (key.empty() || key.length() > 64 || (IRCD && !IRCD->IsNickValid(key)))
+				{
+					request.Error(RPC::ERR_INVALID_PARAMS, "Invalid nick: " + key);
+					return true;
+				}
+			}
+
+			if (!parent->EnsureSQL(request))
+				return true;
+
+			return parent->SelectMany(iface, client, request, "getNicks", "nick", keys, period, period_start);
+		}
+	};
+
+	class StatsEvent final
+		: public RPC::Event
+	{
+		MRPCChanstatsPlus *parent;
+
+	public:
+		StatsEvent(MRPCChanstatsPlus *p)
+			: RPC::Event(p, "anope.chanstatsplus.stats")
+			, parent(p)
+		{
+		}
+
+		bool Run(RPC::ServiceInterface *iface, HTTP::Client *client, RPC::Request &request) override
+		{
+			auto &root = request.Root();
+			root.Reply("pending", static_cast<uint64_t>(parent->pending.size()));
+
+			auto &cache = root.ReplyMap("cache");
+			cache.Reply("entries", static_cast<uint64_t>(parent->cache.size()));
+			cache.Reply("hits", parent->cache_hits);
+			cache.Reply("misses", parent->cache_misses);
+			cache.Reply("invalidations", parent->cache_invalidations);
+
+			auto &boards = root.ReplyMap("leaderboards");
+			boards.Reply("metrics", static_cast<uint64_t>(parent->board_metrics.size()));
+			boards.Reply("ready", parent->boards_ready);
+
+			auto &bounds = root.ReplyArray("latency_buckets_ms");
+			for (size_t i = 0; i < MethodStats::BUCKETS - 1; ++i)
+				bounds.Reply(static_cast<uint64_t>(1) << i);
+
+			auto &methods = root.ReplyMap("methods");
+			for (const auto &[name, stats] : parent->method_stats)
+			{
+				auto &method = methods.ReplyMap(name);
+				method.Reply("queries", stats.queries);
+				method.Reply("cached", stats.cached);
+				method.Reply("rows", stats.rows);
+				method.Reply("errors", stats.errors);
+				method.Reply("timeouts", stats.timeouts);
+				method.Reply("slow", stats.slow);
+
+				auto &latency = method.ReplyArray("latency");
+				for (auto count : stats.latency)
+					latency.Reply(count);
+			}
 			return true;
 		}
 	};
@@ -693,11 +1634,17 @@ class MRPCChanstatsPlus final
 	TopNicksGlobalEvent event_top_nicks_global;
 	ListNicksInChannelEvent event_list_nicks_in_channel;
 	ListChannelsForNickEvent event_list_channels_for_nick;
+	GetChannelsEvent event_get_channels;
+	GetNicksEvent event_get_nicks;
+	FlushListener flush_listener;
+	StatsEvent event_stats;
 
 public:
 	MRPCChanstatsPlus(const Anope::string &modname, const Anope::string &creator)
 		: Module(modname, creator, EXTRA | VENDOR)
 		, sql("", "")
+		, board_query(this, false)
+		, board_build(this, true)
 		, event_get_channel(this)
 		, event_get_nick(this)
 		, event_top(this)
@@ -705,21 +1652,67 @@ public:
 		, event_top_nicks_global(this)
 		, event_list_nicks_in_channel(this)
 		, event_list_channels_for_nick(this)
+		, event_get_channels(this)
+		, event_get_nicks(this)
+		, flush_listener(this)
+		, event_stats(this)
 	{
 	}
 
+	~MRPCChanstatsPlus() override
+	{
+		while (!pending.empty())
+		{
+			auto *req = *pending.begin();
+			req->Fail(ERR_DB_ERROR, "Module unloaded");
+			delete req;
+		}
+	}
+
 	void OnReload(Configuration::Conf &conf) override
 	{
 		const auto &block = conf.GetModule(this);
 		engine = block.Get<const Anope::string>("engine");
 		prefix = block.Get<const Anope::string>("prefix", "anope_");
+		const Anope::string dialect = block.Get<const Anope::string>("dialect");
+		sqlite = dialect.empty() ? engine.find_ci("sqlite") == 0 : dialect.equals_ci("sqlite");
 		max_limit = block.Get<size_t>("maxlimit", "100");
+		timeout = block.Get<time_t>("timeout", "10s");
+		cache_ttl = block.Get<time_t>("cachettl", "30s");
+		cache_size = block.Get<size_t>("cachesize", "1000");
+		slow_query = block.Get<uint64_t>("slowquery", "1000");
+		// Results from another engine/prefix, or cached under another TTL, no longer apply.
+		CacheClear();
 		if (!max_limit)
 			max_limit = 100;
 
+		board_metrics.clear();
+		spacesepstream metricstream(block.Get<const Anope::string>("leaderboards"));
+		for (Anope::string metric; metricstream.GetToken(metric);)
+		{
+			if (IsValidMetric(metric))
+				board_metrics.push_back(metric.lower());
+			else
+				Log(this) << "rpc_chanstatsplus: ignoring unknown leaderboard metric " << metric;
+		}
+		board_size = block.Get<size_t>("leaderboardsize", "100");
+		if (!board_size)
+			board_size = 100;
+		board_rebuild = block.Get<time_t>("leaderboardrebuild", "1d");
+		boards_ready = false;
+
 		sql = ServiceReference<SQL::Provider>("SQL::Provider", engine);
 		if (!sql)
+		{
 			Log(this) << "rpc_chanstatsplus: no database connection to " << engine;
+			return;
+		}
+
+		if (!board_metrics.empty())
+		{
+			EnsureLeaderboards();
+			RebuildLeaderboards();
+		}
 	}
 };
 
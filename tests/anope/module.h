@@ -0,0 +1,861 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Stand-in for Anope's module.h, used by the programs in tests/.
+//
+// It declares just enough of the Anope 2.1 API for the modules in this
+// repository to compile into a standalone program. Everything is inline so a
+// harness is a single translation unit: it includes the module source and adds
+// its own main(). Nothing here talks to an IRC server; lookups find nothing,
+// replies and logs go to stdout/stderr, and configuration comes from
+// Configuration::Block::Set().
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+
+class Serializable;
+class Module;
+
+namespace Anope
+{
+	class string final
+	{
+		std::string _string;
+
+	public:
+		typedef std::string::iterator iterator;
+		typedef std::string::const_iterator const_iterator;
+		typedef std::string::size_type size_type;
+		static const size_type npos = std::string::npos;
+
+		string() = default;
+		string(const char *s) : _string(s) { }
+		string(const char *s, size_t n) : _string(s, n) { }
+		string(const std::string &s) : _string(s) { }
+		string(size_t n, char c) : _string(n, c) { }
+		template<typename It> string(It a, It b) : _string(a, b) { }
+
+		std::string &str() { return _string; }
+		const std::string &str() const { return _string; }
+		const char *c_str() const { return _string.c_str(); }
+		const char *data() const { return _string.data(); }
+		size_t length() const { return _string.length(); }
+		size_t size() const { return _string.size(); }
+		size_t capacity() const { return _string.capacity(); }
+		bool empty() const { return _string.empty(); }
+		void clear() { _string.clear(); }
+		void reserve(size_t n) { _string.reserve(n); }
+		void resize(size_t n) { _string.resize(n); }
+
+		size_t find(const string &s, size_t p = 0) const { return _string.find(s._string, p); }
+		size_t find(char c, size_t p = 0) const { return _string.find(c, p); }
+		size_t rfind(char c, size_t p = npos) const { return _string.rfind(c, p); }
+		size_t find_first_of(const string &s, size_t p = 0) const { return _string.find_first_of(s._string, p); }
+		size_t find_first_not_of(const string &s, size_t p = 0) const { return _string.find_first_not_of(s._string, p); }
+		size_t find_ci(const string &s, size_t p = 0) const { return lower()._string.find(s.lower()._string, p); }
+		string substr(size_t a, size_t n = npos) const { return _string.substr(a, n); }
+		string &erase(size_t a = 0, size_t n = npos) { _string.erase(a, n); return *this; }
+		iterator erase(iterator i) { return _string.erase(i); }
+		void push_back(char c) { _string.push_back(c); }
+		string &append(const char *p, size_t n) { _string.append(p, n); return *this; }
+		string &replace_all_cs(const string &from, const string &to)
+		{
+			for (size_t p = 0; !from.empty() && (p = _string.find(from._string, p)) != npos; p += to.length())
+				_string.replace(p, from.length(), to._string);
+			return *this;
+		}
+
+		string &operator+=(const string &o) { _string += o._string; return *this; }
+		string &operator+=(const char *o) { _string += o; return *this; }
+		string &operator+=(char o) { _string += o; return *this; }
+		string operator+(const string &o) const { return _string + o._string; }
+		string operator+(const char *o) const { return _string + o; }
+		string operator+(char o) const { return _string + o; }
+		friend string operator+(const char *a, const string &b) { return std::string(a) + b._string; }
+		friend string operator+(char a, const string &b) { return std::string(1, a) + b._string; }
+		bool operator==(const string &o) const { return _string == o._string; }
+		bool operator==(const char *o) const { return _string == o; }
+		bool operator!=(const string &o) const { return _string != o._string; }
+		bool operator!=(const char *o) const { return _string != o; }
+		bool operator<(const string &o) const { return _string < o._string; }
+		char &operator[](size_t i) { return _string[i]; }
+		const char &operator[](size_t i) const { return _string[i]; }
+
+		iterator begin() { return _string.begin(); }
+		iterator end() { return _string.end(); }
+		const_iterator begin() const { return _string.begin(); }
+		const_iterator end() const { return _string.end(); }
+
+		string lower() const
+		{
+			std::string s = _string;
+			for (auto &c : s)
+				c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+			return s;
+		}
+
+		string upper() const
+		{
+			std::string s = _string;
+			for (auto &c : s)
+				c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+			return s;
+		}
+
+		bool equals_ci(const string &o) const { return lower() == o.lower(); }
+		bool equals_cs(const string &o) const { return _string == o._string; }
+
+		bool is_pos_number_only() const
+		{
+			return !empty() && std::all_of(begin(), end(), [](char c) { return c >= '0' && c <= '9'; });
+		}
+
+		bool is_number_only() const
+		{
+			return !empty() && (is_pos_number_only() || (_string[0] == '-' && substr(1).is_pos_number_only()));
+		}
+
+		friend std::ostream &operator<<(std::ostream &os, const string &s) { return os << s._string; }
+	};
+
+	struct hash_ci final
+	{
+		size_t operator()(const string &s) const { return std::hash<std::string>()(s.lower().str()); }
+	};
+
+	struct hash_cs final
+	{
+		size_t operator()(const string &s) const { return std::hash<std::string>()(s.str()); }
+	};
+
+	struct compare final
+	{
+		bool operator()(const string &a, const string &b) const { return a.equals_ci(b); }
+	};
+
+	template<typename T> using unordered_map = std::unordered_map<string, T, hash_ci, compare>;
+	template<typename T> using map = std::map<string, T>;
+
+	inline time_t CurTime = 0;
+	inline bool ReadOnly = false;
+	inline string DataDir = ".";
+
+	inline string ExpandData(const string &path)
+	{
+		return !path.empty() && path[0] == '/' ? path : DataDir + "/" + path;
+	}
+
+	template<typename T> string ToString(const T &v)
+	{
+		std::ostringstream os;
+		os << v;
+		return os.str();
+	}
+
+	template<typename T> std::optional<T> TryConvert(const string &s, string *left = nullptr)
+	{
+		std::istringstream is(s.str());
+		T v;
+		if (!(is >> v))
+			return std::nullopt;
+		if (left)
+		{
+			std::string rest;
+			std::getline(is, rest, '\0');
+			*left = rest;
+		}
+		return v;
+	}
+
+	template<typename T> T Convert(const string &s, T def, string *left = nullptr)
+	{
+		return TryConvert<T>(s, left).value_or(def);
+	}
+
+	/** Parses a duration such as "90", "5s", "1h30m" into seconds. */
+	inline time_t DoTime(const string &s)
+	{
+		static const std::map<char, time_t> units = { { 's', 1 }, { 'm', 60 }, { 'h', 3600 }, { 'd', 86400 }, { 'w', 604800 }, { 'y', 31536000 } };
+		time_t total = 0, cur = 0;
+		for (const char c : s)
+		{
+			if (c >= '0' && c <= '9')
+				cur = cur * 10 + (c - '0');
+			else if (units.count(c))
+			{
+				total += cur * units.at(c);
+				cur = 0;
+			}
+		}
+		return total + cur;
+	}
+
+	inline string Duration(time_t t, void * = nullptr)
+	{
+		return ToString(t) + "s";
+	}
+
+	inline string strftime(time_t t, void * = nullptr, bool = false)
+	{
+		char buf[64];
+		std::tm tmv;
+		localtime_r(&t, &tmv);
+		std::strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tmv);
+		return buf;
+	}
+
+	inline string printf(const char *fmt, ...)
+	{
+		char buf[1024];
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, args);
+		va_end(args);
+		return buf;
+	}
+
+	inline string Format(const char *fmt, ...)
+	{
+		char buf[1024];
+		va_list args;
+		va_start(args, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, args);
+		va_end(args);
+		return buf;
+	}
+
+	inline string Expand(const string &base, const string &path)
+	{
+		return base + "/" + path;
+	}
+
+	inline string Hex(const char *data, size_t len)
+	{
+		static const char digits[] = "0123456789abcdef";
+		string out;
+		for (size_t i = 0; i < len; ++i)
+		{
+			out += digits[static_cast<unsigned char>(data[i]) >> 4];
+			out += digits[static_cast<unsigned char>(data[i]) & 15];
+		}
+		return out;
+	}
+
+	inline void B64Encode(const string &in, string &out) { out = in; }
+	inline void B64Decode(const string &in, string &out) { out = in; }
+	inline int VersionMajor() { return 2; }
+	inline int VersionMinor() { return 1; }
+}
+
+inline const char *_(const char *s) { return s; }
+
+#define CHAN_X_NOT_REGISTERED "Channel %s isn't registered."
+#define CHAN_X_NOT_IN_USE "Channel %s doesn't exist."
+#define CHAN_X_INVALID "Channel %s is not a valid channel."
+#define NICK_X_NOT_REGISTERED "Nick %s isn't registered."
+#define ACCESS_DENIED "Access denied."
+#define READ_ONLY_MODE "Services are in read-only mode!"
+#define MORE_INFO "\"%s%s HELP %s\" for more information."
+
+enum ModType { EXTRA = 1, VENDOR = 2, THIRD = 4 };
+enum EventReturn { EVENT_STOP, EVENT_CONTINUE, EVENT_ALLOW };
+enum LogType { LOG_ADMIN, LOG_OVERRIDE, LOG_COMMAND, LOG_SERVER, LOG_CHANNEL, LOG_USER, LOG_MODULE, LOG_NORMAL, LOG_TERMINAL, LOG_RAWIO, LOG_DEBUG, LOG_DEBUG_2 };
+enum { PSEUDOCLIENT = 8 };
+
+class CoreException : public std::exception
+{
+public:
+	CoreException(const Anope::string &) { }
+};
+
+class ModuleException : public CoreException
+{
+public:
+	ModuleException(const Anope::string &m) : CoreException(m) { }
+};
+
+/** Extensions are looked up by name in the ExtensibleItems a module created. */
+class Extensible
+{
+public:
+	template<typename T> T *GetExt(const Anope::string &name) const;
+	template<typename T> T *Extend(const Anope::string &name);
+	template<typename T> T *Require(const Anope::string &name) { return Extend<T>(name); }
+	template<typename T> void Shrink(const Anope::string &name);
+	bool HasExt(const Anope::string &name) const;
+};
+
+namespace Serialize
+{
+	struct Data
+	{
+		struct Value
+		{
+			template<typename T> Value &operator<<(const T &) { return *this; }
+			template<typename T> Value &operator>>(T &) { return *this; }
+		};
+
+		Value value;
+		Value &operator[](const Anope::string &) { return value; }
+	};
+
+	class Type
+	{
+	public:
+		Type(const Anope::string &, Module * = nullptr) { }
+		virtual ~Type() = default;
+		virtual void Serialize(::Serializable *, Data &) const = 0;
+		virtual ::Serializable *Unserialize(::Serializable *, Data &) const = 0;
+	};
+
+	template<typename T> class Checker final
+	{
+		T obj;
+
+	public:
+		Checker(const Anope::string &) { }
+		T *operator->() { return &obj; }
+		const T *operator->() const { return &obj; }
+		T &operator*() { return obj; }
+		const T &operator*() const { return obj; }
+	};
+}
+
+class Serializable
+{
+public:
+	Serializable(const Anope::string &) { }
+	virtual ~Serializable() = default;
+	void QueueUpdate() { }
+};
+
+template<typename T, typename O> T anope_dynamic_static_cast(O o) { return static_cast<T>(o); }
+
+template<typename T> class Reference
+{
+	T *ref = nullptr;
+
+public:
+	Reference() = default;
+	Reference(T *t) : ref(t) { }
+	operator bool() const { return ref; }
+	operator T *() const { return ref; }
+	T *operator->() const { return ref; }
+	T *operator*() const { return ref; }
+};
+
+class NickCore : public Extensible, public Serializable
+{
+public:
+	Anope::string display;
+	NickCore() : Serializable("NickCore") { }
+	uint64_t GetId() { return 0; }
+};
+
+class NickAlias : public Extensible
+{
+public:
+	NickCore *nc = nullptr;
+	Anope::string nick;
+	static NickAlias *Find(const Anope::string &) { return nullptr; }
+};
+
+class User;
+class ChannelInfo;
+
+struct ChanUserContainer
+{
+	User *user = nullptr;
+	class Channel *chan = nullptr;
+};
+
+struct AccessGroup
+{
+	bool HasPriv(const Anope::string &) const { return false; }
+};
+
+class Channel : public Extensible
+{
+public:
+	Anope::string name;
+	ChannelInfo *ci = nullptr;
+	Anope::string topic, topic_setter;
+	time_t topic_time = 0;
+
+	ChanUserContainer *FindUser(User *) const { return nullptr; }
+	bool MatchesList(User *, const Anope::string &) { return false; }
+	bool HasMode(const Anope::string &) { return false; }
+	void ChangeTopic(const Anope::string &, const Anope::string &, time_t) { }
+	static Channel *Find(const Anope::string &) { return nullptr; }
+};
+
+class ChannelInfo : public Extensible, public Serializable
+{
+public:
+	Anope::string name;
+	Channel *c = nullptr;
+	Anope::string last_topic, last_topic_setter;
+	time_t last_topic_time = 0;
+
+	ChannelInfo() : Serializable("ChannelInfo") { }
+	AccessGroup AccessFor(User *) { return AccessGroup(); }
+	static ChannelInfo *Find(const Anope::string &) { return nullptr; }
+};
+
+typedef std::unordered_map<Anope::string, ChannelInfo *, Anope::hash_ci, Anope::compare> registered_channel_map;
+inline registered_channel_map *RegisteredChannelList = nullptr;
+
+class User : public Extensible
+{
+public:
+	Anope::string nick;
+	NickCore *account = nullptr;
+
+	bool IsIdentified(bool = false) const { return account; }
+	NickCore *Account() const { return account; }
+	bool IsServicesOper() { return false; }
+	bool HasPriv(const Anope::string &) { return false; }
+	static User *Find(const Anope::string &, bool = false) { return nullptr; }
+};
+
+class BotInfo : public User
+{
+public:
+	Anope::string host;
+	const Anope::string &GetIdent() const { return nick; }
+	static BotInfo *Find(const Anope::string &, bool = false) { return nullptr; }
+};
+
+typedef std::map<Anope::string, User *> user_map;
+inline user_map UserListByNick;
+
+class MessageSource
+{
+public:
+	User *GetUser() const { return nullptr; }
+};
+
+class ChannelMode { };
+struct ModeData { };
+
+class Server
+{
+public:
+	bool IsSynced() const { return true; }
+};
+inline Server *Me = nullptr;
+
+class CommandSource
+{
+public:
+	Reference<Channel> c;
+	Reference<BotInfo> service;
+	Anope::string command;
+	Anope::string permission;
+	NickCore *nc = nullptr;
+	Anope::string nick;
+
+	void Reply(const char *fmt, ...)
+	{
+		va_list args;
+		va_start(args, fmt);
+		vprintf(fmt, args);
+		va_end(args);
+		std::putchar('\n');
+	}
+
+	void Reply(const Anope::string &message) { std::puts(message.c_str()); }
+	AccessGroup AccessFor(ChannelInfo *) { return AccessGroup(); }
+	bool HasPriv(const Anope::string &) { return true; }
+	bool HasCommand(const Anope::string &) { return true; }
+	NickCore *GetAccount() { return nc; }
+	const Anope::string &GetNick() const { return nick; }
+	User *GetUser() { return nullptr; }
+	bool IsOper() { return true; }
+	bool IsFounder(ChannelInfo *) { return false; }
+};
+
+class Command
+{
+public:
+	Module *module;
+	Anope::string name;
+
+	Command(Module *owner, const Anope::string &sname, size_t, size_t = 0) : module(owner), name(sname) { }
+	virtual ~Command() = default;
+	void SetDesc(const Anope::string &) { }
+	void SetSyntax(const Anope::string &) { }
+	void ClearSyntax() { }
+	void SendSyntax(CommandSource &) { }
+	void AllowUnregistered(bool) { }
+	void RequireUser(bool) { }
+	virtual void Execute(CommandSource &, const std::vector<Anope::string> &) = 0;
+	virtual bool OnHelp(CommandSource &, const Anope::string &) { return false; }
+	virtual void OnSyntaxError(CommandSource &, const Anope::string &) { }
+	static bool FindCommandFromService(const Anope::string &, BotInfo *&, Anope::string &) { return false; }
+};
+
+class InfoFormatter
+{
+	std::map<Anope::string, Anope::string> options;
+
+public:
+	void AddOption(const Anope::string &) { }
+	Anope::string &operator[](const Anope::string &key) { return options[key]; }
+};
+
+class ListFormatter
+{
+public:
+	typedef std::map<Anope::string, Anope::string> ListEntry;
+
+private:
+	std::vector<ListEntry> entries;
+
+public:
+	ListFormatter(NickCore *) { }
+	ListFormatter &AddColumn(const Anope::string &) { return *this; }
+	void AddEntry(const ListEntry &entry) { entries.push_back(entry); }
+	bool IsEmpty() const { return entries.empty(); }
+	void SendTo(CommandSource &) { }
+};
+
+/** Writes module and admin logs to stderr; debug logs are discarded. */
+class Log final
+{
+	bool show;
+	std::ostringstream buf;
+
+public:
+	Log(LogType type = LOG_NORMAL, const Anope::string & = "") : show(type < LOG_DEBUG) { }
+	Log(Module *) : show(true) { }
+	Log(LogType type, CommandSource &, Command *, ChannelInfo * = nullptr) : show(type < LOG_DEBUG) { }
+	~Log()
+	{
+		if (show)
+			std::cerr << buf.str() << std::endl;
+	}
+	template<typename T> Log &operator<<(const T &v)
+	{
+		buf << v;
+		return *this;
+	}
+};
+
+class spacesepstream
+{
+	std::istringstream is;
+
+public:
+	spacesepstream(const Anope::string &s) : is(s.str()) { }
+
+	bool GetToken(Anope::string &token)
+	{
+		std::string s;
+		if (!(is >> s))
+			return false;
+		token = s;
+		return true;
+	}
+
+	bool StreamEnd() { return (is >> std::ws).eof(); }
+};
+
+class commasepstream
+{
+	std::istringstream is;
+
+public:
+	commasepstream(const Anope::string &s, bool = false) : is(s.str()) { }
+
+	bool GetToken(Anope::string &token)
+	{
+		std::string s;
+		if (!std::getline(is, s, ','))
+			return false;
+		token = s;
+		return true;
+	}
+};
+
+namespace Configuration
+{
+	/** A module block. Harnesses fill it with Set(); unset keys use the default. */
+	struct Block
+	{
+		std::map<std::string, std::string> items;
+
+		void Set(const Anope::string &key, const Anope::string &value) { items[key.str()] = value.str(); }
+
+		template<typename T> T Get(const Anope::string &key, const Anope::string &def = "") const
+		{
+			auto it = items.find(key.str());
+			const Anope::string value = it == items.end() ? def : Anope::string(it->second);
+			if constexpr (std::is_same_v<std::decay_t<T>, Anope::string>)
+				return value;
+			else if constexpr (std::is_same_v<T, bool>)
+				return value.equals_ci("yes") || value.equals_ci("true") || value.equals_ci("on") || value == "1";
+			else if constexpr (std::is_same_v<T, time_t>)
+				return Anope::DoTime(value);
+			else
+				return Anope::Convert<T>(value, T());
+		}
+
+		int CountBlock(const Anope::string &) const { return 0; }
+		const Block &GetBlock(const Anope::string &, int = 0) const { return *this; }
+	};
+
+	struct Conf
+	{
+		Block module;
+		const Block &GetModule(Module *) { return module; }
+		Block &GetBlock(const Anope::string &) { return module; }
+	};
+}
+
+class Module : public Extensible
+{
+public:
+	Anope::string name;
+
+	Module(const Anope::string &modname, const Anope::string &, int) : name(modname) { }
+	virtual ~Module() = default;
+	void SetAuthor(const Anope::string &) { }
+	void SetVersion(const Anope::string &) { }
+
+	virtual void OnReload(Configuration::Conf &) { }
+	virtual EventReturn OnPreCommand(CommandSource &, Command *, std::vector<Anope::string> &) { return EVENT_CONTINUE; }
+	virtual EventReturn OnPreHelp(CommandSource &, const std::vector<Anope::string> &) { return EVENT_CONTINUE; }
+	virtual void OnPostHelp(CommandSource &, const std::vector<Anope::string> &) { }
+	virtual void OnUserConnect(User *, bool &) { }
+	virtual void OnUserNickChange(User *, const Anope::string &) { }
+	virtual void OnUserLogin(User *) { }
+	virtual void OnNickLogout(User *) { }
+	virtual void OnNickRegister(User *, NickAlias *, const Anope::string &) { }
+	virtual void OnJoinChannel(User *, Channel *) { }
+	virtual void OnChanRegistered(ChannelInfo *) { }
+	virtual void OnSaveDatabase() { }
+	virtual void OnChanInfo(CommandSource &, ChannelInfo *, InfoFormatter &, bool) { }
+	virtual void OnNickInfo(CommandSource &, NickAlias *, InfoFormatter &, bool) { }
+	virtual void OnTopicUpdated(User *, Channel *, const Anope::string &, const Anope::string &) { }
+	virtual EventReturn OnChannelModeSet(Channel *, MessageSource &, ChannelMode *, const ModeData &) { return EVENT_CONTINUE; }
+	virtual EventReturn OnChannelModeUnset(Channel *, MessageSource &, ChannelMode *, const Anope::string &) { return EVENT_CONTINUE; }
+	virtual void OnPreUserKicked(const MessageSource &, ChanUserContainer *, const Anope::string &) { }
+	virtual void OnPrivmsg(User *, Channel *, Anope::string &, const Anope::map<Anope::string> &) { }
+	virtual void OnDelChan(ChannelInfo *) { }
+	virtual void OnChanDrop(CommandSource &, ChannelInfo *) { }
+	virtual void OnModuleLoad(User *, Module *) { }
+	virtual void OnShutdown() { }
+	virtual void OnRestart() { }
+	virtual void OnReloadConfig() { }
+};
+
+/** Timers only fire when a harness calls TimerManager::TickTimers(). */
+class Timer
+{
+	time_t secs;
+	bool repeat;
+	time_t trigger;
+
+public:
+	static std::set<Timer *> &All()
+	{
+		static std::set<Timer *> timers;
+		return timers;
+	}
+
+	Timer(Module *, time_t seconds, bool rep = true) : Timer(seconds, rep) { }
+	Timer(time_t seconds, bool rep = true) : secs(seconds), repeat(rep), trigger(Anope::CurTime + seconds) { All().insert(this); }
+	virtual ~Timer() { All().erase(this); }
+	virtual void Tick() = 0;
+	void SetSecs(time_t seconds) { secs = seconds; trigger = Anope::CurTime + seconds; }
+	time_t GetSecs() const { return secs; }
+	Module *GetOwner() const { return nullptr; }
+	bool GetRepeat() const { return repeat; }
+
+	/** Runs the timer if it is due. Returns false once a one-shot timer has deleted itself. */
+	bool Check(time_t now)
+	{
+		if (now < trigger)
+			return true;
+		Tick();
+		if (!repeat)
+		{
+			delete this;
+			return false;
+		}
+		trigger = now + secs;
+		return true;
+	}
+};
+
+namespace TimerManager
+{
+	inline void TickTimers(time_t now)
+	{
+		const std::set<Timer *> timers = Timer::All();
+		for (Timer *t : timers)
+		{
+			if (Timer::All().count(t))
+				t->Check(now);
+		}
+	}
+}
+
+class Service
+{
+public:
+	Module *owner;
+	Service(Module *o, const Anope::string &, const Anope::string &) : owner(o) { }
+	virtual ~Service() = default;
+};
+
+/** Every reference of a type resolves to the one instance the harness registers. */
+template<typename T> class ServiceReference
+{
+public:
+	static T *&Default()
+	{
+		static T *instance = nullptr;
+		return instance;
+	}
+
+	ServiceReference() = default;
+	ServiceReference(const Anope::string &, const Anope::string &) { }
+	operator bool() const { return Default(); }
+	T *operator->() { return Default(); }
+	T *operator*() { return Default(); }
+};
+
+class ExtensibleBase
+{
+public:
+	static std::map<Anope::string, ExtensibleBase *> &Items()
+	{
+		static std::map<Anope::string, ExtensibleBase *> items;
+		return items;
+	}
+
+	const Anope::string name;
+
+	ExtensibleBase(const Anope::string &n) : name(n) { Items()[name] = this; }
+	virtual ~ExtensibleBase() { Items().erase(name); }
+	virtual bool Has(const Extensible *obj) const = 0;
+
+	static ExtensibleBase *Find(const Anope::string &name)
+	{
+		auto it = Items().find(name);
+		return it == Items().end() ? nullptr : it->second;
+	}
+};
+
+template<typename T> class ExtensibleItem : public ExtensibleBase
+{
+	std::map<const Extensible *, T> items;
+
+public:
+	ExtensibleItem(Module *, const Anope::string &n) : ExtensibleBase(n) { }
+	bool Has(const Extensible *obj) const override { return HasExt(obj); }
+
+	T *Get(const Extensible *obj) const
+	{
+		auto it = items.find(obj);
+		return it == items.end() ? nullptr : const_cast<T *>(&it->second);
+	}
+
+	/** Like Anope's, an item that can be built from its owner is. */
+	T *Set(Extensible *obj)
+	{
+		if constexpr (std::is_constructible_v<T, Extensible *>)
+			return &items.try_emplace(obj, obj).first->second;
+		else
+			return &items[obj];
+	}
+	T *Require(Extensible *obj) { return Set(obj); }
+	void Unset(Extensible *obj) { items.erase(obj); }
+	bool HasExt(const Extensible *obj) const { return items.count(obj); }
+};
+
+template<typename T> T *Extensible::GetExt(const Anope::string &name) const
+{
+	auto *item = dynamic_cast<ExtensibleItem<T> *>(ExtensibleBase::Find(name));
+	return item ? item->Get(this) : nullptr;
+}
+
+template<typename T> T *Extensible::Extend(const Anope::string &name)
+{
+	auto *item = dynamic_cast<ExtensibleItem<T> *>(ExtensibleBase::Find(name));
+	return item ? item->Set(this) : nullptr;
+}
+
+template<typename T> void Extensible::Shrink(const Anope::string &name)
+{
+	auto *item = dynamic_cast<ExtensibleItem<T> *>(ExtensibleBase::Find(name));
+	if (item)
+		item->Unset(this);
+}
+
+inline bool Extensible::HasExt(const Anope::string &name) const
+{
+	const ExtensibleBase *item = ExtensibleBase::Find(name);
+	return item && item->Has(this);
+}
+
+template<typename T> class SerializableExtensibleItem : public ExtensibleItem<T>
+{
+public:
+	SerializableExtensibleItem(Module *m, const Anope::string &n) : ExtensibleItem<T>(m, n) { }
+};
+
+template<typename T> class PrimitiveExtensibleItem : public ExtensibleItem<T>
+{
+public:
+	PrimitiveExtensibleItem(Module *m, const Anope::string &n) : ExtensibleItem<T>(m, n) { }
+};
+
+class IRCDProto
+{
+public:
+	virtual ~IRCDProto() = default;
+	void SendPrivmsg(BotInfo *, const Anope::string &, const Anope::string &) { }
+	void SendNotice(BotInfo *, const Anope::string &, const Anope::string &) { }
+	bool IsChannelValid(const Anope::string &chan) { return !chan.empty() && chan[0] == '#'; }
+	bool IsNickValid(const Anope::string &nick) { return !nick.empty(); }
+};
+inline IRCDProto *IRCD = nullptr;
+
+struct ConfigT
+{
+	Configuration::Block block;
+	Configuration::Block &GetModule(Module *) { return block; }
+	Configuration::Block &GetModule(const Anope::string &) { return block; }
+	BotInfo *GetClient(const Anope::string &) { return nullptr; }
+};
+inline ConfigT *Config = nullptr;
+
+#define FOREACH_RESULT(ev, ret, args) ret = EVENT_CONTINUE
+#define FOREACH_MOD(ev, args) do { } while (0)
+#define MODULE_INIT(x) x *harness_module_instance = nullptr;
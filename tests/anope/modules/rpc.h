@@ -0,0 +1,84 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Stand-in for Anope's modules/rpc.h, used by the programs in tests/.
+// Replies are accepted and discarded.
+
+#pragma once
+
+#include "module.h"
+
+namespace HTTP
+{
+	struct Reply { };
+
+	class Client : public Extensible
+	{
+	public:
+		void SendReply(Reply *) { }
+	};
+}
+
+namespace RPC
+{
+	enum
+	{
+		ERR_CUSTOM_END = -32000,
+		ERR_CUSTOM_START = -32099,
+		ERR_PARSE_ERROR = -32700,
+		ERR_INVALID_REQUEST = -32600,
+		ERR_METHOD_NOT_FOUND = -32601,
+		ERR_INVALID_PARAMS = -32602,
+		ERR_INTERNAL_ERROR = -32603
+	};
+
+	class Array;
+
+	class Map
+	{
+	public:
+		template<typename T> Map &Reply(const Anope::string &, const T &) { return *this; }
+		Map &ReplyMap(const Anope::string &);
+		Array &ReplyArray(const Anope::string &);
+	};
+
+	class Array
+	{
+	public:
+		template<typename T> Array &Reply(const T &) { return *this; }
+		Map &ReplyMap() { static Map m; return m; }
+		Array &ReplyArray() { return *this; }
+	};
+
+	inline Map &Map::ReplyMap(const Anope::string &) { return *this; }
+	inline Array &Map::ReplyArray(const Anope::string &) { static Array a; return a; }
+
+	class Request
+	{
+	public:
+		HTTP::Reply &reply;
+		Anope::string id, name;
+		std::vector<Anope::string> data;
+
+		Request(HTTP::Reply &r) : reply(r) { }
+		Request(const Request &) = default;
+		void Error(int64_t, const Anope::string &) { }
+		template<typename T = Map> T &Root() { static T root; return root; }
+	};
+
+	class ServiceInterface
+	{
+	public:
+		virtual ~ServiceInterface() = default;
+		virtual void Reply(Request &) = 0;
+	};
+
+	class Event
+	{
+	public:
+		Event(Module *, const Anope::string &, size_t = 0) { }
+		virtual ~Event() = default;
+		virtual bool Run(ServiceInterface *, HTTP::Client *, Request &) = 0;
+	};
+}
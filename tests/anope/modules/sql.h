@@ -0,0 +1,92 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Stand-in for Anope's modules/sql.h, used by the programs in tests/.
+// Queries are not run anywhere; a harness registers its own SQL::Provider.
+
+#pragma once
+
+#include "module.h"
+
+namespace SQL
+{
+	struct QueryData final
+	{
+		Anope::string data;
+		bool escape = true;
+	};
+
+	struct Query final
+	{
+		Anope::string query;
+		std::map<Anope::string, QueryData> parameters;
+
+		Query() = default;
+		Query(const Anope::string &q) : query(q) { }
+
+		Query &operator=(const Anope::string &q)
+		{
+			query = q;
+			parameters.clear();
+			return *this;
+		}
+
+		template<typename T> void SetValue(const Anope::string &key, const T &value, bool escape = true)
+		{
+			parameters[key] = { Anope::ToString(value), escape };
+		}
+	};
+
+	class Result
+	{
+	protected:
+		std::vector<std::map<Anope::string, Anope::string>> entries;
+		Query query;
+		Anope::string error;
+
+	public:
+		unsigned int id = 0;
+		Anope::string finished_query;
+
+		Result() = default;
+		Result(unsigned int i, const Query &q, const Anope::string &fq, const Anope::string &err = "")
+			: query(q), error(err), id(i), finished_query(fq)
+		{
+		}
+
+		operator bool() const { return error.empty(); }
+		unsigned int GetID() const { return id; }
+		const Query &GetQuery() const { return query; }
+		const Anope::string &GetError() const { return error; }
+		int Rows() const { return static_cast<int>(entries.size()); }
+		const std::map<Anope::string, Anope::string> &Row(size_t index) const { return entries[index]; }
+
+		const Anope::string Get(size_t index, const Anope::string &col) const
+		{
+			auto it = entries[index].find(col);
+			return it == entries[index].end() ? "" : it->second;
+		}
+
+		void AddRow(const std::map<Anope::string, Anope::string> &row) { entries.push_back(row); }
+	};
+
+	class Interface
+	{
+	public:
+		Module *owner;
+		Interface(Module *m) : owner(m) { }
+		virtual ~Interface() = default;
+		virtual void OnResult(const Result &r) = 0;
+		virtual void OnError(const Result &r) = 0;
+	};
+
+	class Provider : public Service
+	{
+	public:
+		Provider(Module *c, const Anope::string &n) : Service(c, "SQL::Provider", n) { }
+		virtual void Run(Interface *i, const Query &query) = 0;
+		virtual Result RunQuery(const Query &query) = 0;
+		virtual Anope::string GetColumnType(int) { return "TEXT"; }
+	};
+}
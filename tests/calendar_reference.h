@@ -0,0 +1,70 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Brute-force local calendar used by the period start checks. It asks
+// localtime_r() for the local date of every sampled instant and walks to the
+// week and month start in UTC, where every day is 86400 seconds long.
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+
+namespace CalendarReference
+{
+	/** Zones with DST at midnight (Sao_Paulo until 2019, Havana, Beirut), a
+	 * 30 minute DST shift (Lord_Howe), a skipped day (Apia, 2011-12-30) and
+	 * the usual European and US rules.
+	 */
+	static const char *const zones[] = {
+		"UTC", "America/New_York", "Europe/London", "America/Sao_Paulo", "America/Havana",
+		"Asia/Beirut", "Australia/Lord_Howe", "Pacific/Apia",
+	};
+
+	/** 2011-01-01 to 2020-01-01 UTC, sampled every ten minutes. */
+	static const time_t first = 1293840000;
+	static const time_t last = 1577836800;
+	static const time_t step = 600;
+
+	inline void SetZone(const char *zone)
+	{
+		setenv("TZ", zone, 1);
+		tzset();
+	}
+
+	inline std::string Format(int year, int month, int day)
+	{
+		char buf[40];
+		snprintf(buf, sizeof(buf), "%04d-%02d-%02d", year, month, day);
+		return buf;
+	}
+
+	struct Starts final
+	{
+		std::string day, week, month;
+	};
+
+	inline Starts For(time_t t)
+	{
+		std::tm local;
+		localtime_r(&t, &local);
+
+		Starts s;
+		s.day = Format(local.tm_year + 1900, local.tm_mon + 1, local.tm_mday);
+		s.month = Format(local.tm_year + 1900, local.tm_mon + 1, 1);
+
+		std::tm noon = { };
+		noon.tm_year = local.tm_year;
+		noon.tm_mon = local.tm_mon;
+		noon.tm_mday = local.tm_mday;
+		noon.tm_hour = 12;
+		const time_t monday = timegm(&noon) - 86400 * ((local.tm_wday + 6) % 7);
+		std::tm week;
+		gmtime_r(&monday, &week);
+		s.week = Format(week.tm_year + 1900, week.tm_mon + 1, week.tm_mday);
+		return s;
+	}
+}
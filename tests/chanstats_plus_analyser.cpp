@@ -0,0 +1,181 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Checks chanstats_plus's single-pass MessageAnalyser against the per-token
+// find() loops it replaced, then times both.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Itests/anope tests/chanstats_plus_analyser.cpp -o analyser && ./analyser [messages [log]]
+//
+// Exits non-zero if any of the random messages is counted differently. The
+// timing replays log, one message per line (the text as sent, without
+// timestamps or nicks), or otherwise 65536 lines of synthetic chat, so
+// neither side is timed on one line the branch predictor has learnt.
+
+#include "../chanstats_plus.cpp"
+#include "chat_traffic.h"
+
+#include <chrono>
+#include <fstream>
+#include <random>
+
+namespace
+{
+	/** Word count the way chanstats_plus did it before the analyser: std::isspace per byte. */
+	size_t OldCountWords(const Anope::string &msg)
+	{
+		bool in_word = false;
+		size_t words = 0;
+		for (const unsigned char c : msg)
+		{
+			if (std::isspace(c))
+			{
+				in_word = false;
+				continue;
+			}
+			if (!in_word)
+			{
+				in_word = true;
+				words++;
+			}
+		}
+		return words;
+	}
+
+	/** Smiley count the way chanstats_plus did it before the analyser: tokenise the list, find() each token. */
+	size_t OldCountSmileys(const Anope::string &msg, const Anope::string &smileylist)
+	{
+		size_t smileys = 0;
+		spacesepstream sep(smileylist);
+		Anope::string token;
+		while (sep.GetToken(token) && !token.empty())
+		{
+			for (size_t pos = msg.find(token, 0); pos != Anope::string::npos; pos = msg.find(token, pos + 1))
+				smileys++;
+		}
+		return smileys;
+	}
+
+	struct SmileyLists final
+	{
+		Anope::string config[SMILEY_KINDS];
+		std::vector<Anope::string> tokens[SMILEY_KINDS];
+
+		SmileyLists(const char *happy, const char *sad, const char *other)
+		{
+			const char *lists[SMILEY_KINDS] = { happy, sad, other };
+			for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+			{
+				config[kind] = lists[kind];
+				spacesepstream sep(config[kind]);
+				for (Anope::string token; sep.GetToken(token);)
+					tokens[kind].push_back(token);
+			}
+		}
+	};
+
+	bool Check(const SmileyLists &lists, const MessageAnalyser &analyser, const Anope::string &msg)
+	{
+		MessageCounts counts;
+		analyser.Analyse(std::string_view(msg.data(), msg.length()), counts);
+
+		bool ok = counts.letters == msg.length() && counts.words == OldCountWords(msg);
+		for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+			ok = ok && counts.smileys[kind] == OldCountSmileys(msg, lists.config[kind]);
+		if (!ok)
+			std::cout << "MISMATCH on \"" << msg << "\"" << std::endl;
+		return ok;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	const unsigned messages = argc > 1 ? std::atoi(argv[1]) : 200000;
+	unsigned failures = 0;
+
+	// Overlapping tokens, a token that is a suffix of another, a token listed
+	// twice and one that is a single byte also used as punctuation.
+	const SmileyLists lists(":) :-) :D )", ":( :-( :(", ";) ;-) -");
+	MessageAnalyser analyser;
+	analyser.Build(lists.tokens);
+
+	std::mt19937 rng(1);
+	const char alphabet[] = ":-();D) \t\n\v\f\rab\x01\xff";
+	for (unsigned i = 0; i < messages; ++i)
+	{
+		Anope::string msg;
+		const size_t len = rng() % 40;
+		for (size_t j = 0; j < len; ++j)
+			msg += alphabet[rng() % (sizeof(alphabet) - 1)];
+		failures += !Check(lists, analyser, msg);
+	}
+
+	// No smileys configured at all.
+	const SmileyLists none("", "", "");
+	MessageAnalyser empty;
+	empty.Build(none.tokens);
+	failures += !Check(none, empty, "hi :) there");
+	failures += !Check(none, empty, "");
+
+	std::cout << messages + 2 << " messages checked, " << failures << " mismatches" << std::endl;
+	if (failures)
+		return 1;
+
+	std::vector<Anope::string> corpus;
+	if (argc > 2)
+	{
+		std::ifstream log(argv[2]);
+		for (std::string line; std::getline(log, line);)
+		{
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			corpus.emplace_back(line);
+		}
+		if (corpus.empty())
+		{
+			std::cerr << "no messages in " << argv[2] << std::endl;
+			return 1;
+		}
+	}
+	else
+		corpus = Traffic(5, 65536).pool;
+
+	// Time the corpus with the default smiley lists, about a million messages each.
+	const SmileyLists defaults(":) :-) :D", ":( :-(", ";) ;-)");
+	MessageAnalyser fast;
+	fast.Build(defaults.tokens);
+	const size_t passes = std::max<size_t>(1, 1000000 / corpus.size());
+	const size_t iterations = passes * corpus.size();
+	uint64_t sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t pass = 0; pass < passes; ++pass)
+	{
+		for (const auto &line : corpus)
+		{
+			const Anope::string copy = line;
+			sink += OldCountWords(copy);
+			for (size_t kind = 0; kind < SMILEY_KINDS; ++kind)
+				sink += OldCountSmileys(copy, defaults.config[kind]);
+		}
+	}
+	const double old_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	start = std::chrono::steady_clock::now();
+	for (size_t pass = 0; pass < passes; ++pass)
+	{
+		for (const auto &line : corpus)
+		{
+			MessageCounts counts;
+			fast.Analyse(std::string_view(line.data(), line.length()), counts);
+			sink += counts.words + counts.smileys[SMILEY_HAPPY];
+		}
+	}
+	const double new_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+	std::cout << "Timed " << iterations << " messages (" << corpus.size() << " lines)" << std::endl;
+	std::cout << "find() loops: " << old_ns << " ns/message" << std::endl;
+	std::cout << "analyser:     " << new_ns << " ns/message (" << sink << ")" << std::endl;
+	return 0;
+}
@@ -0,0 +1,205 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Replays synthetic channel traffic through chanstats_plus (OnPrivmsg and the
+// flush timers) against a fake SQL provider that counts and then completes
+// every query, and reports messages/s, heap allocations per message, peak
+// buffered entries and the SQL generated per flush.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Itests/anope tests/chanstats_plus_bench.cpp -o bench && ./bench [messages [channels [speakers [smiley% [rate]]]]]
+//
+// Defaults: 200000 messages, 20 channels, 500 speakers, 5% smileys, at 500
+// messages per simulated second with a 10 ms SQL round trip. Much above that
+// rate the default maxinflight/maxrowsperquery cannot keep up and most of the
+// time goes into parking batches in the journal. The journal and speaker sketches go to a
+// temporary directory that is removed afterwards.
+
+#include "../chanstats_plus.cpp"
+#include "chat_traffic.h"
+
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	// Heap allocations while counting is on; the global operator new below bumps it.
+	bool counting_allocations = false;
+	uint64_t allocations = 0;
+
+	/** Records every query and completes it with an empty result when the
+	 * harness calls Complete(), like a server one round trip away.
+	 */
+	class CountingProvider final
+		: public SQL::Provider
+	{
+		std::vector<std::pair<SQL::Interface *, SQL::Query>> queued;
+
+	public:
+		uint64_t queries = 0;
+		uint64_t sync_queries = 0;
+		uint64_t bytes = 0;
+
+		CountingProvider()
+			: SQL::Provider(nullptr, "bench")
+		{
+		}
+
+		void Run(SQL::Interface *i, const SQL::Query &q) override
+		{
+			Count(q);
+			queued.emplace_back(i, q);
+		}
+
+		SQL::Result RunQuery(const SQL::Query &q) override
+		{
+			Count(q);
+			sync_queries++;
+			return SQL::Result(0, q, q.query);
+		}
+
+		void Complete()
+		{
+			std::vector<std::pair<SQL::Interface *, SQL::Query>> done;
+			done.swap(queued);
+			for (auto &[i, q] : done)
+				i->OnResult(SQL::Result(0, q, q.query));
+		}
+
+	private:
+		void Count(const SQL::Query &q)
+		{
+			queries++;
+			bytes += q.query.length();
+			for (const auto &[name, value] : q.parameters)
+				bytes += value.data.length();
+		}
+	};
+}
+
+void *operator new(size_t size)
+{
+	if (counting_allocations)
+		allocations++;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+// Out of line, or GCC sees free() on memory from operator new and warns
+// -Wmismatched-new-delete even though both sides are the ones above.
+[[gnu::noinline]] void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+[[gnu::noinline]] void operator delete(void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p) noexcept
+{
+	std::free(p);
+}
+
+[[gnu::noinline]] void operator delete[](void *p, size_t) noexcept
+{
+	std::free(p);
+}
+
+int main(int argc, char **argv)
+{
+	const size_t messages = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 200000;
+	const size_t channels = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 20;
+	const size_t speakers = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 500;
+	const unsigned smiley_percent = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 5;
+	const size_t per_second = argc > 5 ? std::strtoull(argv[5], nullptr, 10) : 500;
+	const size_t per_round_trip = std::max<size_t>(1, per_second / 100);
+	if (!messages || !channels || !speakers || smiley_percent > 100 || !per_second)
+	{
+		std::cerr << "usage: " << argv[0] << " [messages [channels [speakers [smiley% [rate]]]]]" << std::endl;
+		return 1;
+	}
+
+	char dir[] = "/tmp/chanstats_plus_bench.XXXXXX";
+	if (!mkdtemp(dir))
+	{
+		std::cerr << "cannot create a temporary directory" << std::endl;
+		return 1;
+	}
+	Anope::DataDir = dir;
+	Anope::CurTime = 1700000000;
+
+	CountingProvider provider;
+	ServiceReference<SQL::Provider>::Default() = &provider;
+
+	auto *module = new MChanstatsPlus("chanstats_plus", "");
+	Configuration::Conf conf;
+	conf.module.Set("engine", "mysql/bench");
+	module->OnReload(conf);
+	provider.Complete();
+
+	std::vector<ChannelInfo> infos(channels);
+	std::vector<Channel> chans(channels);
+	for (size_t i = 0; i < channels; ++i)
+	{
+		infos[i].name = chans[i].name = "#bench" + Anope::ToString(i);
+		chans[i].ci = &infos[i];
+		infos[i].Extend<bool>(EXT_CS_STATS);
+	}
+
+	// Everyone is identified and opted in, so every message also writes a per-nick row.
+	std::vector<NickCore> accounts(speakers);
+	std::vector<User> users(speakers);
+	for (size_t i = 0; i < speakers; ++i)
+	{
+		accounts[i].display = users[i].nick = "bench" + Anope::ToString(i);
+		accounts[i].Extend<bool>(EXT_NS_STATS);
+		users[i].account = &accounts[i];
+	}
+
+	Traffic traffic(smiley_percent);
+	const uint64_t queries_before = provider.queries, bytes_before = provider.bytes;
+	Anope::string msg;
+
+	counting_allocations = true;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < messages; ++i)
+	{
+		// Skewed towards low ids, like real channels where a few people do most of the talking.
+		const uint64_t r = traffic.Next();
+		const size_t speaker = r % (1 + (r >> 32) % speakers);
+		msg = traffic.pool[i % traffic.pool.size()];
+		module->OnPrivmsg(&users[speaker], &chans[(r >> 16) % channels], msg, {});
+
+		if ((i + 1) % per_round_trip == 0)
+			provider.Complete();
+		if ((i + 1) % per_second == 0)
+		{
+			Anope::CurTime++;
+			TimerManager::TickTimers(Anope::CurTime);
+		}
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	counting_allocations = false;
+
+	const auto us = std::max<int64_t>(1, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+	std::cout << "Replayed " << messages << " messages over " << channels << " channels and " << speakers << " speakers in "
+		<< us / 1000 << " ms: " << messages * 1000000ULL / us << " messages/s, " << us * 1000 / messages << " ns/message" << std::endl;
+	std::cout << "Heap allocations: " << allocations << " (" << static_cast<double>(allocations) / messages << " per message)" << std::endl;
+	std::cout << "SQL: " << provider.queries - queries_before << " queries, " << provider.bytes - bytes_before << " bytes" << std::endl;
+
+	CommandSource source;
+	module->SendStats(source);
+
+	delete module;
+	std::filesystem::remove_all(dir);
+	return 0;
+}
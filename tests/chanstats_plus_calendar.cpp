@@ -0,0 +1,69 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Checks the day, week and month a chanstats_plus row is written under
+// (LocalDay, StartOfWeek, StartOfMonth, FormatDays) against a brute-force
+// local calendar, across DST changes and month/year rollovers in several
+// time zones.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Itests/anope tests/chanstats_plus_calendar.cpp -o calendar && ./calendar
+//
+// Exits non-zero on the first zone with a mismatch. Needs the system zoneinfo
+// database; a missing zone silently behaves like UTC.
+
+#include "../chanstats_plus.cpp"
+#include "calendar_reference.h"
+
+#include <random>
+
+namespace
+{
+	unsigned CheckZone(const char *zone)
+	{
+		CalendarReference::SetZone(zone);
+		unsigned failures = 0;
+
+		auto check = [&](LocalDay &local_day, time_t t)
+		{
+			const int32_t day = local_day.Get(t);
+			const CalendarReference::Starts want = CalendarReference::For(t);
+			const Anope::string got_day = FormatDays(day), got_week = FormatDays(StartOfWeek(day)),
+				got_month = FormatDays(StartOfMonth(day));
+			if (got_day.str() == want.day && got_week.str() == want.week && got_month.str() == want.month)
+				return;
+
+			if (failures++ < 5)
+			{
+				std::cout << zone << " " << t << ": got " << got_day << " " << got_week << " " << got_month
+					<< ", want " << want.day << " " << want.week << " " << want.month << std::endl;
+			}
+		};
+
+		// In order, the way the clock normally moves, so the cached day is reused.
+		LocalDay sequential;
+		for (time_t t = CalendarReference::first; t < CalendarReference::last; t += CalendarReference::step)
+			check(sequential, t);
+
+		// Random jumps in both directions, so the cache is rebuilt from anywhere.
+		LocalDay jumping;
+		std::mt19937 rng(27);
+		for (int i = 0; i < 200000; ++i)
+			check(jumping, CalendarReference::first + static_cast<time_t>(rng() % (CalendarReference::last - CalendarReference::first)));
+
+		return failures;
+	}
+}
+
+int main()
+{
+	unsigned failures = 0;
+	for (const char *zone : CalendarReference::zones)
+	{
+		const unsigned zone_failures = CheckZone(zone);
+		std::cout << zone << ": " << zone_failures << " mismatches" << std::endl;
+		failures += zone_failures;
+	}
+	return failures ? 1 : 0;
+}
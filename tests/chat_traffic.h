@@ -0,0 +1,59 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Synthetic channel chat shared by the chanstats_plus analyser and replay
+// benchmarks: messages of 1 to 24 common words with some smileys and CTCP
+// ACTIONs, from a fixed seed so runs are comparable.
+
+#pragma once
+
+#include "module.h"
+
+#include <cstdint>
+#include <vector>
+
+/** The generator the old in-module BENCH used, so figures stay comparable. */
+class Traffic final
+{
+	uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+public:
+	std::vector<Anope::string> pool;
+
+	// xorshift64*; deterministic so runs are comparable.
+	uint64_t Next()
+	{
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545f4914f6cdd1dULL;
+	}
+
+	/** A pool of messages of 1 to 24 words, so generation isn't timed. */
+	Traffic(unsigned smiley_percent, size_t pool_size = 1024)
+		: pool(pool_size)
+	{
+		static const char *const words[] = {
+			"the", "a", "to", "and", "is", "it", "you", "that", "lol", "on", "for", "this",
+			"anyone", "know", "how", "services", "channel", "working", "again", "yes", "no", "maybe",
+		};
+		static const char *const smiley_tokens[] = { ":)", ":(", ";)", ":D" };
+
+		for (auto &msg : pool)
+		{
+			const size_t count = 1 + Next() % 24;
+			for (size_t w = 0; w < count; ++w)
+			{
+				if (w)
+					msg += " ";
+				if (Next() % 100 < smiley_percent)
+					msg += smiley_tokens[Next() % 4];
+				else
+					msg += words[Next() % (sizeof(words) / sizeof(*words))];
+			}
+			if (Next() % 16 == 0)
+				msg = "\001ACTION " + msg + "\001";
+		}
+	}
+};
@@ -0,0 +1,228 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Checks cs_topichistory's TopicHistoryList (the delta-encoded ring, its topic
+// and word indexes, and the record it is stored as) against a plain
+// std::deque of full topics.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Itests/anope tests/cs_topichistory_list.cpp -o cs_topichistory_list && ./cs_topichistory_list [steps]
+//
+// Every step sets a topic the way OnTopicUpdated does: a repeated topic is
+// erased from wherever it is and pushed to the front again. Topics are drawn
+// from a few words so that repeats are common at the head, in the middle and
+// at the oldest entry, and neighbours share starts and ends. After each step
+// the list, Find(), Search() and an Encode() -> Decode() copy must match the
+// deque. With a full ring every push evicts, so the word index is rebuilt
+// many times over a run. A last run with bursts of topics over 1 KiB checks
+// that the oldest are dropped once the record would pass 64 KiB, and that the
+// ring still grows correctly after it has wrapped around. Prints the first
+// mismatch and exits non-zero if there was any.
+
+#include "../cs_topichistory.cpp"
+
+#include <random>
+
+namespace
+{
+	const char *const vocabulary[] = { "welcome", "to", "the", "meeting", "is", "at", "5pm", "release", "1.2", "\002bold\002", "|", "12 x" };
+
+	class Checker final
+	{
+		ChannelInfo ci;
+		std::deque<TopicHistoryEntry> expected;
+		size_t expected_bytes = 0;
+		std::mt19937 rng;
+		const bool long_topics;
+		size_t topics = 0;
+
+	public:
+		TopicHistoryList list;
+		unsigned failures = 0;
+		/* Repeats erased at the head, in the middle and at the oldest entry */
+		size_t repeats[3] = { };
+
+		Checker(unsigned seed, bool l)
+			: rng(seed)
+			, long_topics(l)
+			, list((ci.name = "#test", &ci))
+		{
+		}
+
+		Anope::string RandomTopic()
+		{
+			Anope::string topic = "Welcome to #test | ";
+			// Alternately 200 topics of 1-1.5 KiB, which wrap the ring early, and 200 short ones, which grow it again
+			if (long_topics && (topics++ / 200) % 2)
+				topic += Anope::string(1000 + rng() % 500, '=') + " ";
+			const size_t words = 1 + rng() % 3;
+			for (size_t i = 0; i < words; ++i)
+				topic += Anope::string(i ? " " : "") + vocabulary[rng() % (sizeof(vocabulary) / sizeof(*vocabulary))];
+			return topic;
+		}
+
+		/* Length of the entry and the space after it in the record */
+		static size_t RecordBytes(const TopicHistoryEntry &entry)
+		{
+			return (Anope::ToString(entry.when) + " " + entry.setter + " " + Anope::ToString(entry.topic.length()) + " " + entry.topic + " ").length();
+		}
+
+		void Drop()
+		{
+			expected_bytes -= RecordBytes(expected.back());
+			expected.pop_back();
+		}
+
+		void Set(const Anope::string &topic, time_t when)
+		{
+			const Anope::string setter = "nick" + Anope::ToString(rng() % 5);
+			auto it = std::find_if(expected.begin(), expected.end(), [&](const auto &entry) { return entry.topic == topic; });
+			if (it != expected.end())
+			{
+				const size_t pos = it - expected.begin();
+				++repeats[pos == 0 ? 0 : pos + 1 == expected.size() ? 2 : 1];
+				expected_bytes -= RecordBytes(*it);
+				expected.erase(it);
+			}
+			expected.push_front({ topic, setter, when });
+			expected_bytes += RecordBytes(expected.front());
+			if (expected.size() > maxhistory + 1)
+				Drop();
+			while (expected_bytes > MAX_RECORD_BYTES)
+				Drop();
+
+			const int dup = list.Find(topic);
+			if (dup >= 0)
+				list.Erase(dup);
+			list.PushFront(topic, setter, when);
+		}
+
+		/* A maxhistory change on reload takes effect on the next push */
+		void Resize(unsigned newmax)
+		{
+			maxhistory = newmax;
+			while (expected.size() > maxhistory + 1)
+				Drop();
+		}
+
+		void Fail(const char *what, size_t step)
+		{
+			if (!failures++)
+				std::cout << "MISMATCH in " << what << " at step " << step << " (maxhistory " << maxhistory << ")" << std::endl;
+		}
+
+		static bool Same(const std::vector<TopicHistoryEntry> &got, const std::deque<TopicHistoryEntry> &want)
+		{
+			if (got.size() != want.size())
+				return false;
+			for (size_t i = 0; i < got.size(); ++i)
+			{
+				if (got[i].topic != want[i].topic || got[i].setter != want[i].setter || got[i].when != want[i].when)
+					return false;
+			}
+			return true;
+		}
+
+		void Check(size_t step)
+		{
+			if (list.size() != expected.size() || !Same(list.List(), expected))
+				Fail("List()", step);
+
+			// The head, the oldest and a few others, as every one of 500 entries would take too long
+			for (size_t i : { size_t(0), expected.size() - 1, rng() % expected.size(), rng() % expected.size() })
+			{
+				if (list.Find(expected[i].topic) != static_cast<int>(i))
+					Fail("Find()", step);
+			}
+			if (list.Find("not a topic") != -1)
+				Fail("Find() of a missing topic", step);
+
+			// The words after the common start, sometimes with one that is never used
+			std::vector<Anope::string> query = TopicWords(RandomTopic());
+			query.erase(query.begin(), query.begin() + 3);
+			if (query.empty())
+				query.push_back("welcome");
+			if (rng() % 10 == 0)
+				query.push_back("nowhere");
+			std::vector<size_t> want;
+			for (size_t i = 0; i < expected.size(); ++i)
+			{
+				const std::vector<Anope::string> topicwords = TopicWords(expected[i].topic);
+				bool all = true;
+				for (const auto &word : query)
+					all = all && std::find(topicwords.begin(), topicwords.end(), word) != topicwords.end();
+				if (all)
+					want.push_back(i);
+			}
+			std::vector<size_t> got;
+			for (const auto &[pos, entry] : list.Search(query))
+			{
+				got.push_back(pos);
+				if (entry.topic != expected[pos].topic)
+					Fail("Search() topic", step);
+			}
+			if (got != want)
+				Fail("Search()", step);
+
+			ChannelInfo copyci;
+			copyci.name = "#copy";
+			TopicHistoryList copy(&copyci);
+			const Anope::string record = list.Encode();
+			if (record.length() > MAX_RECORD_BYTES)
+				Fail("Encode() length", step);
+			copy.Decode(record);
+			if (!Same(copy.List(), expected))
+				Fail("Encode() -> Decode()", step);
+		}
+	};
+}
+
+int main(int argc, char **argv)
+{
+	const size_t steps = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 5000;
+	unsigned failures = 0;
+	time_t when = 1700000000;
+
+	for (unsigned max : { 1u, 3u, 10u, 500u, 501u })
+	{
+		// 501 is 500 again, with topics too long for 500 of them to fit the record
+		const unsigned configured = std::min(max, 500u);
+		maxhistory = configured;
+		Checker checker(max, max > 500);
+
+		// Repeats of the head, a middle entry and the oldest, in a full ring
+		for (const char *topic : { "a", "b", "c", "d", "e", "e", "c", "b" })
+			checker.Set(topic, ++when);
+		checker.Check(0);
+
+		for (size_t step = 1; step <= steps; ++step)
+		{
+			// Resize the ring half way through, as a reload would
+			if (step == steps / 2)
+				checker.Resize(max > 1 ? max / 2 : 2);
+			checker.Set(checker.RandomTopic(), ++when);
+			checker.Check(step);
+		}
+
+		std::cout << "maxhistory " << configured << (max > 500 ? " (long topics)" : "") << ": " << steps << " steps, repeats at head/middle/oldest "
+			<< checker.repeats[0] << "/" << checker.repeats[1] << "/" << checker.repeats[2] << ", " << checker.list.size() << " topics kept in " << checker.list.Bytes() << " bytes" << std::endl;
+		failures += checker.failures;
+	}
+
+	// The ring only takes the slots it uses
+	maxhistory = 500;
+	ChannelInfo ci;
+	ci.name = "#small";
+	TopicHistoryList small(&ci);
+	small.PushFront("only topic", "nick", when);
+	std::cout << "One topic with maxhistory 500: " << small.Bytes() << " bytes" << std::endl;
+	if (small.Bytes() > 1024)
+	{
+		std::cout << "A one-topic list takes the space of the full ring" << std::endl;
+		++failures;
+	}
+
+	std::cout << failures << " mismatches" << std::endl;
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+# SPDX-License-Identifier: GPL-2.0-only
+#
+# Builds diceserv_eval.cpp against two revisions of DiceServ/diceserv.cpp,
+# checks that both give the same output for the same random expressions and
+# RNG seeds, and prints the evaluation speed of each.
+#
+# Usage, from anywhere in the repository:
+#   tests/diceserv_compare.sh [old-rev [new-rev [count]]]
+#
+# new-rev may be "worktree" for the checked-out files. By default it compares
+# the commit that compiled expressions to flat instructions with its parent,
+# over 600000 expressions, which takes a few minutes. Exits non-zero if the
+# outputs differ. Revisions that change what a roll prints (different dice,
+# different limits) are expected to differ.
+
+set -e
+
+cd "$(git rev-parse --show-toplevel)"
+
+flat=$(git log -n 1 --format=%H --grep='compile expressions to flat instructions' -- DiceServ/diceserv.cpp)
+old=${1:-$flat^}
+new=${2:-$flat}
+count=${3:-600000}
+CXX=${CXX:-g++}
+
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+build()
+{
+	mkdir "$tmp/$1"
+	if [ "$2" = worktree ]; then
+		cp DiceServ/diceserv.cpp DiceServ/diceserv.h "$tmp/$1/"
+	else
+		git show "$2:DiceServ/diceserv.cpp" > "$tmp/$1/diceserv.cpp"
+		git show "$2:DiceServ/diceserv.h" > "$tmp/$1/diceserv.h"
+	fi
+	"$CXX" -std=c++17 -O2 -w -Itests/anope -DDICESERV_SOURCE="\"$tmp/$1/diceserv.cpp\"" tests/diceserv_eval.cpp -o "$tmp/$1/eval"
+}
+
+build old "$old"
+build new "$new"
+
+"$tmp/old/eval" dump "$count" > "$tmp/old.out"
+"$tmp/new/eval" dump "$count" > "$tmp/new.out"
+
+echo "old ($old):"
+"$tmp/old/eval" bench 200000
+echo "new ($new):"
+"$tmp/new/eval" bench 200000
+
+if cmp -s "$tmp/old.out" "$tmp/new.out"; then
+	echo "$count expressions: identical output"
+else
+	echo "$count expressions: output differs"
+	diff "$tmp/old.out" "$tmp/new.out" | head -n 20
+	exit 1
+fi
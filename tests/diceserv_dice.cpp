@@ -0,0 +1,101 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Checks that dSFMT216091::FillDice, which DiceServ throws its dice with,
+// stays within [1, sides] and gives every side the same chance, then
+// compares its throughput with one Random() call per die.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Itests/anope tests/diceserv_dice.cpp -o diceserv_dice && ./diceserv_dice
+//
+// Uniformity is a chi-square test per die size over at least 10 million
+// throws, with a fixed seed. It fails if a throw is out of range or the
+// statistic is more than 5 standard deviations from its mean, which a fair
+// die does far less often than once in a million runs.
+
+#include "../DiceServ/diceserv.cpp"
+
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	/** Throws count dice of the given size into a histogram and returns the
+	 * chi-square statistic as a z-score, or NaN if a throw was out of range.
+	 */
+	double UniformityZ(unsigned sides, size_t count, std::vector<unsigned> &buf)
+	{
+		std::vector<uint64_t> hist(sides + 1);
+		for (size_t done = 0; done < count;)
+		{
+			const size_t n = std::min(buf.size(), count - done);
+			sfmtRNG.FillDice(n, sides, buf.data());
+			for (size_t i = 0; i < n; ++i)
+			{
+				if (buf[i] < 1 || buf[i] > sides)
+				{
+					std::cout << "d" << sides << ": threw " << buf[i] << std::endl;
+					return NAN;
+				}
+				++hist[buf[i]];
+			}
+			done += n;
+		}
+
+		const double expected = static_cast<double>(count) / sides;
+		double chi = 0;
+		for (unsigned side = 1; side <= sides; ++side)
+			chi += (hist[side] - expected) * (hist[side] - expected) / expected;
+
+		// chi-square with sides - 1 degrees of freedom has that mean and twice that variance
+		const double df = sides - 1;
+		return (chi - df) / std::sqrt(2 * df);
+	}
+
+	void Throughput(unsigned sides, std::vector<unsigned> &buf)
+	{
+		const size_t count = size_t(1) << 24;
+		uint64_t sink = 0;
+
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; ++i)
+			sink += sfmtRNG.Random(1, sides);
+		const auto random = std::chrono::steady_clock::now();
+		for (size_t done = 0; done < count; done += buf.size())
+		{
+			sfmtRNG.FillDice(buf.size(), sides, buf.data());
+			sink += buf[0];
+		}
+		const auto fill = std::chrono::steady_clock::now();
+
+		const double random_secs = std::chrono::duration<double>(random - start).count();
+		const double fill_secs = std::chrono::duration<double>(fill - random).count();
+		printf("d%-6u Random %6.0f M/s, FillDice %6.0f M/s (%llu)\n", sides, count / random_secs / 1e6, count / fill_secs / 1e6,
+			static_cast<unsigned long long>(sink));
+	}
+}
+
+int main()
+{
+	sfmtRNG = dSFMT216091(11);
+	std::vector<unsigned> buf(1 << 20);
+
+	// Powers of two never reject, the others do; 99999 is DICE_MAX_SIDES.
+	static const unsigned sizes[] = { 2, 3, 6, 7, 20, 100, 1000, DICE_MAX_SIDES };
+	unsigned failures = 0;
+	for (unsigned sides : sizes)
+	{
+		const size_t count = std::max<size_t>(50 * size_t(sides), 10000000);
+		const double z = UniformityZ(sides, count, buf);
+		const bool ok = std::fabs(z) <= 5;
+		printf("d%-6u %zu throws, chi-square z = %+.2f%s\n", sides, count, z, ok ? "" : "  FAILED");
+		if (!ok)
+			++failures;
+	}
+
+	for (unsigned sides : { 6u, 20u, DICE_MAX_SIDES })
+		Throughput(sides, buf);
+
+	return failures ? 1 : 0;
+}
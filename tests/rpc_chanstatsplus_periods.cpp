@@ -0,0 +1,56 @@
+// Anope IRC Services module>
+//
+// SPDX-License-Identifier: GPL-2.0-only
+//
+// Checks the default period_start rpc_chanstatsplus answers with
+// (DefaultPeriodStart) against a brute-force local calendar, across DST
+// changes and month/year rollovers in several time zones. It has to match
+// what chanstats_plus writes; see chanstats_plus_calendar.cpp.
+//
+// Build and run from the repository root:
+//   g++ -std=c++17 -O2 -Itests/anope tests/rpc_chanstatsplus_periods.cpp -o periods && ./periods
+//
+// Exits non-zero if any zone has a mismatch. Needs the system zoneinfo
+// database; a missing zone silently behaves like UTC.
+
+#include "../rpc_chanstatsplus.cpp"
+#include "calendar_reference.h"
+
+namespace
+{
+	unsigned CheckZone(const char *zone)
+	{
+		CalendarReference::SetZone(zone);
+		unsigned failures = 0;
+
+		for (time_t t = CalendarReference::first; t < CalendarReference::last; t += CalendarReference::step)
+		{
+			Anope::CurTime = t;
+			const CalendarReference::Starts want = CalendarReference::For(t);
+			const Anope::string got_day = DefaultPeriodStart("daily"), got_week = DefaultPeriodStart("weekly"),
+				got_month = DefaultPeriodStart("monthly");
+			if (got_day.str() == want.day && got_week.str() == want.week && got_month.str() == want.month
+				&& DefaultPeriodStart("total") == "1970-01-01")
+				continue;
+
+			if (failures++ < 5)
+			{
+				std::cout << zone << " " << t << ": got " << got_day << " " << got_week << " " << got_month
+					<< ", want " << want.day << " " << want.week << " " << want.month << std::endl;
+			}
+		}
+		return failures;
+	}
+}
+
+int main()
+{
+	unsigned failures = 0;
+	for (const char *zone : CalendarReference::zones)
+	{
+		const unsigned zone_failures = CheckZone(zone);
+		std::cout << zone << ": " << zone_failures << " mismatches" << std::endl;
+		failures += zone_failures;
+	}
+	return failures ? 1 : 0;
+}